@@ -3,6 +3,8 @@
 #include <liboscar/AdvancedOpTree.h>
 #include <liboscar/CQRFromComplexSpatialQuery.h>
 #include <liboscar/CQRFromRouting.h>
+#include <liboscar/CellCenterIndex.h>
+#include <liboscar/CellNeighborLadder.h>
 
 #include <sserialize/spatial/CellQueryResult.h>
 #include <sserialize/Static/CellTextCompleter.h>
@@ -18,18 +20,28 @@ namespace liboscar {
 */
 class AdvancedCellOpTree: public AdvancedOpTree {
 public:
+	///Estimated number of items of a query, the exact number is in [min, max]
+	struct CountEstimate {
+		uint32_t min;
+		uint32_t max;
+		uint32_t estimate;
+	};
 	struct CalcBase {
 		CalcBase(sserialize::Static::CellTextCompleter & ctc,
 			const sserialize::Static::CQRDilator & cqrd,
 			const CQRFromComplexSpatialQuery & csq,
 			const sserialize::spatial::GeoHierarchySubGraph & ghsg,
 			const liboscar::interface::CQRFromRouting & cqrr,
+			const CellCenterIndex * cci,
+			const CellNeighborLadder * cnl,
 			uint32_t threadCount) :
 		m_ctc(ctc),
 		m_cqrd(cqrd),
 		m_csq(csq),
 		m_ghsg(ghsg),
 		m_cqrr(cqrr),
+		m_cci(cci),
+		m_cnl(cnl),
 		m_threadCount(threadCount)
 		{}
 		sserialize::Static::CellTextCompleter & m_ctc;
@@ -37,6 +49,10 @@ public:
 		const CQRFromComplexSpatialQuery & m_csq;
 		const sserialize::spatial::GeoHierarchySubGraph & m_ghsg;
 		const liboscar::interface::CQRFromRouting & m_cqrr;
+		///may be nullptr
+		const CellCenterIndex * m_cci;
+		///may be nullptr
+		const CellNeighborLadder * m_cnl;
 		uint32_t m_threadCount;
 		
 		const sserialize::Static::ItemIndexStore & idxStore() const;
@@ -49,10 +65,24 @@ public:
 
 		uint32_t threadCount() const;
 		sserialize::CellQueryResult toCQR(const sserialize::TreedCellQueryResult & cqr) const;
+		///true if a cell of cqr holds at least one item
+		static bool hasItems(const sserialize::CellQueryResult & cqr);
+		bool hasItems(const sserialize::TreedCellQueryResult & cqr) const;
+		///estimate from the sizes of the cell indexes of cqr, cellItemDuplication is the average number of cells per item
+		CountEstimate cqrEstimate(const sserialize::CellQueryResult & cqr, double cellItemDuplication) const;
+		CountEstimate cqrEstimate(const sserialize::TreedCellQueryResult & cqr, double cellItemDuplication) const;
+		///estimate of the set operation op of two operands with the estimates a and b, the operands are assumed to be independent
+		CountEstimate combineEstimates(char op, const CountEstimate & a, const CountEstimate & b) const;
+		///cells within distance meters of the cells of cqr that are not part of cqr
+		///uses the CellNeighborLadder if there is one and distance is at most its largest radius,
+		///the CellCenterIndex if there is one and the CQRDilator otherwise
+		sserialize::ItemIndex dilateCells(const sserialize::CellQueryResult & cqr, double distance) const;
 		sserialize::CellQueryResult calcBetweenOp(const sserialize::CellQueryResult & c1, const sserialize::CellQueryResult & c2);
+		sserialize::CellQueryResult calcWithinOp(Node * node, const sserialize::CellQueryResult & c1, const sserialize::CellQueryResult & c2);
 		sserialize::CellQueryResult calcCompassOp(Node * node, const sserialize::CellQueryResult & cqr);
 		sserialize::CellQueryResult calcRelevantElementOp(Node * node, const sserialize::CellQueryResult & cqr);
 		sserialize::CellQueryResult calcInOp(Node * node, const sserialize::CellQueryResult & cqr);
+		sserialize::CellQueryResult calcKnnOp(Node * node, const sserialize::CellQueryResult & cqr);
 		///th in [0, 1]
 		sserialize::ItemIndex calcDilateRegionByCellCoverageOp(double th, const sserialize::CellQueryResult & cqr);
 		sserialize::ItemIndex calcDilateRegionByCellCoverageOp(Node * node, const sserialize::CellQueryResult & cqr);
@@ -71,8 +101,10 @@ public:
 			const CQRFromComplexSpatialQuery & csq,
 			const sserialize::spatial::GeoHierarchySubGraph & ghsg,
 			const liboscar::interface::CQRFromRouting & cqrr,
+			const CellCenterIndex * cci,
+			const CellNeighborLadder * cnl,
 			uint32_t threadCount) :
-		CalcBase(ctc, cqrd, csq, ghsg, cqrr, threadCount)
+		CalcBase(ctc, cqrd, csq, ghsg, cqrr, cci, cnl, threadCount)
 		{}
 		CQRType calc(Node * node);
 		CQRType calcItem(Node * node);
@@ -96,9 +128,18 @@ public:
 		CQRType calcCompassOp(Node * node);
 		CQRType calcNearOp(Node * node);
 		CQRType calcInOp(Node * node);
+		CQRType calcKnnOp(Node * node);
 		CQRType calcRelevantElementOp(Node * node);
 		CQRType calcBinaryOp(Node * node);
 		CQRType calcBetweenOp(Node * node);
+		CQRType calcWithinOp(Node * node);
+		///true if node matches at least one item
+		///The first operand of a set operation decides the result if it is empty, the second one is not computed in this case.
+		///Both operands of a union are tested on their own, the second one is only computed if the first one is empty.
+		bool exists(Node * node);
+		///Set operations are estimated from the estimates of their operands, their item indexes are never combined.
+		///All other nodes are computed and estimated from the sizes of their cell indexes.
+		CountEstimate estimate(Node * node, double cellItemDuplication);
 	};
 public:
 	AdvancedCellOpTree(
@@ -113,8 +154,18 @@ public:
 	AdvancedCellOpTree & operator=(const AdvancedCellOpTree&) = delete;
 	///remove potential harmless queries
 	void clean(double maxDilation);
+	///use cci instead of the CQRDilator to dilate cells
+	void setCellCenterIndex(const std::shared_ptr<const CellCenterIndex> & cci) { m_cci = cci; }
+	///use cnl to dilate cells by at most cnl->maxRadius()
+	void setCellNeighborLadder(const std::shared_ptr<const CellNeighborLadder> & cnl) { m_cnl = cnl; }
 	template<typename T_CQR_TYPE>
 	T_CQR_TYPE calc(uint32_t threadCount = 1);
+	///true if the query matches at least one item, see Calc::exists()
+	template<typename T_CQR_TYPE>
+	bool exists(uint32_t threadCount = 1);
+	///estimated number of items of the query, see Calc::estimate()
+	template<typename T_CQR_TYPE>
+	CountEstimate estimate(double cellItemDuplication, uint32_t threadCount = 1);
 	
 public:
 	sserialize::Static::CellTextCompleter & ctc() { return m_ctc; }
@@ -123,12 +174,16 @@ public:
 	const CQRFromComplexSpatialQuery & csq() const { return m_csq; }
 	const sserialize::spatial::GeoHierarchySubGraph & ghsg() const { return m_ghsg; }
 	const liboscar::interface::CQRFromRouting & cqrr() const { return *m_cqrr; }
+	const CellCenterIndex * cci() const { return m_cci.get(); }
+	const CellNeighborLadder * cnl() const { return m_cnl.get(); }
 private:
 	sserialize::Static::CellTextCompleter m_ctc;
 	sserialize::Static::CQRDilator m_cqrd;
 	CQRFromComplexSpatialQuery m_csq;
 	sserialize::spatial::GeoHierarchySubGraph m_ghsg;
 	std::shared_ptr<liboscar::interface::CQRFromRouting> m_cqrr;
+	std::shared_ptr<const CellCenterIndex> m_cci;
+	std::shared_ptr<const CellNeighborLadder> m_cnl;
 };
 
 template<typename T_CQR_TYPE>
@@ -136,7 +191,7 @@ T_CQR_TYPE
 AdvancedCellOpTree::calc(uint32_t threadCount) {
 	typedef T_CQR_TYPE CQRType;
 	if (root()) {
-		Calc<CQRType> calculator(ctc(), cqrd(), csq(), ghsg(), cqrr(), threadCount);
+		Calc<CQRType> calculator(ctc(), cqrd(), csq(), ghsg(), cqrr(), cci(), cnl(), threadCount);
 		return calculator.calc( root() );
 	}
 	else {
@@ -144,6 +199,30 @@ AdvancedCellOpTree::calc(uint32_t threadCount) {
 	}
 }
 
+template<typename T_CQR_TYPE>
+bool
+AdvancedCellOpTree::exists(uint32_t threadCount) {
+	if (root()) {
+		Calc<T_CQR_TYPE> calculator(ctc(), cqrd(), csq(), ghsg(), cqrr(), cci(), cnl(), threadCount);
+		return calculator.exists( root() );
+	}
+	else {
+		return false;
+	}
+}
+
+template<typename T_CQR_TYPE>
+AdvancedCellOpTree::CountEstimate
+AdvancedCellOpTree::estimate(double cellItemDuplication, uint32_t threadCount) {
+	if (root()) {
+		Calc<T_CQR_TYPE> calculator(ctc(), cqrd(), csq(), ghsg(), cqrr(), cci(), cnl(), threadCount);
+		return calculator.estimate(root(), cellItemDuplication);
+	}
+	else {
+		return CountEstimate{0, 0, 0};
+	}
+}
+
 template<typename T_CQR_TYPE>
 T_CQR_TYPE
 AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcRect(AdvancedCellOpTree::Node* node) {
@@ -164,8 +243,8 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcRect(AdvancedCellOpTree::Node* node) {
 template<typename T_CQR_TYPE>
 T_CQR_TYPE
 AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcPolygon(AdvancedCellOpTree::Node* node) {
-	//first construct the polygon out of the values
-	std::vector<sserialize::spatial::GeoPoint> gps;
+	//first construct the polygons out of the values, each with its outer ring first
+	std::vector< std::vector<sserialize::spatial::GeoPolygon> > polygons(1);
 	liboscar::CQRFromPolygon::Accuracy ac = liboscar::CQRFromPolygon::AC_AUTO;
 	{
 		struct MyOut {
@@ -195,18 +274,55 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcPolygon(AdvancedCellOpTree::Node* node
 		else {
 			pos = 0;
 		}
-		sserialize::split<std::string::const_iterator, MyS, MyS, MyOut>(node->value.begin()+pos, node->value.end(), MyS(','), MyS('\\'), MyOut(&gps));
+		//rings are separated by ';' (holes of the current polygon) and '|' (start of a further polygon)
+		while (pos <= node->value.size()) {
+			auto ringEnd = node->value.find_first_of(";|", pos);
+			if (ringEnd == std::string::npos) {
+				ringEnd = node->value.size();
+			}
+			std::vector<sserialize::spatial::GeoPoint> gps;
+			sserialize::split<std::string::const_iterator, MyS, MyS, MyOut>(node->value.begin()+pos, node->value.begin()+ringEnd, MyS(','), MyS('\\'), MyOut(&gps));
+			if (gps.size() >= 3) {
+				//check if back and front are the same, if not, close the ring:
+				if (!sserialize::spatial::equal(gps.back(), gps.front(), 0.0)) {
+					gps.push_back(gps.front());
+				}
+				polygons.back().emplace_back(std::move(gps));
+			}
+			if (ringEnd < node->value.size() && node->value[ringEnd] == '|' && polygons.back().size()) {
+				polygons.emplace_back();
+			}
+			pos = ringEnd+1;
+		}
+		if (!polygons.back().size()) {
+			polygons.pop_back();
+		}
 	}
-	if (gps.size() < 3) {
+	if (!polygons.size()) {
 		return T_CQR_TYPE();
 	}
-	//check if back and front are the same, if not, close the polygon:
-	if (!sserialize::spatial::equal(gps.back(), gps.front(), 0.0)) {
-		gps.push_back(gps.front());
-	}
 	
-	sserialize::CellQueryResult cqr = m_csq.cqrfp().cqr(sserialize::spatial::GeoPolygon(std::move(gps)), ac, m_ctc.flags(), m_threadCount);
-	return T_CQR_TYPE(cqr);
+	std::vector<sserialize::CellQueryResult> results;
+	results.reserve(polygons.size());
+	for(const std::vector<sserialize::spatial::GeoPolygon> & rings : polygons) {
+		if (rings.size() == 1) {
+			results.push_back( m_csq.cqrfp().cqr(rings.front(), ac, m_ctc.flags(), m_threadCount) );
+		}
+		else {
+			results.push_back( m_csq.cqrfp().cqr(PreparedGeoPolygon(rings), ac, m_ctc.flags(), m_threadCount) );
+		}
+	}
+	if (results.size() == 1) {
+		return T_CQR_TYPE(results.front());
+	}
+	return T_CQR_TYPE(
+		sserialize::treeReduce<std::vector<sserialize::CellQueryResult>::const_iterator, sserialize::CellQueryResult>(
+			results.begin(),
+			results.end(),
+			std::plus<sserialize::CellQueryResult>(),
+			threadCount()
+		)
+	);
 }
 
 template<typename T_CQR_TYPE>
@@ -238,7 +354,7 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcPath(AdvancedCellOpTree::Node* node) {
 		else {
 			auto tmp = m_ctc.cqrAlongPath<sserialize::CellQueryResult>(0.0, gp.begin(), gp.end());
 			if (radius > 0.0) {
-				return CQRType(m_cqrd.dilate(tmp, radius, m_threadCount), ci(), idxStore(), tmp.flags()) + CQRType(tmp);
+				return CQRType(dilateCells(tmp, radius), ci(), idxStore(), tmp.flags()) + CQRType(tmp);
 			}
 			else {
 				return CQRType(tmp);
@@ -456,6 +572,14 @@ template<>
 sserialize::TreedCellQueryResult
 AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcBetweenOp(AdvancedCellOpTree::Node* node);
 
+template<>
+sserialize::CellQueryResult
+AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcWithinOp(AdvancedCellOpTree::Node* node);
+
+template<>
+sserialize::TreedCellQueryResult
+AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcWithinOp(AdvancedCellOpTree::Node* node);
+
 template<>
 sserialize::CellQueryResult
 AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcCompassOp(AdvancedCellOpTree::Node* node);
@@ -472,6 +596,14 @@ template<>
 sserialize::TreedCellQueryResult
 AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcInOp(AdvancedCellOpTree::Node* node);
 
+template<>
+sserialize::CellQueryResult
+AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcKnnOp(AdvancedCellOpTree::Node* node);
+
+template<>
+sserialize::TreedCellQueryResult
+AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcKnnOp(AdvancedCellOpTree::Node* node);
+
 template<>
 sserialize::CellQueryResult
 AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcRelevantElementOp(AdvancedCellOpTree::Node* node);
@@ -561,6 +693,8 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calc(AdvancedCellOpTree::Node* node) {
 			return calcRelevantElementOp(node);
 		case Node::QUERY_EXCLUSIVE_CELLS:
 			return calcQueryExclusiveCells(node);
+		case Node::KNN_OP:
+			return calcKnnOp(node);
 		default:
 			break;
 		};
@@ -571,6 +705,8 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calc(AdvancedCellOpTree::Node* node) {
 			return calcBinaryOp(node);
 		case Node::BETWEEN_OP:
 			return calcBetweenOp(node);
+		case Node::WITHIN_OP:
+			return calcWithinOp(node);
 		default:
 			break;
 		};
@@ -581,6 +717,69 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calc(AdvancedCellOpTree::Node* node) {
 	return CQRType();
 }
 
+template<typename T_CQR_TYPE>
+bool
+AdvancedCellOpTree::Calc<T_CQR_TYPE>::exists(AdvancedCellOpTree::Node* node) {
+	if (!node) {
+		return false;
+	}
+	if (node->baseType == Node::BINARY_OP && node->subType == Node::SET_OP && node->value.size() == 1) {
+		switch (node->value.front()) {
+		case '+':
+			return exists(node->children.front()) || exists(node->children.back());
+		case '/':
+		case ' ':
+		{
+			CQRType first( calc(node->children.front()) );
+			if (!hasItems(first)) {
+				return false;
+			}
+			CQRType second( calc(node->children.back()) );
+			if (!hasItems(second)) {
+				return false;
+			}
+			return hasItems(first / second);
+		}
+		case '-':
+		{
+			CQRType first( calc(node->children.front()) );
+			if (!hasItems(first)) {
+				return false;
+			}
+			return hasItems(first - calc(node->children.back()));
+		}
+		default:
+			break;
+		}
+	}
+	return hasItems(calc(node));
+}
+
+template<typename T_CQR_TYPE>
+AdvancedCellOpTree::CountEstimate
+AdvancedCellOpTree::Calc<T_CQR_TYPE>::estimate(AdvancedCellOpTree::Node* node, double cellItemDuplication) {
+	if (!node) {
+		return CountEstimate{0, 0, 0};
+	}
+	if (node->baseType == Node::BINARY_OP && node->subType == Node::SET_OP && node->value.size() == 1) {
+		switch (node->value.front()) {
+		case '+':
+		case '/':
+		case ' ':
+		case '-':
+		case '^':
+			return combineEstimates(
+				node->value.front(),
+				estimate(node->children.front(), cellItemDuplication),
+				estimate(node->children.back(), cellItemDuplication)
+			);
+		default:
+			break;
+		}
+	}
+	return cqrEstimate(calc(node), cellItemDuplication);
+}
+
 }//end namespace
 
 #endif
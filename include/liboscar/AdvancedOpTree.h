@@ -8,7 +8,7 @@
 /** The AdvancedOpTree supports the following query language:
   *
   *
-  * Q := FM_CONVERSION Q | DILATION Q | COMPASS Q | Q BETWEEN_OP Q | Q BINARY_OP Q
+  * Q := FM_CONVERSION Q | DILATION Q | COMPASS Q | KNN Q | Q BETWEEN_OP Q | Q WITHIN_OP Q | Q BINARY_OP Q
   * Q := (Q) | Q Q
   * Q := ITEM | GEO_RECT | GEO_PATH | REGION | CELL
   * FM_CONVERSION := %
@@ -18,7 +18,15 @@
   * COMPASS_OP := :^ | :v | :> | :< | :north-of | :east-of | :south-of | :west-of
   * USER_FRIENDLY := :in | :near | in | near
   * RELEVANT_ELEMENT_OP := *
+  * KNN := $knn:k,lat,lon
+  *   the k items of the following query that are closest to (lat, lon)
   * BETWEEN_OP := <-> | :between
+  *   the area between the items or regions of both queries, a query with few items is reduced to its most relevant item
+  *   Regions are represented by the convex hull of their geometry and the area is the convex hull of both operands.
+  *   This hull also covers the areas beside the operands, e.g. next to two long regions lying side by side.
+  *   The cells of the regions are removed from the result if both operands are regions.
+  * WITHIN_OP := :within:<meters>
+  *   the items of the left query that are at most <meters> away from an item of the right query, items contained in both queries are always kept
   * BINARY_OP := - | + | INTERSECTION | ^ |
   * INTERSECTION := ' ' | / | , | .
   * FUNCTION_CALL := $function_name FUNCTION_CALL_PARAMETER_SPEC
@@ -27,7 +35,10 @@
   * ITEM := $item:<itemId>
   * GEO_RECT := $geo:[ACCURACY_DEFINITION]:<rect-definition>
   * POINT := $point:radius,lat,lon
-  * POLYGON := $poly:[ACCURACY_DEFINITION]:[lat,lon]
+  * POLYGON := $poly:[ACCURACY_DEFINITION]:RING[;RING]*[|RING[;RING]*]*
+  * RING := [lat,lon]
+  *   The rings of a polygon are separated by ';' and combined with the even-odd rule, i.e. the rings after the first are its holes.
+  *   Polygons are separated by '|', the result is the union of the results of the polygons.
   * GEO_PATH := $path:radius,[lat,lon]
   * ROUTE := $route:radius,options,[lat,lon]* | $route(radius, options, [lat, lon]*)
   * REGION := $region:<storeId>
@@ -48,8 +59,8 @@ struct Node {
 	enum OpType : int {
 		FM_CONVERSION_OP, CELL_DILATION_OP, REGION_DILATION_BY_CELL_COVERAGE_OP, REGION_DILATION_BY_ITEM_COVERAGE_OP, COMPASS_OP, RELEVANT_ELEMENT_OP,
 		IN_OP, NEAR_OP,
-		SET_OP, BETWEEN_OP,
-		QUERY_EXCLUSIVE_CELLS,
+		SET_OP, BETWEEN_OP, WITHIN_OP,
+		QUERY_EXCLUSIVE_CELLS, KNN_OP,
 		FUNCTION_CALL,
 		STRING, STRING_ITEM, STRING_REGION,
 
@@ -89,6 +100,7 @@ struct Token {
 		COMPASS_OP,
 		RELEVANT_ELEMENT_OP,
 		BETWEEN_OP,
+		WITHIN_OP,
 		IN_OP,
 		NEAR_OP,
 		SET_OP,
@@ -111,7 +123,8 @@ struct Token {
 		CELLS,
 		TRIANGLE,
 		TRIANGLES,
-		ROUTE
+		ROUTE,
+		KNN
 	};
 	int type;
 	std::string value;
@@ -3,6 +3,8 @@
 #include <sserialize/spatial/CellQueryResult.h>
 #include <sserialize/Static/GeoHierarchySubGraph.h>
 #include "CQRFromPolygon.h"
+#include <memory>
+#include <mutex>
 
 namespace liboscar {
 namespace detail {
@@ -11,17 +13,54 @@ class CQRFromComplexSpatialQuery;
 
 }//end namespace detail
 
+/** Convex hulls of the region geometries of a GeoHierarchy.
+  * Hulls are computed on first access or all at once by precompute() and then cached.
+  * The cache is meant to be shared between queries and is thread-safe.
+  */
+class RegionHullCache final {
+public:
+	using Hull = std::vector<sserialize::spatial::GeoPoint>;
+	using HullPtr = std::shared_ptr<const Hull>;
+public:
+	RegionHullCache(const liboscar::Static::OsmKeyValueObjectStore & store);
+	~RegionHullCache();
+	///@return the convex hull of the region geometry of the region with the given ghId
+	HullPtr hull(uint32_t ghId) const;
+	///compute the hulls of all regions
+	void precompute(uint32_t threadCount);
+	///appends the points of the outer boundary of shape to dest
+	static void appendPoints(const sserialize::Static::spatial::GeoShape & shape, Hull & dest);
+	///computes the convex hull of points, the result is appended to dest
+	static void convexHull(const Hull & points, Hull & dest);
+	///convex hull of the outer boundary of shape
+	static HullPtr shapeHull(const sserialize::Static::spatial::GeoShape & shape);
+private:
+	liboscar::Static::OsmKeyValueObjectStore m_store;
+	mutable std::mutex m_lock;
+	mutable std::vector<HullPtr> m_hulls;
+};
+
 class CQRFromComplexSpatialQuery final {
 public:
 	enum UnaryOp : uint32_t {UO_INVALID=0, UO_NORTH_OF, UO_EAST_OF, UO_SOUTH_OF, UO_WEST_OF};
 	enum BinaryOp : uint32_t {BO_INVALID=0, BO_BETWEEN};
 public:
 	CQRFromComplexSpatialQuery(const CQRFromComplexSpatialQuery & other);
-	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp);
+	///@param regionHulls cache of region hulls used by betweenOp, hulls are computed per query if it is not set
+	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp, const std::shared_ptr<RegionHullCache> & regionHulls = std::shared_ptr<RegionHullCache>());
 	~CQRFromComplexSpatialQuery();
 	sserialize::CellQueryResult compassOp(const sserialize::CellQueryResult & cqr, UnaryOp direction, uint32_t threadCount) const;
 	sserialize::CellQueryResult relevantElementOp(const sserialize::CellQueryResult & cqr) const;
+	///Area between the relevant items or regions of cqr1 and cqr2.
+	///Involving a region, the area is the convex hull of the region hull and the hull of the other operand.
+	///It is therefore larger than the area strictly between them wherever the operands are wide compared to their distance.
+	///If both operands are regions then their cells are not part of the result.
 	sserialize::CellQueryResult betweenOp(const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, uint32_t threadCount) const;
+	///@return the k items of cqr that are closest to p, the result has global item ids
+	sserialize::CellQueryResult knnOp(const sserialize::CellQueryResult & cqr, const sserialize::spatial::GeoPoint & p, uint32_t k) const;
+	///@return the items of cqr1 whose geometry is at most distance meters away from the geometry of an item of cqr2, the result has global item ids
+	///Items that are part of both operands are always part of the result, i.e. A :within:0 A is A
+	sserialize::CellQueryResult withinOp(const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, double distance, uint32_t threadCount) const;
 	const liboscar::CQRFromPolygon & cqrfp() const;
 private:
 	sserialize::RCPtrWrapper<detail::CQRFromComplexSpatialQuery> m_priv;
@@ -36,11 +75,19 @@ public:
 private:
 	enum QueryItemType : uint32_t { QIT_INVALID=0, QIT_ITEM=1, QIT_REGION=2};
 public:
-	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph& ssc, const liboscar::CQRFromPolygon& cqrfp);
+	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph& ssc, const liboscar::CQRFromPolygon& cqrfp, const std::shared_ptr<liboscar::RegionHullCache> & regionHulls);
 	virtual ~CQRFromComplexSpatialQuery();
 	sserialize::CellQueryResult relevantElementOp(const sserialize::CellQueryResult& cqr) const;
 	sserialize::CellQueryResult compassOp(const sserialize::CellQueryResult& cqr, liboscar::CQRFromComplexSpatialQuery::UnaryOp direction, uint32_t threadCount) const;
 	sserialize::CellQueryResult betweenOp(const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, uint32_t threadCount) const;
+	///Visits the cells of cqr in increasing order of their distance to p and stops
+	///as soon as the k-th best item is closer than the next cell.
+	///Distances are measured in an equirectangular projection centered at p.
+	sserialize::CellQueryResult knnOp(const sserialize::CellQueryResult & cqr, const sserialize::spatial::GeoPoint & p, uint32_t k) const;
+	///Spatial join, the cells of cqr1 are processed in parallel.
+	///Candidate cells of cqr2 are found by a search in the cell graph that is pruned by the distance of the cell bounding boxes.
+	///Candidate item pairs are then filtered by their bounding boxes before their geometries are compared.
+	sserialize::CellQueryResult withinOp(const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, double distance, uint32_t threadCount) const;
 	const liboscar::CQRFromPolygon & cqrfp() const;
 public: //cqr creation
 	//uses auto-detection of accuracy
@@ -55,6 +102,10 @@ private://polygon creation functions for betweenOp
 	void createPolygon(const sserialize::Static::spatial::GeoWay & gw, const sserialize::Static::spatial::GeoPoint & gp, std::vector< sserialize::spatial::GeoPoint >& pp) const;
 	void createPolygon(const sserialize::spatial::GeoRect & polyRect, const sserialize::spatial::GeoPoint & point, std::vector< sserialize::spatial::GeoPoint >& pp) const;
 	void createPolygon(const sserialize::spatial::GeoRect & polyRect, const sserialize::Static::spatial::GeoWay & gw, std::vector< sserialize::spatial::GeoPoint >& pp) const;
+	///convex hull of both hulls
+	void createPolygon(const RegionHullCache::Hull & hull1, const RegionHullCache::Hull & hull2, std::vector< sserialize::spatial::GeoPoint >& pp) const;
+	RegionHullCache::HullPtr regionHull(uint32_t ghId) const;
+	RegionHullCache::HullPtr itemHull(uint32_t itemId) const;
 private: //polygon creation functions for compassOp
 	void createPolygon(const sserialize::spatial::GeoPoint & point, double distance, liboscar::CQRFromComplexSpatialQuery::UnaryOp direction, std::vector< sserialize::spatial::GeoPoint >& pp) const;
 	void createPolygon(const sserialize::Static::spatial::GeoWay & way, liboscar::CQRFromComplexSpatialQuery::UnaryOp direction, std::vector< sserialize::spatial::GeoPoint >& pp) const;
@@ -69,6 +120,8 @@ private:
 	///if qit == QIT_REGION then id is ghId
 	void determineQueryItemType(const sserialize::CellQueryResult& cqr, QueryItemType& qit, uint32_t & id) const;
 	void determineQueryItemTypeOld(const sserialize::CellQueryResult & cqr, QueryItemType & qit, uint32_t & id) const;
+	///@return true if cqr has less than threshold distinct items, these are then stored sorted in items
+	bool itemCountSmallerThan(const sserialize::CellQueryResult & cqr, uint32_t threshold, std::vector<uint32_t> & items) const;
 	
 private: //accessor function
 	const liboscar::Static::OsmKeyValueObjectStore & store() const;
@@ -78,6 +131,7 @@ private: //accessor function
 private:
 	sserialize::spatial::GeoHierarchySubGraph m_ssc;
 	liboscar::CQRFromPolygon m_cqrfp;
+	std::shared_ptr<liboscar::RegionHullCache> m_regionHulls;
 	uint32_t m_itemQueryItemCountTh;
 	uint32_t m_itemQueryCellCountTh;
 };
@@ -1,9 +1,18 @@
 #ifndef LIBOSCAR_CQR_FROM_POLYGON_H
 #define LIBOSCAR_CQR_FROM_POLYGON_H
 #include "OsmKeyValueObjectStore.h"
+#include "PreparedGeoPolygon.h"
+#include "CellItemRTree.h"
 #include <sserialize/spatial/GeoPolygon.h>
 #include <sserialize/Static/GeoPolygon.h>
 #include <sserialize/Static/GeoMultiPolygon.h>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace liboscar {
 namespace detail {
@@ -28,12 +37,81 @@ public:
 		ACT_USE_LENGTH_OVER_DIAGONAL_RATIO=20 //if the length of the polygon is more than 20 times longer than its diagonal, then use the length/20 as threshould value
 	};
 	
+	///Tile pyramid of the optional tile cache, see setTileCacheSize()
+	enum TileCacheParameters : uint32_t {
+		TCP_MIN_ZOOM=2,
+		TCP_MAX_ZOOM=18,
+		TCP_TILES_PER_DIMENSION=4, //zoom level is chosen such that a query spans about this many tiles per dimension
+		TCP_MAX_TILES=256 //queries covering more tiles bypass the cache
+	};
+	
+	/** Runtime parameters of AC_AUTO, see setAutoAccuracyParameters().
+	  * AC_AUTO first selects an accuracy by the extent of the polygon (see AccurayThresholds).
+	  * It then estimates the work of this accuracy from the number of cells whose bounding box
+	  * intersects the bounding box of the polygon and the number of items in these cells.
+	  * If the estimate exceeds the work budget of the accuracy, the next cheaper accuracy is tried.
+	  * Work is measured in edge tests, one item or cell access counts as itemAccessWork/cellAccessWork edge tests.
+	  */
+	struct AutoAccuracyParameters {
+		double polygonItemExtent{ACT_POLYGON_ITEM};
+		double polygonItemBBoxExtent{ACT_POLYGON_ITEM_BBOX};
+		double polygonCellBBoxExtent{ACT_POLYGON_CELL_BBOX};
+		double lengthOverDiagonalRatio{ACT_USE_LENGTH_OVER_DIAGONAL_RATIO};
+		double itemAccessWork{32};
+		double cellAccessWork{64};
+		double polygonItemWork{32*1024*1024};
+		double polygonItemBBoxWork{32*1024*1024};
+		double polygonCellBBoxWork{64*1024*1024};
+	};
+	
+	///Number of queries resolved to each accuracy by AC_AUTO
+	struct AutoAccuracyStats {
+		///indexed by Accuracy, entry AC_AUTO is the total number of AC_AUTO queries
+		std::array<uint64_t, AC_POLYGON_BBOX_CELL_BBOX+1> chosen{};
+		///number of queries whose accuracy was lowered due to the work estimate
+		uint64_t demoted{0};
+	};
+	
+	/** Polygons with more than SP_MIN_EDGES edges are simplified before cells are tested against them.
+	  * The tolerance is 1/SP_CELL_FRACTION of the smallest extent of the cells containing SP_SAMPLES vertices of the polygon.
+	  * Cell tests account for the simplification error, hence results stay exact for item accuracies
+	  * and only cells within the tolerance of the polygon may be added for cell accuracies.
+	  * Regions and items are always tested against the original polygon.
+	  */
+	enum SimplificationParameters : uint32_t {
+		SP_MIN_EDGES=256,
+		SP_CELL_FRACTION=16,
+		SP_SAMPLES=16
+	};
+	
+	/** Strategies to collect the cells of a query polygon.
+	  * The walk locates one vertex of each ring in the triangulation and flood-fills the triangles intersecting the polygon.
+	  * This yields exactly the cells intersecting the polygon.
+	  * If the cells whose bbox intersects the bbox of the polygon are known (see autoAccuracy()),
+	  * the walk may visit as many triangles as these candidate cells have on average.
+	  * It is therefore at most a constant factor more expensive than testing all candidate cells.
+	  * Otherwise counting the candidates would cost another query of the hierarchy,
+	  * so only polygons with a diagonal below VP_WALK_MAX_DIAGONAL meters walk and at most VP_WALK_MAX_FACES triangles.
+	  * If the walk is aborted (or a vertex is outside the triangulation),
+	  * polygons with a diagonal below VP_PATH_MAX_DIAGONAL meters use the cells along their boundary
+	  * and all others descend the region hierarchy.
+	  */
+	enum VisitParameters : uint32_t {
+		VP_PATH_MAX_DIAGONAL=1000,
+		VP_WALK_MAX_DIAGONAL=50*1000,
+		VP_WALK_MAX_FACES=64*1024
+	};
+	
 	using CellInfo = sserialize::CellQueryResult::CellInfo;
 	
 public:
+	///creates an invalid object
+	CQRFromPolygon();
 	CQRFromPolygon(const CQRFromPolygon & other);
 	CQRFromPolygon(const Static::OsmKeyValueObjectStore & store, const sserialize::Static::ItemIndexStore & idxStore);
 	~CQRFromPolygon();
+	///false if this was created by the default constructor
+	inline bool valid() const { return m_priv.priv(); }
 	const Static::OsmKeyValueObjectStore & store() const;
 	const CellInfo & cellInfo() const;
 	const sserialize::Static::spatial::GeoHierarchy & geoHierarchy() const;
@@ -42,7 +120,31 @@ public:
 	sserialize::ItemIndex fullMatches(const sserialize::spatial::GeoPolygon & gp, Accuracy ac, uint32_t threadCount) const;
 	///supports AC_POLYGON_ITEM_BBOX and AC_POLYGON_ITEM, does NOT support AC_POLYGON_CELL, falls back to AC_POLYGON_CELL_BBOX
 	sserialize::CellQueryResult cqr(const sserialize::spatial::GeoPolygon & gp, Accuracy ac, int cqrFlags, uint32_t threadCount) const;
+	///same as above but with an already prepared polygon, usefull if the polygon is used more than once
+	sserialize::CellQueryResult cqr(const PreparedGeoPolygon & pgp, Accuracy ac, int cqrFlags, uint32_t threadCount) const;
 	sserialize::CellQueryResult cqr(const sserialize::spatial::GeoPoint & gp, double radius, Accuracy ac, int cqrFlags, uint32_t threadCount) const;
+public:
+	/** Enable the tile cache by setting maxTiles > 0.
+	  * Queries are then snapped to an equirectangular tile pyramid (zoom level depends on the query extent)
+	  * and the result is the union of per-tile results which are kept in a LRU cache of maxTiles entries.
+	  * Tiles completely covered by the query are always served from the cache.
+	  * Border tiles are computed exactly for item accuracies, cell accuracies use the cached tile as well.
+	  * Hence for cell accuracies the result is a superset of the uncached result.
+	  * This function is not thread-safe, call it before issuing queries.
+	  * The cache itself is shared among all copies of this object and is thread-safe.
+	  */
+	void setTileCacheSize(uint32_t maxTiles);
+	uint32_t tileCacheSize() const;
+	/** Point queries with radius 0 only test items whose bounding box contains the point if a tree is set.
+	  * The tree has to be built for the GeoHierarchy of store(). Pass an empty tree to disable it.
+	  * This function is not thread-safe, call it before issuing queries.
+	  */
+	void setCellItemRTree(const CellItemRTree & tree);
+	///This function is thread-safe
+	void setAutoAccuracyParameters(const AutoAccuracyParameters & params);
+	AutoAccuracyParameters autoAccuracyParameters() const;
+	AutoAccuracyStats autoAccuracyStats() const;
+	std::ostream & printStats(std::ostream & out) const;
 public:
 	///unparseable strings map to AC_AUTO
 	static Accuracy toAccuracy(std::string const & str);
@@ -74,33 +176,106 @@ public:
 	const CellInfo & cellInfo() const;
 	const sserialize::Static::spatial::GeoHierarchy & geoHierarchy() const;
 	const sserialize::Static::ItemIndexStore & idxStore() const;
-	sserialize::ItemIndex fullMatches(const sserialize::spatial::GeoPolygon& gp, Accuracy ac, uint32_t threadCount) const;
-	sserialize::CellQueryResult cqr(const sserialize::spatial::GeoPolygon & gp, Accuracy ac, int cqrFlags, uint32_t threadCount) const;
+	sserialize::ItemIndex fullMatches(const PreparedGeoPolygon & pgp, Accuracy ac, uint32_t threadCount) const;
+	sserialize::CellQueryResult cqr(const PreparedGeoPolygon & pgp, Accuracy ac, int cqrFlags, uint32_t threadCount) const;
 	sserialize::CellQueryResult cqr(const sserialize::spatial::GeoPoint & gp, double radius, Accuracy ac, int cqrFlags, uint32_t threadCount) const;
+	void setTileCacheSize(uint32_t maxTiles);
+	uint32_t tileCacheSize() const;
+	void setCellItemRTree(const CellItemRTree & tree);
+	void setAutoAccuracyParameters(const liboscar::CQRFromPolygon::AutoAccuracyParameters & params);
+	liboscar::CQRFromPolygon::AutoAccuracyParameters autoAccuracyParameters() const;
+	liboscar::CQRFromPolygon::AutoAccuracyStats autoAccuracyStats() const;
+private:
+	struct TileKey {
+		uint32_t zoom;
+		uint32_t x;
+		uint32_t y;
+		Accuracy ac;
+		int cqrFlags;
+		bool operator==(const TileKey & other) const;
+	};
+	struct TileKeyHash {
+		std::size_t operator()(const TileKey & k) const;
+	};
+	class TileCache final {
+	public:
+		TileCache(uint32_t maxSize);
+		~TileCache();
+		inline uint32_t maxSize() const { return m_maxSize; }
+		bool get(const TileKey & key, sserialize::CellQueryResult & dest);
+		void insert(const TileKey & key, const sserialize::CellQueryResult & cqr);
+	private:
+		using Entry = std::pair<TileKey, sserialize::CellQueryResult>;
+	private:
+		std::mutex m_lock;
+		uint32_t m_maxSize;
+		///most recently used entry at the front
+		std::list<Entry> m_entries;
+		std::unordered_map<TileKey, std::list<Entry>::iterator, TileKeyHash> m_index;
+	};
 private:
+	///resolves AC_AUTO
+	///@param bboxCells set to the cells whose bbox intersects the bbox of pgp if the work estimate needed them, empty otherwise
+	Accuracy autoAccuracy(const PreparedGeoPolygon & pgp, uint32_t threadCount, sserialize::ItemIndex & bboxCells) const;
+	///@param bboxCells the cells whose bbox intersects the bbox of pgp if they are known already, may be nullptr
+	sserialize::CellQueryResult uncachedCqr(const PreparedGeoPolygon & pgp, Accuracy ac, int cqrFlags, uint32_t threadCount, const sserialize::ItemIndex * bboxCells = nullptr) const;
+	sserialize::CellQueryResult tiledCqr(const PreparedGeoPolygon & pgp, Accuracy ac, int cqrFlags, uint32_t threadCount, const sserialize::ItemIndex * bboxCells = nullptr) const;
+	///@param bboxCells see uncachedCqr(), replace the candidate cells of small polygons and filter the exclusive cells of regions
 	template<typename T_OPERATOR>
-	void visit(const sserialize::spatial::GeoPolygon & gp, const sserialize::Static::spatial::GeoPolygon& sgp, T_OPERATOR & op) const;
-	sserialize::Static::spatial::GeoPolygon toStatic(const sserialize::spatial::GeoPolygon & gp) const;
-	sserialize::ItemIndex intersectingCellsPolygonCellBBox(const sserialize::spatial::GeoPolygon & gp) const;
+	void visit(const PreparedGeoPolygon & pgp, T_OPERATOR & op, const sserialize::ItemIndex * bboxCells) const;
+	///returns false if the walk was aborted after maxFaces triangles, see VisitParameters
+	bool cellsByTriangulationWalk(const PreparedGeoPolygon & pgp, uint32_t maxFaces, sserialize::ItemIndex & cells) const;
+	///average number of triangles per cell
+	double facesPerCell() const;
+	bool intersects(const PreparedGeoPolygon & pgp, const sserialize::Static::spatial::GeoShape & region) const;
+	bool encloses(const PreparedGeoPolygon & pgp, const sserialize::Static::spatial::GeoShape & region) const;
+	///returns pgp or a simplified version of it stored in storage, see SimplificationParameters
+	const PreparedGeoPolygon & cellTestPolygon(const PreparedGeoPolygon & pgp, PreparedGeoPolygon & storage) const;
+	///cellPgp is used to test cells, regions are tested with pgp
+	sserialize::ItemIndex intersectingCellsPolygonCellBBox(const PreparedGeoPolygon & pgp, const PreparedGeoPolygon & cellPgp, const sserialize::ItemIndex * bboxCells = nullptr) const;
 	template<typename T_OPERATOR>
-	sserialize::CellQueryResult intersectingCellsPolygonItem(const sserialize::spatial::GeoPolygon & gp) const;
+	sserialize::CellQueryResult intersectingCellsPolygonItem(const PreparedGeoPolygon & pgp, const PreparedGeoPolygon & cellPgp, const sserialize::ItemIndex * bboxCells = nullptr) const;
 private:
 	Static::OsmKeyValueObjectStore m_store;
 	sserialize::Static::ItemIndexStore m_idxStore;
 	CellInfo m_ci;
+	std::unique_ptr<TileCache> m_tileCache;
+	CellItemRTree m_cellItemRTree;
+	mutable std::mutex m_autoParamsLock;
+	liboscar::CQRFromPolygon::AutoAccuracyParameters m_autoParams;
+	mutable std::array<std::atomic<uint64_t>, liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX+1> m_autoChosen;
+	mutable std::atomic<uint64_t> m_autoDemoted;
 };
 
 template<typename T_OPERATOR>
-void CQRFromPolygon::visit(const sserialize::spatial::GeoPolygon& gp, const sserialize::Static::spatial::GeoPolygon& sgp, T_OPERATOR & op) const {
+void CQRFromPolygon::visit(const PreparedGeoPolygon & pgp, T_OPERATOR & op, const sserialize::ItemIndex * bboxCells) const {
 	typedef sserialize::Static::spatial::GeoHierarchy::Region Region;
 	typedef sserialize::Static::spatial::GeoHierarchy GeoHierarchy;
 
 	const GeoHierarchy & gh = m_store.geoHierarchy();
-	sserialize::spatial::GeoRect rect(gp.boundary());
+	sserialize::spatial::GeoRect rect(pgp.boundary());
 	
 	double rectDiag = rect.diagInM();
-	if (rectDiag < 1000) {
-		sserialize::ItemIndex cellCandidates = m_store.regionArrangement().cellsAlongPath(rectDiag/2.0, gp.points().cbegin(), gp.points().cend());
+	uint32_t maxWalkFaces = 0;
+	if (bboxCells) {
+		maxWalkFaces = uint32_t( std::min<double>(bboxCells->size()*facesPerCell(), std::numeric_limits<uint32_t>::max()) );
+	}
+	else if (rectDiag < liboscar::CQRFromPolygon::VP_WALK_MAX_DIAGONAL) {
+		maxWalkFaces = liboscar::CQRFromPolygon::VP_WALK_MAX_FACES;
+	}
+	sserialize::ItemIndex walkCells;
+	if (maxWalkFaces && cellsByTriangulationWalk(pgp, maxWalkFaces, walkCells)) {
+		op.candidates(walkCells);
+	}
+	else if (bboxCells && rectDiag < liboscar::CQRFromPolygon::VP_PATH_MAX_DIAGONAL) {
+		op.candidates(*bboxCells);
+	}
+	else if (rectDiag < liboscar::CQRFromPolygon::VP_PATH_MAX_DIAGONAL) {
+		sserialize::ItemIndex cellCandidates;
+		for(std::size_t i(0), s(pgp.ringCount()); i < s; ++i) {
+			sserialize::ItemIndex ringCells = m_store.regionArrangement().cellsAlongPath(rectDiag/2.0, pgp.ringBegin(i), pgp.ringEnd(i));
+			cellCandidates = i ? cellCandidates + ringCells : ringCells;
+		}
 		op.candidates(cellCandidates);
 	}
 	else {
@@ -111,8 +286,7 @@ void CQRFromPolygon::visit(const sserialize::spatial::GeoPolygon& gp, const sser
 			uint32_t childId = r.child(i);
 			if (rect.overlap(gh.regionBoundary(childId))) {
 				uint32_t childStoreId = gh.ghIdToStoreId(childId);
-				sserialize::Static::spatial::GeoShape gs(m_store.geoShape(childStoreId));
-				if(gs.get<sserialize::spatial::GS_REGION>()->intersects(sgp)) {
+				if(intersects(pgp, m_store.geoShape(childStoreId))) {
 					queue.push_back(childId);
 					visitedRegions.insert(childId);
 				}
@@ -122,15 +296,7 @@ void CQRFromPolygon::visit(const sserialize::spatial::GeoPolygon& gp, const sser
 			//by definition: regions in the queue intersect the query polygon
 			r = gh.region(queue.front());
 			queue.pop_front();
-			sserialize::Static::spatial::GeoShape gs(m_store.geoShape(r.storeId()));
-			bool enclosed = false;
-			if (gs.type() == sserialize::spatial::GS_POLYGON) {
-				enclosed = sgp.encloses(*(gs.get<sserialize::spatial::GS_POLYGON>()));
-			}
-			else if (gs.type() == sserialize::spatial::GS_MULTI_POLYGON) {
-				enclosed = gs.get<sserialize::spatial::GS_MULTI_POLYGON>()->enclosed(sgp);
-			}
-			if (enclosed) {
+			if (encloses(pgp, m_store.geoShape(r.storeId()))) {
 				//checking the itemsCount of the region does only work if the hierarchy was created with a full region item index
 				//so instead we have to check the cellcount
 				uint32_t cIdxPtr = r.cellIndexPtr();
@@ -144,8 +310,7 @@ void CQRFromPolygon::visit(const sserialize::spatial::GeoPolygon& gp, const sser
 					uint32_t childId = r.child(i);
 					if (!visitedRegions.count(childId) && rect.overlap(gh.regionBoundary(childId))) {
 						uint32_t childStoreId = gh.ghIdToStoreId(childId);
-						sserialize::Static::spatial::GeoShape gs(m_store.geoShape(childStoreId));
-						if(gs.get<sserialize::spatial::GS_REGION>()->intersects(sgp)) {
+						if(intersects(pgp, m_store.geoShape(childStoreId))) {
 							queue.push_back(childId);
 							visitedRegions.insert(childId);
 						}
@@ -155,7 +320,7 @@ void CQRFromPolygon::visit(const sserialize::spatial::GeoPolygon& gp, const sser
 				uint32_t exclusiveCellIndexPtr = r.exclusiveCellIndexPtr();
 				if (m_idxStore.idxSize(exclusiveCellIndexPtr)) {
 					sserialize::ItemIndex idx(m_idxStore.at(exclusiveCellIndexPtr));
-					op.candidates(idx);
+					op.candidates(bboxCells ? idx / *bboxCells : idx);
 				}
 			}
 		}
@@ -165,11 +330,13 @@ void CQRFromPolygon::visit(const sserialize::spatial::GeoPolygon& gp, const sser
 namespace CQRFromPolygonHelpers {
 
 ///T_OPERATOR needs to implement bool intersects(uint32_t itemId) returning if the item intersects the query polygon
+///T_OPERATOR may provide its own filter(cellItems) to test all items of a cell at once
 template<typename T_OPERATOR>
 struct PolyCellItemIntersectBaseOp {
 	typedef T_OPERATOR MySubClass;
-	const sserialize::spatial::GeoPolygon & gp;
-	const sserialize::Static::spatial::GeoPolygon & sgp;
+	const PreparedGeoPolygon & pgp;
+	///used to classify cells, may be a simplified version of pgp
+	const PreparedGeoPolygon & cellPgp;
 	const sserialize::Static::spatial::GeoHierarchy & gh;
 	const liboscar::Static::OsmKeyValueObjectStore & store;
 	const sserialize::Static::ItemIndexStore & idxStore;
@@ -179,6 +346,14 @@ struct PolyCellItemIntersectBaseOp {
 	//temporary storage
 	std::vector<uint32_t> intersectingItems;
 	
+	///puts all items of cellItems intersecting the query polygon into intersectingItems
+	void filter(const sserialize::ItemIndex & cellItems) {
+		for(uint32_t itemId : cellItems) {
+			if (static_cast<MySubClass*>(this)->intersects(itemId)) {
+				intersectingItems.push_back(itemId);
+			}
+		}
+	}
 	void enclosed(const sserialize::ItemIndex & enclosedCells) {
 		fullMatches.insert(enclosedCells.cbegin(), enclosedCells.cend());
 	}
@@ -188,19 +363,15 @@ struct PolyCellItemIntersectBaseOp {
 				continue;
 			}
 			sserialize::spatial::GeoRect cellBoundary(gh.cellBoundary(cellId));
-			if (!gp.intersects(cellBoundary)) {
+			if (!cellPgp.intersects(cellBoundary)) {
 				continue;
 			}
-			if (gp.encloses( sserialize::spatial::GeoPolygon::fromRect(cellBoundary)) ) {
+			if (cellPgp.encloses(cellBoundary)) {
 				fullMatches.insert(cellId);
 			}
 			else {
 				sserialize::ItemIndex cellItems( idxStore.at( gh.cellItemsPtr(cellId) ) );
-				for(uint32_t itemId : cellItems) {
-					if (static_cast<MySubClass*>(this)->intersects(itemId)) {
-						intersectingItems.push_back(itemId);
-					}
-				}
+				static_cast<MySubClass*>(this)->filter(cellItems);
 				if (intersectingItems.size() == cellItems.size()) { //this is a fullmatch
 					fullMatches.insert(cellId);
 					intersectingItems.clear();
@@ -212,14 +383,14 @@ struct PolyCellItemIntersectBaseOp {
 			}
 		}
 	}
-	PolyCellItemIntersectBaseOp(const sserialize::spatial::GeoPolygon & gp,
-				const sserialize::Static::spatial::GeoPolygon & sgp,
+	PolyCellItemIntersectBaseOp(const PreparedGeoPolygon & pgp,
+				const PreparedGeoPolygon & cellPgp,
 				const sserialize::Static::spatial::GeoHierarchy & gh,
 				const liboscar::Static::OsmKeyValueObjectStore & store,
 				const sserialize::Static::ItemIndexStore & idxStore,
 				std::unordered_set<uint32_t> & fullMatches,
 				std::map<uint32_t, sserialize::ItemIndex> & partialMatches) :
-	gp(gp), sgp(sgp), gh(gh), store(store), idxStore(idxStore), fullMatches(fullMatches), partialMatches(partialMatches)
+	pgp(pgp), cellPgp(cellPgp), gh(gh), store(store), idxStore(idxStore), fullMatches(fullMatches), partialMatches(partialMatches)
 	{}
 };
 
@@ -227,31 +398,31 @@ struct PolyBBoxCellItemBBoxIntersectOp: public PolyCellItemIntersectBaseOp<PolyB
 	inline bool intersects(uint32_t itemId) {
 		return m_gpb.overlap(store.geoShape(itemId).boundary());
 	}
-	PolyBBoxCellItemBBoxIntersectOp(const sserialize::spatial::GeoPolygon & gp,
-				const sserialize::Static::spatial::GeoPolygon & sgp,
+	PolyBBoxCellItemBBoxIntersectOp(const PreparedGeoPolygon & pgp,
+				const PreparedGeoPolygon & cellPgp,
 				const sserialize::Static::spatial::GeoHierarchy & gh,
 				const liboscar::Static::OsmKeyValueObjectStore & store,
 				const sserialize::Static::ItemIndexStore & idxStore,
 				std::unordered_set<uint32_t> & fullMatches,
 				std::map<uint32_t, sserialize::ItemIndex> & partialMatches) :
-	PolyCellItemIntersectBaseOp(gp, sgp, gh, store, idxStore, fullMatches, partialMatches),
-	m_gpb(gp.boundary())
+	PolyCellItemIntersectBaseOp(pgp, cellPgp, gh, store, idxStore, fullMatches, partialMatches),
+	m_gpb(pgp.boundary())
 	{}
 	sserialize::spatial::GeoRect m_gpb;
 };
 
 struct PolyCellItemBBoxIntersectOp: public PolyCellItemIntersectBaseOp<PolyCellItemBBoxIntersectOp> {
 	inline bool intersects(uint32_t itemId) {
-		return gp.intersects(store.geoShape(itemId).boundary());
+		return pgp.intersects(store.geoShape(itemId).boundary());
 	}
-	PolyCellItemBBoxIntersectOp(const sserialize::spatial::GeoPolygon & gp,
-				const sserialize::Static::spatial::GeoPolygon & sgp,
+	PolyCellItemBBoxIntersectOp(const PreparedGeoPolygon & pgp,
+				const PreparedGeoPolygon & cellPgp,
 				const sserialize::Static::spatial::GeoHierarchy & gh,
 				const liboscar::Static::OsmKeyValueObjectStore & store,
 				const sserialize::Static::ItemIndexStore & idxStore,
 				std::unordered_set<uint32_t> & fullMatches,
 				std::map<uint32_t, sserialize::ItemIndex> & partialMatches) :
-	PolyCellItemIntersectBaseOp(gp, sgp, gh, store, idxStore, fullMatches, partialMatches)
+	PolyCellItemIntersectBaseOp(pgp, cellPgp, gh, store, idxStore, fullMatches, partialMatches)
 	{}
 };
 
@@ -259,59 +430,104 @@ struct PolyBBoxCellItemIntersectOp: public PolyCellItemIntersectBaseOp<PolyBBoxC
 	inline bool intersects(uint32_t itemId) {
 		return store.geoShape(itemId).get()->intersects(m_gpb);
 	}
-	PolyBBoxCellItemIntersectOp(const sserialize::spatial::GeoPolygon & gp,
-				const sserialize::Static::spatial::GeoPolygon & sgp,
+	PolyBBoxCellItemIntersectOp(const PreparedGeoPolygon & pgp,
+				const PreparedGeoPolygon & cellPgp,
 				const sserialize::Static::spatial::GeoHierarchy & gh,
 				const liboscar::Static::OsmKeyValueObjectStore & store,
 				const sserialize::Static::ItemIndexStore & idxStore,
 				std::unordered_set<uint32_t> & fullMatches,
 				std::map<uint32_t, sserialize::ItemIndex> & partialMatches) :
-	PolyCellItemIntersectBaseOp(gp, sgp, gh, store, idxStore, fullMatches, partialMatches),
-	m_gpb(gp.boundary())
+	PolyCellItemIntersectBaseOp(pgp, cellPgp, gh, store, idxStore, fullMatches, partialMatches),
+	m_gpb(pgp.boundary())
 	{}
 	sserialize::spatial::GeoRect m_gpb;
 };
 
 struct PolyCellItemIntersectOp: public PolyCellItemIntersectBaseOp<PolyCellItemIntersectOp> {
-	inline bool intersects(uint32_t itemId) {
-		sserialize::Static::spatial::GeoShape gs( store.geoShape(itemId) );
+	inline bool intersects(const sserialize::Static::spatial::GeoShape & gs) {
 		switch(gs.type()) {
 		case sserialize::spatial::GS_POINT:
-			return sgp.contains(*gs.get<sserialize::spatial::GS_POINT>());
+			return pgp.contains(*gs.get<sserialize::spatial::GS_POINT>());
 		case sserialize::spatial::GS_WAY:
-			return sgp.intersects(*gs.get<sserialize::spatial::GS_WAY>());
+			return pgp.intersects(*gs.get<sserialize::spatial::GS_WAY>());
 		case sserialize::spatial::GS_POLYGON:
-			return sgp.intersects(*gs.get<sserialize::spatial::GS_POLYGON>());
+			return pgp.intersects(*gs.get<sserialize::spatial::GS_POLYGON>());
 		case sserialize::spatial::GS_MULTI_POLYGON:
-			return gs.get<sserialize::spatial::GS_MULTI_POLYGON>()->intersects(sgp);
+			return pgp.intersects(*gs.get<sserialize::spatial::GS_MULTI_POLYGON>());
 		default:
 			return false;
 		};
 	}
-	PolyCellItemIntersectOp(const sserialize::spatial::GeoPolygon & gp,
-				const sserialize::Static::spatial::GeoPolygon & sgp,
+	inline bool intersects(uint32_t itemId) {
+		return intersects(store.geoShape(itemId));
+	}
+	///point items are collected and tested in a single batch
+	void filter(const sserialize::ItemIndex & cellItems) {
+		const sserialize::spatial::GeoRect & pgpb = pgp.boundary();
+		m_matches.assign(cellItems.size(), 0);
+		m_pointPositions.clear();
+		m_pointLat.clear();
+		m_pointLon.clear();
+		uint32_t pos = 0;
+		for(uint32_t itemId : cellItems) {
+			sserialize::Static::spatial::GeoShape gs( store.geoShape(itemId) );
+			if (gs.type() == sserialize::spatial::GS_POINT) {
+				sserialize::spatial::GeoPoint p( *gs.get<sserialize::spatial::GS_POINT>() );
+				if (pgpb.contains(p.lat(), p.lon())) {
+					m_pointPositions.push_back(pos);
+					m_pointLat.push_back(p.lat());
+					m_pointLon.push_back(p.lon());
+				}
+			}
+			else {
+				m_matches[pos] = intersects(gs);
+			}
+			++pos;
+		}
+		if (m_pointPositions.size()) {
+			m_pointMatches.resize(m_pointPositions.size());
+			pgp.contains(m_pointLat.data(), m_pointLon.data(), m_pointPositions.size(), m_pointMatches.data());
+			for(std::size_t i(0), s(m_pointPositions.size()); i < s; ++i) {
+				m_matches[m_pointPositions[i]] = m_pointMatches[i];
+			}
+		}
+		pos = 0;
+		for(uint32_t itemId : cellItems) {
+			if (m_matches[pos]) {
+				intersectingItems.push_back(itemId);
+			}
+			++pos;
+		}
+	}
+	PolyCellItemIntersectOp(const PreparedGeoPolygon & pgp,
+				const PreparedGeoPolygon & cellPgp,
 				const sserialize::Static::spatial::GeoHierarchy & gh,
 				const liboscar::Static::OsmKeyValueObjectStore & store,
 				const sserialize::Static::ItemIndexStore & idxStore,
 				std::unordered_set<uint32_t> & fullMatches,
 				std::map<uint32_t, sserialize::ItemIndex> & partialMatches) :
-	PolyCellItemIntersectBaseOp(gp, sgp, gh, store, idxStore, fullMatches, partialMatches)
+	PolyCellItemIntersectBaseOp(pgp, cellPgp, gh, store, idxStore, fullMatches, partialMatches)
 	{}
+	//temporary storage for filter()
+	std::vector<uint8_t> m_matches;
+	std::vector<uint32_t> m_pointPositions;
+	std::vector<double> m_pointLat;
+	std::vector<double> m_pointLon;
+	std::vector<uint8_t> m_pointMatches;
 };
 
 }//end namespace CQRFromPolygonHelpers
 
 template<typename T_OPERATOR>
-sserialize::CellQueryResult CQRFromPolygon::intersectingCellsPolygonItem(const sserialize::spatial::GeoPolygon & gp) const {
+sserialize::CellQueryResult CQRFromPolygon::intersectingCellsPolygonItem(const PreparedGeoPolygon & pgp, const PreparedGeoPolygon & cellPgp, const sserialize::ItemIndex * bboxCells) const {
 	//use a hash and map here since this operation is very expensive anyway
-	sserialize::Static::spatial::GeoPolygon sgp(toStatic(gp));
-	
+
 	std::unordered_set<uint32_t> fullMatches;
 	std::map<uint32_t, sserialize::ItemIndex> partialMatches;
 	
-	T_OPERATOR myOp(gp, sgp, m_store.geoHierarchy(), m_store, idxStore(), fullMatches, partialMatches);
+	T_OPERATOR myOp(pgp, cellPgp, m_store.geoHierarchy(), m_store, idxStore(), fullMatches, partialMatches);
 
-	visit(gp, sgp, myOp);
+	visit(pgp, myOp, bboxCells);
 	std::vector<uint32_t> fullMatchesSorted(fullMatches.begin(), fullMatches.end());
 	std::sort(fullMatchesSorted.begin(), fullMatchesSorted.end());
 	
@@ -0,0 +1,91 @@
+#ifndef LIBOSCAR_CELL_CENTER_INDEX_H
+#define LIBOSCAR_CELL_CENTER_INDEX_H
+#include <vector>
+#include <memory>
+#include <sserialize/spatial/GeoPoint.h>
+#include <sserialize/spatial/CellDistance.h>
+#include <sserialize/spatial/CellQueryResult.h>
+#include <sserialize/containers/ItemIndex.h>
+#include <liboscar/CellDistanceKernels.h>
+
+namespace liboscar {
+
+/** KD-tree over the centers of the cells, each cell is a ball given by its center and radius.
+  * The distance between two cells is the distance of their centers minus both radii, see CellDistanceBySphere.
+  * Distances are great circle distances computed by CellDistanceKernels.
+  * Centers are mapped onto the unit sphere, hence there are no problems at the date line or the poles.
+  * Every node stores the bounding box of its centers and the largest radius of its cells.
+  * The balls are stored in tree order so that the leaves are tested by the batched kernels.
+  * This allows to answer "all cells within d of a point" and "all cells within d of a set of cells"
+  * without walking the cell graph and without calling CellDistance::distance for every pair.
+  * If the balls only bound the cells, i.e. for CellDistanceByHull, set a refinement:
+  * dilate() and cellsWithin(cells) then keep only the candidates accepted by CellDistanceByHull::within.
+  */
+class CellCenterIndex final {
+public:
+	struct CellInfo {
+		sserialize::spatial::GeoPoint center;
+		double radius;
+	};
+public:
+	CellCenterIndex();
+	CellCenterIndex(const std::vector<CellInfo> & d);
+	CellCenterIndex(std::vector<CellInfo> && d);
+	~CellCenterIndex();
+	inline uint32_t cellCount() const { return (uint32_t) m_ci.size(); }
+	inline const CellInfo & cellInfo(uint32_t cellId) const { return m_ci.at(cellId); }
+	///the balls have to contain the cells with respect to cd, an empty cd disables the refinement
+	inline void setRefinement(const std::shared_ptr<sserialize::spatial::interface::CellDistance> & cd) { m_refinement = cd; }
+	inline const std::shared_ptr<sserialize::spatial::interface::CellDistance> & refinement() const { return m_refinement; }
+	///distance between the balls of two cells in meters, 0 if they intersect
+	double distance(uint32_t cellId1, uint32_t cellId2) const;
+	///distance between p and the ball of cellId in meters, 0 if p is inside the ball
+	double distance(const sserialize::spatial::GeoPoint & p, uint32_t cellId) const;
+	///appends the ids of all cells within distance meters of p to dest, the ids are not sorted
+	void cellsWithin(const sserialize::spatial::GeoPoint & p, double distance, std::vector<uint32_t> & dest) const;
+	///appends the ids of all cells within distance meters of cellId to dest, including cellId, the ids are not sorted
+	///The balls are not refined, hence these are candidates if there is a refinement.
+	void cellsWithin(uint32_t cellId, double distance, std::vector<uint32_t> & dest) const;
+	///@return all cells that are within distance meters of at least one cell of cells and are not part of cells
+	sserialize::ItemIndex cellsWithin(const sserialize::ItemIndex & cells, double distance, uint32_t threadCount) const;
+	///same as CQRDilator::dilate: all cells within distance meters of a cell of cqr that are not part of cqr
+	sserialize::ItemIndex dilate(const sserialize::CellQueryResult & cqr, double distance, uint32_t threadCount) const;
+private:
+	struct Point3D {
+		double v[3];
+	};
+	///the children of an inner node are at self+1 and right
+	struct Node {
+		Point3D min;
+		Point3D max;
+		double maxRadius;
+		uint32_t begin;
+		uint32_t end;
+		uint32_t right;
+	};
+	static constexpr uint32_t LeafSize = 16;
+private:
+	void build();
+	uint32_t build(const std::vector<Point3D> & points, uint32_t begin, uint32_t end);
+	///calls cb(begin, end) with the tree positions of every leaf that may contain a cell whose ball is at most distance away from the ball (p, radius)
+	template<typename T_CALLBACK>
+	void visit(const sserialize::spatial::GeoPoint & p, double radius, double distance, T_CALLBACK cb) const;
+	static Point3D toPoint3D(const sserialize::spatial::GeoPoint & p);
+	///lower bound of the distance in meters between q and every point on the unit sphere within the box of node
+	static double lowerBound(const Point3D & q, const Node & node);
+	sserialize::ItemIndex neighborhood(const std::vector<uint32_t> & src, double distance, uint32_t threadCount) const;
+private:
+	std::vector<CellInfo> m_ci;
+	///cell ids in the order of the tree
+	std::vector<uint32_t> m_cellIds;
+	///cellId -> position in the tree
+	std::vector<uint32_t> m_cellPos;
+	///balls in the order of the tree
+	CellDistanceKernels m_kernels;
+	std::vector<Node> m_nodes;
+	std::shared_ptr<sserialize::spatial::interface::CellDistance> m_refinement;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef LIBOSCAR_CELL_DISTANCE_BY_HULL_H
+#define LIBOSCAR_CELL_DISTANCE_BY_HULL_H
+#include <vector>
+#include <sserialize/spatial/CellDistance.h>
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/Static/TriangulationGeoHierarchyArrangement.h>
+#define LIBOSCAR_CELL_DISTANCE_BY_HULL_VERSION 1
+
+namespace liboscar {
+
+/** Cell distance based on the convex hulls of the cells.
+  * Spheres and annuli badly overestimate the extent of long and thin cells.
+  * The hull distance is much closer to the real distance of the cell boundaries.
+  *
+  * Every cell has a simplified convex hull with at most maxHullSize points and a bounding sphere.
+  * Simplification removes hull points, hence the simplified hull may not contain the whole cell.
+  * The slack of a cell is the largest distance of the original hull to the simplified hull, it is subtracted from hull distances.
+  * distance() first computes the sphere lower bound and refines it by the hull distance
+  * if the lower bound is at most MaxRefinementDistance.
+  * Above MaxRefinementDistance distance() returns the sphere lower bound,
+  * hence distance() is not continuous there and may jump by up to the sum of the radii minus the hull distance.
+  * Refining is much more expensive than the sphere bounds.
+  * Callers that compare against a distance should use within(), which only refines if the sphere bounds do not decide.
+  * Hull distances are computed in an equirectangular projection, see ItemGeoDistance.
+  * The file is built by create(), Static::OsmCompleter::writeCellFile writes it to the files directory.
+  *
+  * file layout:
+  *
+  *-----------------------------------------------------------------------
+  *VERSION|CellCount|CellInfo            |HullOffsets     |Points
+  *-----------------------------------------------------------------------
+  *  u8   |   u32   |(u32,u32,u32,u32)[CellCount]|u32[CellCount+1]|(u32,u32)[*]
+  *-----------------------------------------------------------------------
+  *
+  * CellInfo: CenterLat|CenterLon|Radius|Slack
+  * Coordinates are fixed point numbers, radius and slack are in meters and rounded up.
+  * The points of the hull of cell i are Points[HullOffsets[i], HullOffsets[i+1]).
+  */
+class CellDistanceByHull: public sserialize::spatial::interface::CellDistance {
+public:
+	typedef sserialize::Static::spatial::TriangulationGeoHierarchyArrangement TriangulationGeoHierarchyArrangement;
+	static constexpr uint32_t DefaultMaxHullSize = 32;
+	///sphere lower bounds larger than this are not refined
+	static constexpr double MaxRefinementDistance = 100*1000;
+public:
+	CellDistanceByHull();
+	CellDistanceByHull(const sserialize::UByteArrayAdapter & d);
+	virtual ~CellDistanceByHull();
+	inline uint32_t cellCount() const { return m_cellCount; }
+	virtual double distance(uint32_t cellId1, uint32_t cellId2) const;
+	virtual double distance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const;
+	///same as distance(cellId1, cellId2) <= distance, but the hulls are only used
+	///if the distance is between the lower bound and the upper bound by the bounding spheres
+	///The hull distance is used regardless of MaxRefinementDistance.
+	bool within(uint32_t cellId1, uint32_t cellId2, double distance) const;
+	///within() with a CellDistanceByHull and distance() <= distance otherwise
+	static bool within(const sserialize::spatial::interface::CellDistance & cd, uint32_t cellId1, uint32_t cellId2, double distance);
+	///lower bound of distance(cellId1, cellId2) by the bounding spheres
+	double lowerBound(uint32_t cellId1, uint32_t cellId2) const;
+	///lower bound of distance(gp, cellId) by the bounding sphere
+	double lowerBound(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const;
+	sserialize::spatial::GeoPoint center(uint32_t cellId) const;
+	///radius of the bounding sphere in meters
+	double radius(uint32_t cellId) const;
+	double slack(uint32_t cellId) const;
+	///the simplified hull of cellId, the result is appended to dest
+	void hull(uint32_t cellId, std::vector<sserialize::spatial::GeoPoint> & dest) const;
+public:
+	static void create(
+		const TriangulationGeoHierarchyArrangement & tra,
+		sserialize::UByteArrayAdapter & dest,
+		uint32_t threadCount,
+		uint32_t maxHullSize = DefaultMaxHullSize
+	);
+private:
+	static constexpr uint32_t CellInfoSize = 4*sizeof(uint32_t);
+	static constexpr uint32_t PointSize = 2*sizeof(uint32_t);
+private:
+	static uint32_t toFixedLat(double lat);
+	static uint32_t toFixedLon(double lon);
+	static double fromFixedLat(uint32_t v);
+	static double fromFixedLon(uint32_t v);
+	void checkCellId(uint32_t cellId) const;
+	///hull distance minus the slacks, uses buffers that are reused by all calls of a thread
+	double hullDistance(uint32_t cellId1, uint32_t cellId2) const;
+	double hullDistance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const;
+private:
+	sserialize::UByteArrayAdapter m_cellInfo;
+	sserialize::UByteArrayAdapter m_offsets;
+	sserialize::UByteArrayAdapter m_points;
+	uint32_t m_cellCount;
+};
+
+}//end namespace liboscar
+
+#endif
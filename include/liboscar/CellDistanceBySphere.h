@@ -2,6 +2,7 @@
 #define LIBOSCAR_CELL_DISTANCE_BY_SPHERE_H
 #include <sserialize/spatial/CellDistance.h>
 #include <sserialize/Static/TriangulationGeoHierarchyArrangement.h>
+#include <liboscar/CellDistanceKernels.h>
 
 namespace liboscar {
 
@@ -16,13 +17,25 @@ public:
 	CellDistanceBySphere(const std::vector<CellInfo> & d);
 	CellDistanceBySphere(std::vector<CellInfo> && d);
 	virtual ~CellDistanceBySphere();
+	///computed by CellDistanceKernels like the batched distances, see there for the earth model and the error bounds
 	virtual double distance(uint32_t cellId1, uint32_t cellId2) const;
 	virtual double distance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const;
+	inline const std::vector<CellInfo> & cellInfos() const { return m_ci; }
+	///dest[i] = distance(cellId, cellIds[i]) computed by CellDistanceKernels, see there for the error bounds
+	void distances(uint32_t cellId, const uint32_t * cellIds, std::size_t count, double * dest) const;
+	///dest[i] = distance(gp, cellIds[i]) computed by CellDistanceKernels, see there for the error bounds
+	void distances(const sserialize::spatial::GeoPoint & gp, const uint32_t * cellIds, std::size_t count, double * dest) const;
+	///dest[i] = distance(gp, i) for all cells computed by CellDistanceKernels, see there for the error bounds
+	void distances(const sserialize::spatial::GeoPoint & gp, double * dest) const;
 public:
 	static std::vector<CellInfo> minSpheres(const TriangulationGeoHierarchyArrangement & tra, uint32_t threadCount);
 	static std::vector<CellInfo> spheres(const TriangulationGeoHierarchyArrangement & tra, uint32_t threadCount);
+private:
+	void initKernels();
 private:
 	std::vector<CellInfo> m_ci;
+	///m_ci as structure of arrays
+	CellDistanceKernels m_kernels;
 };
 
 }//end namespace
@@ -0,0 +1,77 @@
+#ifndef LIBOSCAR_CELL_DISTANCE_KERNELS_H
+#define LIBOSCAR_CELL_DISTANCE_KERNELS_H
+#include <vector>
+#include <cstdint>
+#include <sserialize/spatial/GeoPoint.h>
+
+namespace liboscar {
+
+/** Batched distances between a ball and many balls on a sphere with radius EarthRadius.
+  * The centers are stored as unit vectors in structure of arrays layout together with the radii.
+  * Great circle distances are derived from the chord length c of two unit vectors by 2*R*asin(c/2).
+  * The chords are computed by AVX2 or SSE2 kernels if the compiler targets them, the asin is scalar.
+  * distancesAt() gathers the centers of the given positions into a buffer first.
+  * within() does not need the asin at all:
+  * It compares the chord with the chord of the threshold angle which is derived by the angle sum identities
+  * from sin/cos of the threshold and the precomputed sin/cos of the ball radii.
+  *
+  * Error bounds with respect to the exact distance on the sphere:
+  * The relative error is below 1e-12 for distances up to 10000km and the absolute error is below 0.1m for all distances.
+  * The error is dominated by the asin near antipodal points.
+  * On the WGS84 ellipsoid great circle distances with the mean radius are off by up to 0.6%.
+  * CellDistanceBySphere and CellDistanceByAnulus compute their scalar and batched distances with the kernels,
+  * so both agree on this earth model.
+  */
+class CellDistanceKernels final {
+public:
+	static constexpr double EarthRadius = 6371000.0;
+public:
+	CellDistanceKernels();
+	~CellDistanceKernels();
+	void reserve(std::size_t size);
+	///@param radius in meters
+	void push_back(const sserialize::spatial::GeoPoint & center, double radius);
+	inline std::size_t size() const { return m_x.size(); }
+	inline double radius(std::size_t pos) const { return m_radius[pos]; }
+	///distance between the ball at pos1 and the ball at pos2, 0 if they intersect
+	double distance(std::size_t pos1, std::size_t pos2) const;
+	///distance between p and the ball at pos, 0 if p is inside the ball
+	double distance(const sserialize::spatial::GeoPoint & p, std::size_t pos) const;
+	///dest[i-begin] = distance between the ball (p, radius) and the ball at position i for i in [begin, end)
+	void distances(const sserialize::spatial::GeoPoint & p, double radius, std::size_t begin, std::size_t end, double * dest) const;
+	///dest[i] = distance between the ball (p, radius) and the ball at position positions[i] for i in [0, count)
+	void distancesAt(const sserialize::spatial::GeoPoint & p, double radius, const uint32_t * positions, std::size_t count, double * dest) const;
+	///dest[i] = distance between the ball at pos and the ball at position positions[i] for i in [0, count)
+	void distancesAt(std::size_t pos, const uint32_t * positions, std::size_t count, double * dest) const;
+	///Appends all positions in [begin, end) whose ball is at most maxDistance away from the ball (p, radius) to dest
+	///@return number of appended positions
+	std::size_t within(const sserialize::spatial::GeoPoint & p, double radius, double maxDistance, std::size_t begin, std::size_t end, std::vector<uint32_t> & dest) const;
+	///same as within(center of pos, radius of pos, maxDistance, begin, end, dest)
+	std::size_t within(std::size_t pos, double maxDistance, std::size_t begin, std::size_t end, std::vector<uint32_t> & dest) const;
+private:
+	struct Query {
+		double x;
+		double y;
+		double z;
+		double radius;
+	};
+private:
+	static Query query(const sserialize::spatial::GeoPoint & p, double radius);
+	Query query(std::size_t pos) const;
+	void distances(const Query & q, std::size_t begin, std::size_t end, double * dest) const;
+	void distancesAt(const Query & q, const uint32_t * positions, std::size_t count, double * dest) const;
+	std::size_t within(const Query & q, double maxDistance, std::size_t begin, std::size_t end, std::vector<uint32_t> & dest) const;
+	static double chordToDistance(double chord2);
+private:
+	std::vector<double> m_x;
+	std::vector<double> m_y;
+	std::vector<double> m_z;
+	std::vector<double> m_radius;
+	///sin and cos of half the angle of the radius, the angle is at most pi
+	std::vector<double> m_sinHalf;
+	std::vector<double> m_cosHalf;
+};
+
+}//end namespace liboscar
+
+#endif
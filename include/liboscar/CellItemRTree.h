@@ -0,0 +1,86 @@
+#ifndef LIBOSCAR_CELL_ITEM_RTREE_H
+#define LIBOSCAR_CELL_ITEM_RTREE_H
+#include <vector>
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/spatial/GeoRect.h>
+#include <sserialize/Static/ItemIndexStore.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#define LIBOSCAR_CELL_ITEM_RTREE_VERSION 1
+
+namespace liboscar {
+
+/** Static per-cell R-trees over the bounding boxes of the polygonal items of a cell.
+  * Only polygons and multipolygons are indexed, since only these contain a point with non-zero probability.
+  * The trees are packed bottom-up with the Sort-Tile-Recursive algorithm.
+  * The file is built by create(), Static::OsmCompleter::writeCellFile writes it to the files directory.
+  *
+  * file layout:
+  *
+  *---------------------------------------------------------
+  *VERSION|CellCount|NodeCapacity|TreeOffsets       |Trees
+  *---------------------------------------------------------
+  *  u8   |   u32   |    u32     |u64[CellCount+1]  |*
+  *---------------------------------------------------------
+  *
+  * TreeOffsets are relative to the beginning of Trees. Cells without indexed items have an empty tree.
+  *
+  * Tree:
+  *---------------------------------------------------------
+  *LevelCount|LevelSizes    |Entries of level LevelCount-1|...|Entries of level 0
+  *---------------------------------------------------------
+  *   u32    |u32[LevelCount]|*
+  *---------------------------------------------------------
+  *
+  * Entry of level 0: MinLat|MinLon|MaxLat|MaxLon|ItemId, all u32
+  * Entry of level > 0: MinLat|MinLon|MaxLat|MaxLon|ChildBegin|ChildCount, all u32
+  * ChildBegin is the position of the first child in the next lower level.
+  * Coordinates are fixed point numbers, minimum values are rounded down and maximum values up.
+  * The entries of the top level are the children of the implicit root.
+  */
+class CellItemRTree final {
+public:
+	static constexpr uint32_t DefaultNodeCapacity = 16;
+public:
+	CellItemRTree();
+	CellItemRTree(const sserialize::UByteArrayAdapter & d);
+	~CellItemRTree();
+	inline uint32_t cellCount() const { return m_cellCount; }
+	inline uint32_t nodeCapacity() const { return m_nodeCapacity; }
+	///appends the ids of the indexed items of cellId whose bounding box contains p to dest, the ids are not sorted
+	void itemsContaining(uint32_t cellId, const sserialize::spatial::GeoPoint & p, std::vector<uint32_t> & dest) const;
+	///appends the ids of the indexed items of cellId whose bounding box intersects rect to dest, the ids are not sorted
+	void itemsIntersecting(uint32_t cellId, const sserialize::spatial::GeoRect & rect, std::vector<uint32_t> & dest) const;
+public:
+	static void create(
+		const Static::OsmKeyValueObjectStore & store,
+		const sserialize::Static::ItemIndexStore & idxStore,
+		sserialize::UByteArrayAdapter & dest,
+		uint32_t nodeCapacity = DefaultNodeCapacity
+	);
+private:
+	struct FixedPointRect {
+		uint32_t minLat;
+		uint32_t minLon;
+		uint32_t maxLat;
+		uint32_t maxLon;
+		inline bool overlap(const FixedPointRect & other) const {
+			return !(maxLat < other.minLat || minLat > other.maxLat || maxLon < other.minLon || minLon > other.maxLon);
+		}
+	};
+	static constexpr uint32_t LeafEntrySize = 5*sizeof(uint32_t);
+	static constexpr uint32_t InnerEntrySize = 6*sizeof(uint32_t);
+private:
+	static uint32_t toFixedLat(double lat, bool roundUp);
+	static uint32_t toFixedLon(double lon, bool roundUp);
+	static FixedPointRect toFixed(const sserialize::spatial::GeoRect & rect);
+	void query(uint32_t cellId, const FixedPointRect & rect, std::vector<uint32_t> & dest) const;
+private:
+	sserialize::UByteArrayAdapter m_offsets;
+	sserialize::UByteArrayAdapter m_trees;
+	uint32_t m_cellCount;
+	uint32_t m_nodeCapacity;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef LIBOSCAR_CELL_KV_HISTOGRAMS_H
+#define LIBOSCAR_CELL_KV_HISTOGRAMS_H
+#include <vector>
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/Static/ItemIndexStore.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#define LIBOSCAR_CELL_KV_HISTOGRAMS_VERSION 1
+
+namespace liboscar {
+
+/** Precomputed (key, value) -> count tables of all cells.
+  * KVStats uses them for the full-match cells of a CellQueryResult instead of decoding every item.
+  *
+  * Items may be part of more than one cell, summing the tables of cells would count them multiple times.
+  * Hence the table of a cell only counts the items that are exclusively in this cell.
+  * The items of a cell that are also part of other cells are stored as a list of shared items.
+  * Stats of a set of full-match cells are the sum of their tables plus the stats of the union of their shared items.
+  * The file is built by create(), Static::OsmCompleter::writeCellFile writes it to the files directory.
+  *
+  * file layout:
+  *
+  *----------------------------------------------
+  *VERSION|CellCount|CellOffsets      |Cells
+  *----------------------------------------------
+  *  u8   |   u32   |u64[CellCount+1] |*
+  *----------------------------------------------
+  *
+  * CellOffsets are relative to the beginning of Cells.
+  *
+  * Cell:
+  *----------------------------------------------------------------------------------
+  *ExclusiveItemCount|SharedItemCount|SharedItems|EntryCount|Entries
+  *----------------------------------------------------------------------------------
+  *
+  * All numbers are vl-packed u32.
+  * SharedItems are the differences of the ascending item ids, the first one is relative to 0.
+  * Entries are sorted by (key, value), an entry is KeyDelta|Value|Count.
+  * KeyDelta is the difference to the key of the previous entry.
+  * Value is the difference to the value of the previous entry if KeyDelta is 0 and the value id otherwise.
+  */
+class CellKVHistograms final {
+public:
+	CellKVHistograms();
+	CellKVHistograms(const sserialize::UByteArrayAdapter & d);
+	~CellKVHistograms();
+	inline uint32_t cellCount() const { return m_cellCount; }
+	///number of items that are only part of cellId, these are the items counted by the table of cellId
+	uint32_t exclusiveItemCount(uint32_t cellId) const;
+	///appends the ascending ids of the items of cellId that are also part of other cells to dest
+	void sharedItems(uint32_t cellId, std::vector<uint32_t> & dest) const;
+	///calls cb(keyId, valueId, count) for every entry of the table of cellId in ascending (keyId, valueId) order
+	template<typename T_CALLBACK>
+	void visit(uint32_t cellId, T_CALLBACK cb) const;
+public:
+	static void create(
+		const Static::OsmKeyValueObjectStore & store,
+		const sserialize::Static::ItemIndexStore & idxStore,
+		sserialize::UByteArrayAdapter & dest,
+		uint32_t threadCount
+	);
+private:
+	///number of cells whose tables are computed before they are written
+	static constexpr uint32_t CreateBlockSize = 4096;
+private:
+	///the data of cellId with the get pointer at the beginning
+	sserialize::UByteArrayAdapter cellData(uint32_t cellId) const;
+private:
+	sserialize::UByteArrayAdapter m_offsets;
+	sserialize::UByteArrayAdapter m_cells;
+	uint32_t m_cellCount;
+};
+
+}//end namespace liboscar
+
+//Implementation
+
+namespace liboscar {
+
+template<typename T_CALLBACK>
+void CellKVHistograms::visit(uint32_t cellId, T_CALLBACK cb) const {
+	sserialize::UByteArrayAdapter d( cellData(cellId) );
+	d.getVlPackedUint32(); //exclusive item count
+	for(uint32_t i(0), s(d.getVlPackedUint32()); i < s; ++i) {
+		d.getVlPackedUint32();
+	}
+	uint32_t keyId = 0;
+	uint32_t valueId = 0;
+	for(uint32_t i(0), s(d.getVlPackedUint32()); i < s; ++i) {
+		uint32_t keyDelta = d.getVlPackedUint32();
+		uint32_t value = d.getVlPackedUint32();
+		uint32_t count = d.getVlPackedUint32();
+		if (keyDelta) {
+			keyId += keyDelta;
+			valueId = value;
+		}
+		else {
+			valueId += value;
+		}
+		cb(keyId, valueId, count);
+	}
+}
+
+}//end namespace liboscar
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef LIBOSCAR_CELL_NEIGHBOR_LADDER_H
+#define LIBOSCAR_CELL_NEIGHBOR_LADDER_H
+#include <vector>
+#include <memory>
+#include <sserialize/spatial/CellDistance.h>
+#include <sserialize/spatial/CellQueryResult.h>
+#include <sserialize/containers/ItemIndex.h>
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <liboscar/CellCenterIndex.h>
+#define LIBOSCAR_CELL_NEIGHBOR_LADDER_VERSION 2
+
+namespace liboscar {
+
+/** Precomputed neighbors of all cells for a ladder of radii.
+  * The CQRDilatorWithCache only caches a single threshold and lives in memory.
+  * The ladder stores the neighbors for several radii in a file that can be mmapped.
+  *
+  * The neighbors of a cell are partitioned into rungs:
+  * Rung 0 holds the cells with a distance in [0, Radii[0]], rung i those with a distance in (Radii[i-1], Radii[i]].
+  * The cell itself is not stored.
+  * Hence the cells within Radii[k] of a cell are the union of the rungs 0 to k.
+  * dilate() picks the smallest radius Radii[k] that is at least the dilation distance.
+  * The cells of the rungs below k are within the distance by construction,
+  * only the cells of rung k have to be checked with the cell distance.
+  * Distances larger than maxRadius() are not supported.
+  *
+  * The ladder has to be created with the same cell distance that is used by dilate().
+  * Hence the file records the type of the cell distance, users check it before they use the ladder.
+  *
+  * file layout:
+  *
+  *--------------------------------------------------------------------------------------
+  *VERSION|CellDistanceType|RungCount|Radii         |CellCount|ListOffsets      |Lists
+  *--------------------------------------------------------------------------------------
+  *  u8   |       u8       |   u8    |u32[RungCount]|   u32   |u64[CellCount+1] |*
+  *--------------------------------------------------------------------------------------
+  *
+  * CellDistanceType is opaque to the ladder, OsmCompleter stores its CellDistanceType.
+  * Radii are in meters and strictly ascending. ListOffsets are relative to the beginning of Lists.
+  * The list of a cell consists of RungCount rungs: Count|Deltas
+  * Count is a vl-packed u32, Deltas are Count vl-packed u32 differences of the ascending cell ids, the first one is relative to 0.
+  */
+class CellNeighborLadder final {
+public:
+	typedef sserialize::spatial::interface::CellDistance CellDistance;
+	static constexpr uint32_t MaxRungCount = 255;
+public:
+	CellNeighborLadder();
+	///@param cd the cell distance used to refine the cells of the selected rung
+	CellNeighborLadder(const sserialize::UByteArrayAdapter & d, const std::shared_ptr<CellDistance> & cd);
+	~CellNeighborLadder();
+	inline uint32_t cellCount() const { return m_cellCount; }
+	inline uint32_t rungCount() const { return (uint32_t) m_radii.size(); }
+	inline uint32_t radius(uint32_t rung) const { return m_radii.at(rung); }
+	inline double maxRadius() const { return m_radii.size() ? m_radii.back() : -1.0; }
+	inline const std::shared_ptr<CellDistance> & cellDistance() const { return m_cd; }
+	///type of the cell distance that was used to create the ladder
+	inline uint8_t cellDistanceType() const { return m_cellDistanceType; }
+	///the serialized ladder
+	inline const sserialize::UByteArrayAdapter & data() const { return m_data; }
+	///@return the smallest rung whose radius is at least distance, rungCount() if there is none
+	uint32_t rung(double distance) const;
+	///appends the cells of rung of cellId to dest in ascending order
+	void neighbors(uint32_t cellId, uint32_t rung, std::vector<uint32_t> & dest) const;
+	///appends the ids of all cells within distance meters of cellId excluding cellId to dest, the ids are not sorted
+	///distance must not be larger than maxRadius()
+	void cellsWithin(uint32_t cellId, double distance, std::vector<uint32_t> & dest) const;
+	///same as CQRDilator::dilate: all cells within distance meters of a cell of cqr that are not part of cqr
+	///distance must not be larger than maxRadius()
+	sserialize::ItemIndex dilate(const sserialize::CellQueryResult & cqr, double distance, uint32_t threadCount) const;
+public:
+	///100m, 500m, 1km, 5km, 20km
+	static std::vector<uint32_t> defaultRadii();
+	///@param cci selects the candidates of a cell, it has to select all cells within a radius with respect to cd
+	///Candidates are selected with a distance of 1.01*maxRadius+100m to account for a different model of the earth.
+	///@param radii in meters, they are sorted and duplicates are removed
+	///@param cellDistanceType type of cd, stored in the file
+	static void create(
+		const CellDistance & cd,
+		uint8_t cellDistanceType,
+		const CellCenterIndex & cci,
+		std::vector<uint32_t> radii,
+		sserialize::UByteArrayAdapter & dest,
+		uint32_t threadCount
+	);
+private:
+	///number of cells whose neighbors are computed before they are written
+	static constexpr uint32_t CreateBlockSize = 4096;
+private:
+	void checkCellId(uint32_t cellId) const;
+	///calls cb(rung, cellId) for all neighbors of cellId in the rungs [0, lastRung]
+	template<typename T_CALLBACK>
+	void visit(uint32_t cellId, uint32_t lastRung, T_CALLBACK cb) const;
+private:
+	sserialize::UByteArrayAdapter m_data;
+	std::vector<uint32_t> m_radii;
+	sserialize::UByteArrayAdapter m_offsets;
+	sserialize::UByteArrayAdapter m_lists;
+	uint32_t m_cellCount;
+	uint8_t m_cellDistanceType;
+	std::shared_ptr<CellDistance> m_cd;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LIBOSCAR_ITEM_GEO_DISTANCE_H
+#define LIBOSCAR_ITEM_GEO_DISTANCE_H
+#include <vector>
+#include <sserialize/spatial/GeoPoint.h>
+#include <sserialize/spatial/GeoRect.h>
+#include <sserialize/Static/GeoShape.h>
+
+namespace liboscar {
+
+/** Distances in meters between points, bounding boxes and item geometries.
+  * Distances are measured in an equirectangular projection centered at the origin.
+  * This is accurate for the short distances of proximity queries.
+  * Bounding boxes map to boxes, hence the distance to the bounding box of a shape is a lower bound of the distance to the shape.
+  */
+class ItemGeoDistance final {
+public:
+	ItemGeoDistance(const sserialize::spatial::GeoPoint & origin);
+	~ItemGeoDistance();
+	inline const sserialize::spatial::GeoPoint & origin() const { return m_origin; }
+	double distance(const sserialize::spatial::GeoPoint & p) const;
+	///lower bound of the distance to everything within rect
+	double distance(const sserialize::spatial::GeoRect & rect) const;
+	///distance to the segment a-b
+	double distance(const sserialize::spatial::GeoPoint & a, const sserialize::spatial::GeoPoint & b) const;
+	///distance to the geometry of shape, 0 if the origin lies within a polygon
+	double distance(const sserialize::Static::spatial::GeoShape & shape) const;
+public:
+	///lower bound of the distance between everything within rect1 and everything within rect2
+	static double distance(const sserialize::spatial::GeoRect & rect1, const sserialize::spatial::GeoRect & rect2);
+	///@return true if the geometries of shape1 and shape2 are at most maxDistance apart
+	///Pairs are rejected by their bounding boxes first, segments are only compared if the boxes of their pieces of a chain are close enough.
+	static bool withinDistance(const sserialize::Static::spatial::GeoShape & shape1, const sserialize::Static::spatial::GeoShape & shape2, double maxDistance);
+	///distance between two convex polygons given by their vertices in lat/lon order, 0 if they intersect
+	///A polygon may consist of a single point or a single segment.
+	static double convexPolygonDistance(const std::vector<sserialize::spatial::GeoPoint> & poly1, const std::vector<sserialize::spatial::GeoPoint> & poly2);
+private:
+	struct Point2D {
+		double x;
+		double y;
+	};
+	using Chain = std::vector<Point2D>;
+private:
+	Point2D project(const sserialize::spatial::GeoPoint & p) const;
+	void chains(const sserialize::Static::spatial::GeoShape & shape, std::vector<Chain> & dest) const;
+	static double segmentDistance(const Point2D & p, const Point2D & a, const Point2D & b);
+	static double segmentDistance(const Point2D & a1, const Point2D & a2, const Point2D & b1, const Point2D & b2);
+	static bool isPolygonal(const sserialize::Static::spatial::GeoShape & shape);
+	static bool contains(const sserialize::Static::spatial::GeoShape & shape, const sserialize::spatial::GeoPoint & p);
+	static bool firstPoint(const sserialize::Static::spatial::GeoShape & shape, sserialize::spatial::GeoPoint & p);
+	///p is in the convex polygon poly (not closed) or on its boundary
+	static bool convexContains(const Chain & poly, const Point2D & p);
+private:
+	sserialize::spatial::GeoPoint m_origin;
+	double m_lonScale;
+};
+
+}//end namespace liboscar
+
+#endif
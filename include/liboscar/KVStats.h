@@ -4,19 +4,20 @@
 
 #include <sserialize/containers/CFLArray.h>
 #include <sserialize/iterator/RangeGenerator.h>
-#include <sserialize/containers/OADHashTable.h>
 
 #include <liboscar/OsmKeyValueObjectStore.h>
 #include <liboscar/KVClustering.h>
+#include <liboscar/CellKVHistograms.h>
 
 #include <unordered_map>
 #include <queue>
 
 namespace liboscar {
+
+class KVStats;
+
 namespace detail {
 namespace KVStats {
-	
-struct Data;
 
 struct SortedData {
 	using KeyValue = std::pair<uint32_t, uint32_t>;
@@ -25,24 +26,12 @@ struct SortedData {
 	KeyValueCountContainer keyValueCount;
 	SortedData();
 	SortedData(const SortedData & other) = default;
-	SortedData(Data && other);
 	SortedData(SortedData && other);
 	SortedData & operator=(SortedData && other);
 	static SortedData merge(SortedData && first, SortedData && second);
-};
-
-struct Data {
-	using KeyValueCountUnorderedMap = std::unordered_map<std::pair<uint32_t, uint32_t>, uint32_t>;
-	using KeyValueCountOADMap = sserialize::OADHashTable<std::pair<uint32_t, uint32_t>, uint32_t>;
-	using KeyValueCountSortedMap = std::map<std::pair<uint32_t, uint32_t>, uint32_t>;
-	using KeyValueCountMap = KeyValueCountOADMap;
-	KeyValueCountMap keyValueCount;
-	Data();
-	Data(const Data & other) = default;
-	Data(Data && other);
-	Data & operator=(Data && other);
-	void update(const Static::OsmKeyValueObjectStore::KVItemBase & item);
-	static Data merge(Data && first, Data && second);
+	///removes the counts of second from first, pairs whose count drops to 0 are removed
+	///second has to be contained in first
+	static SortedData subtract(SortedData && first, SortedData && second);
 };
 
 
@@ -79,29 +68,80 @@ struct KeyInfoPtr {
 	inline bool valid() const { return offset != std::numeric_limits<uint32_t>::max(); }
 };
 
+///(keyId << 32) | valueId, hence packed pairs are ordered by key and value
+inline uint64_t packKeyValue(uint32_t keyId, uint32_t valueId) {
+	return (uint64_t(keyId) << 32) | valueId;
+}
+
+///Packed key-value pairs with their number of occurrences
+using PairCounts = std::vector<std::pair<uint64_t, uint32_t>>;
+
+/** The aggregation runs in two phases without any locks:
+  * Collect: every worker decodes blocks of items into a bounded buffer of packed pairs.
+  * A full buffer is sorted and counted, the resulting runs are appended to the pairs of the worker.
+  * The pairs of a worker are compacted whenever they doubled in size,
+  * hence a worker holds about two times its distinct pairs plus the buffer instead of all pairs of all items.
+  * The tables of cells are added as counted pairs.
+  * Reduce: splitters are sampled from the sorted pairs of the workers,
+  * every partition merges the ranges of all workers independently.
+  * The partitions are ranges of packed pairs, hence the concatenation of the reduced partitions is sorted.
+  */
 struct State {
 	using DataType = SortedData;
 	const Static::OsmKeyValueObjectStore & store;
 	const sserialize::ItemIndex & items;
 	std::atomic<std::size_t> pos{0};
+	///the tables of cells are added before items are processed
+	const CellKVHistograms * histograms{nullptr};
+	std::vector<uint32_t> cells;
+	std::atomic<std::size_t> cellPos{0};
 	
-	std::mutex lock;
+	///used to hand out worker slots and partitions
+	std::atomic<uint32_t> taskPos{0};
+	///collected[worker], sorted by pair, every pair occurs once
+	std::vector<PairCounts> collected;
+	///partition p holds the pairs in [splitters[p-1], splitters[p])
+	std::vector<uint64_t> splitters;
+	///d[partition]
 	std::vector<DataType> d;
 	
 	State(const Static::OsmKeyValueObjectStore & store, const sserialize::ItemIndex & items);
+	void run(uint32_t threadCount);
+	///the concatenation of all partitions
+	DataType result();
+private:
+	template<typename T_WORKER>
+	void execute(uint32_t threadCount);
+	void sampleSplitters(uint32_t partitionCount);
 };
 
+///Collect phase
 struct Worker {
 	//number of items to fetch at once
 	static constexpr std::size_t BlockSize = 1000;
-	//number of queued key-value pairs before flushing
+	//number of buffered pairs before they are counted
 	static constexpr std::size_t FlushSize = BlockSize * 1000;
-	Data d;
 	State * state;
+	PairCounts * pairs{nullptr};
+	std::vector<uint64_t> buffer;
+	///size of pairs after the last compaction
+	std::size_t compactedSize{0};
 	Worker(State * state);
 	Worker(const Worker & other);
 	void operator()();
+	///sort and count buffer and append the runs to pairs
 	void flush();
+	///sort pairs and merge equal pairs if pairs doubled in size since the last compaction or force is set
+	void compact(bool force);
+};
+
+///Reduce phase
+struct ReduceWorker {
+	State * state;
+	ReduceWorker(State * state);
+	ReduceWorker(const ReduceWorker & other);
+	void operator()();
+	void reduce(uint32_t partition);
 };
 
 class KeyValueInfo {
@@ -128,6 +168,12 @@ public:
 	uint32_t valueCount{0};
 };
 
+///confidence interval of an estimated count
+struct CountInterval {
+	uint32_t lower{0};
+	uint32_t upper{0};
+};
+
 struct NoKeyExclusions {
 	inline bool operator()(const KeyInfo&) const {return false; }
 };
@@ -168,10 +214,26 @@ public:
 	///@param keyValueExclusions(KeyInfo,ValueInfo) -> bool; true iff we should NOT analze key-value pairs with the given key:value
 	template<typename TCompare, typename TKeyExclusions = NoKeyExclusions, typename TKeyValueExclusions = NoKeyValueExclusions>
 	std::vector<KeyValueInfo> topkv(uint32_t k, TCompare compare, TKeyExclusions keyExclusions = TKeyExclusions(), TKeyValueExclusions keyValueExclusions = TKeyValueExclusions()) const;
+public:
+	///true if the counts are estimated from a sample of the items
+	inline bool approximate() const { return m_approximate; }
+	///number of sampled items, 0 if the stats are exact
+	inline uint64_t sampleSize() const { return m_sampleSize; }
+	///(estimated) number of items
+	inline double populationSize() const { return m_populationSize; }
+	///Wilson score interval of an estimated count, z=1.96 is the 95% interval
+	///@return [count, count] if the stats are exact
+	CountInterval interval(uint32_t count, double z = 1.96) const;
+	inline CountInterval keyInterval(uint32_t keyId, double z = 1.96) const { return interval(key(keyId).count, z); }
+private:
+	friend class liboscar::KVStats;
 private:
 	std::unique_ptr<std::vector<ValueInfo>> m_valueInfoStore;
 	std::vector<KeyInfo> m_keyInfoStore;
 	std::unordered_map<uint32_t, KeyInfoPtr> m_keyInfo; //keyId -> keyInfoStore
+	bool m_approximate{false};
+	uint64_t m_sampleSize{0};
+	double m_populationSize{0};
 };
 
 template<typename TKeyCompare, typename TKeyValueCompare>
@@ -366,15 +428,56 @@ public:
 	using KeyInfo = detail::KVStats::KeyInfo;
 	using KeyValueInfo = detail::KVStats::KeyValueInfo;
 	using Stats = detail::KVStats::Stats;
+	using CountInterval = detail::KVStats::CountInterval;
+	/** Parameters of approximate stats.
+	  * The counts are estimated from a sample of the items and scaled up, hence topk and topkv work as usual.
+	  * Stats::interval() returns the confidence interval of an estimated count.
+	  * The sample size follows from the budget with about 1k decoded items per ms and thread.
+	  * If the items fit into the budget then the stats are exact.
+	  */
+	struct Approximation {
+		enum Sampling {
+			///a uniform sample of all items
+			S_UNIFORM,
+			///a systematic sample of the items of every cell, only used by stats(CellQueryResult)
+			S_CELL_STRATIFIED
+		};
+		Sampling sampling{S_UNIFORM};
+		///time budget for decoding items in milliseconds
+		uint32_t budget{100};
+		///seed of the sampling, equal seeds result in equal samples
+		uint64_t seed{0};
+	};
 public:
 	KVStats(const Static::OsmKeyValueObjectStore & other);
+public:
+	///@param histograms used by stats(CellQueryResult), may be empty
+	KVStats(const Static::OsmKeyValueObjectStore & other, const CellKVHistograms & histograms);
 public:
 	Stats stats(const sserialize::ItemIndex & items, uint32_t threadCount = 1);
+	///Same as stats(cqr.flaten()).
+	///If there are cell histograms then the stats of full-match cells are taken from them
+	///and only the items of partial-match cells and the shared items of full-match cells are decoded.
+	Stats stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount = 1);
+	///approximate stats of items, items are always sampled uniformly
+	Stats stats(const sserialize::ItemIndex & items, const Approximation & approx, uint32_t threadCount = 1);
+	///approximate stats of cqr.flaten()
+	///S_UNIFORM flattens cqr, S_CELL_STRATIFIED samples the cells in proportion to their size without flattening.
+	Stats stats(const sserialize::CellQueryResult & cqr, const Approximation & approx, uint32_t threadCount = 1);
+private:
+	friend class KVStatsSession;
+private:
+	///number of items that can be decoded within approx.budget
+	static uint64_t sampleSize(const Approximation & approx, uint32_t threadCount);
+	///scales the counts of a sample of sampleSize items by populationSize/sampleSize
+	Stats stats(detail::KVStats::SortedData && sample, uint64_t sampleSize, double populationSize);
 private:
-	Stats stats(detail::KVStats::Data && data);
+	///counted key-value pairs of items
+	detail::KVStats::SortedData data(const sserialize::ItemIndex & items, uint32_t threadCount);
 	Stats stats(detail::KVStats::SortedData && data);
 private:
 	Static::OsmKeyValueObjectStore m_store;
+	CellKVHistograms m_histograms;
 };
 
 }//end namespace livoscar
@@ -0,0 +1,38 @@
+#ifndef LIBOSCAR_KVSTATS_SESSION_H
+#define LIBOSCAR_KVSTATS_SESSION_H
+#include <liboscar/KVStats.h>
+
+namespace liboscar {
+
+/** KVStats for a sequence of related item sets, i.e. a query that is refined by the user.
+  * The session keeps the counted key-value pairs of the last item set.
+  * The next item set is either counted from scratch or by removing the counts of the items
+  * that are no longer part of the set and adding the counts of the new items, whichever touches fewer items.
+  * Narrowing "restaurant" to "restaurant Berlin" hence decodes the removed items instead of the remaining ones
+  * if the query removed less than half of the items.
+  */
+class KVStatsSession final {
+public:
+	using Stats = KVStats::Stats;
+public:
+	KVStatsSession(const KVStats & kvstats);
+	~KVStatsSession();
+	///Same as KVStats::stats(items), the session switches to items
+	Stats stats(const sserialize::ItemIndex & items, uint32_t threadCount = 1);
+	///forget the last item set, the next call of stats() counts from scratch
+	void reset();
+	///the item set of the last call of stats()
+	inline const sserialize::ItemIndex & items() const { return m_items; }
+	///true if the last call of stats() updated the counts of the previous item set
+	inline bool lastWasIncremental() const { return m_lastWasIncremental; }
+private:
+	KVStats m_kvstats;
+	sserialize::ItemIndex m_items;
+	detail::KVStats::SortedData m_data;
+	bool m_valid;
+	bool m_lastWasIncremental;
+};
+
+}//end namespace liboscar
+
+#endif
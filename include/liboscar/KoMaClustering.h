@@ -11,45 +11,80 @@
 namespace liboscar {
 namespace detail {
 namespace KoMaClustering {
+///The item positions of all key-value pairs in a single array.
+///The positions of list i are positions[offsets[i], offsets[i+1]) in ascending order.
 struct Data {
 	using KeyValue = std::pair<uint32_t, uint32_t>;
-	using KeyValueItemMap = sserialize::OADHashTable<KeyValue, std::vector<uint32_t>>;
-	KeyValueItemMap keyValueItemMap;
-	//const kvclustering::KeyExclusions &keyExclusions;
-	//const kvclustering::KeyValueExclusions &keyValueExclusions;
+	using KeyValueCountMap = sserialize::OADHashTable<KeyValue, std::size_t>;
+	///keyValues[i] is the key-value pair of list i
+	std::vector<KeyValue> keyValues;
+	std::vector<std::size_t> offsets;
+	std::vector<uint32_t> positions;
 	Data();
-	void update(const KeyValue &key, const uint32_t& itemId);
+	inline uint32_t size() const { return (uint32_t) keyValues.size(); }
+	inline uint32_t count(uint32_t i) const { return uint32_t(offsets[i+1] - offsets[i]); }
+	inline const uint32_t * begin(uint32_t i) const { return positions.data() + offsets[i]; }
+	inline const uint32_t * end(uint32_t i) const { return positions.data() + offsets[i+1]; }
 };
 
+/** Data is created in two passes over the items:
+  * Count: every chunk of consecutive item positions counts its key-value pairs.
+  * The counts define the offsets of the lists and the first slot of every chunk in every list.
+  * Fill: every chunk decodes its items again and writes the positions to its slots.
+  * Chunks are ordered by position and positions are written in order, hence all lists are sorted.
+  * There are about ChunksPerThread chunks per thread, so threads that finish early take over the remaining chunks.
+  * Every worker counts into a single hash table and copies the pairs of a finished chunk to a compact array,
+  * hence there are only as many hash tables as threads and not one per chunk.
+  */
 struct State {
+	static constexpr uint32_t ChunksPerThread = 4;
+	///chunks are not split further below this number of items
+	static constexpr std::size_t MinChunkSize = 1024;
 	const Static::OsmKeyValueObjectStore &store;
 	const sserialize::ItemIndex &items;
 	const kvclustering::KeyExclusions &keyExclusions;
 	const kvclustering::KeyValueExclusions &keyValueExclusions;
-	Data::KeyValueItemMap &keyValueItemMap;
-	std::vector<Data> d;
-	size_t numberOfThreads;
-	std::mutex m;
-	std::atomic<std::size_t> pos{0};
-	void merge();
+	Data &data;
+	uint32_t chunkCount;
+	std::atomic<uint32_t> chunkPos{0};
+	using ChunkCounts = std::vector<std::pair<Data::KeyValue, std::size_t>>;
+	///chunkCounts[chunk]: (key-value pair, count) after the count pass, (key-value pair, first slot in positions) after allocate()
+	std::vector<ChunkCounts> chunkCounts;
 	State(const Static::OsmKeyValueObjectStore &store,
 		const sserialize::ItemIndex &items,
 		const kvclustering::KeyExclusions &keyExclusions,
 		const kvclustering::KeyValueExclusions &keyValueExclusions,
-		Data::KeyValueItemMap &keyValueItemMap,
-		size_t numberOfThreads);
+		Data &data,
+		uint32_t numberOfThreads);
+	void run(uint32_t threadCount);
+	///first item position of chunk
+	std::size_t chunkBegin(uint32_t chunk) const;
+	static uint32_t numberOfChunks(std::size_t itemCount, uint32_t numberOfThreads);
+private:
+	template<typename T_WORKER>
+	void execute(uint32_t threadCount);
+	///computes the offsets of the lists and the first slot of every chunk
+	void allocate();
+};
+
+///Count pass
+struct CountWorker {
+	State * state;
+	///reused for all chunks of this worker
+	Data::KeyValueCountMap counts;
+	CountWorker(State * state);
+	CountWorker(const CountWorker & other);
+	void operator()();
 };
 
-struct Worker {
-	//number of items to fetch at once
-	static constexpr std::size_t BlockSize = 1000;
-	//number of queued key-value pairs before flushing
-	static constexpr std::size_t FlushSize = BlockSize * 1000;
+///Fill pass
+struct FillWorker {
 	State * state;
-	Data d;
+	///next free slot in positions of the current chunk, reused for all chunks of this worker
+	Data::KeyValueCountMap slots;
+	FillWorker(State * state);
+	FillWorker(const FillWorker & other);
 	void operator()();
-	void flush();
-	Worker(State * state);
 };
 } // end namespace KoMaClustering
 } // end namespace detail
@@ -77,12 +112,24 @@ private:
 	kvclustering::KeyExclusions &keyExclusions;
 	kvclustering::KeyValueExclusions &keyValueExclusions;
 	using KeyValueCountVec = std::vector<std::pair<detail::KoMaClustering::Data::KeyValue, uint32_t>>;
-	detail::KoMaClustering::Data::KeyValueItemMap keyValueItemMap;
+	detail::KoMaClustering::Data keyValueItems;
 	KeyValueCountVec keyValueCountVec;
 	KeyValueCountVec keyValueCountVecSortedByIds;
 	uint32_t threadCount;
+	///listIds[i] is the list of keyValueCountVec[i] in keyValueItems
+	std::vector<uint32_t> listIds;
+	///item positions of keyValueCountVec[i] as bitset, only built for pairs that are part of many items
+	std::vector<std::vector<uint64_t>> itemBitsets;
+	///(i << 32) | j with i < j -> intersects(i, j), the sets do not change between calls of topKeyValues()
+	std::unordered_map<uint64_t, bool> intersectionCache;
 
 	void sort();
+	///true if keyValueCountVec[i] and keyValueCountVec[j] have more than (count_i + count_j)/200 items in common
+	bool intersects(uint32_t i, uint32_t j);
+	bool computeIntersects(uint32_t i, uint32_t j);
+	///a list is stored as bitset if the bitset does not need more space than the list
+	inline bool isDense(uint32_t i) const { return uint64_t(keyValueCountVec[i].second)*32 >= items.size(); }
+	const std::vector<uint64_t> & itemBitset(uint32_t i);
 public:
 	void preprocess() override;
 
@@ -0,0 +1,89 @@
+#ifndef LIBOSCAR_OSM_COMPLETER_SNAPSHOT_H
+#define LIBOSCAR_OSM_COMPLETER_SNAPSHOT_H
+#include <vector>
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <liboscar/CellDistanceBySphere.h>
+#include <liboscar/CellDistanceByAnulus.h>
+#define LIBOSCAR_OSM_COMPLETER_SNAPSHOT_VERSION 1
+
+namespace liboscar {
+
+/** Snapshot of structures that are derived from the data files during the setup of an OsmCompleter.
+  * A snapshot is written once after the setup and used on later starts instead of recomputing the structures.
+  * It is only valid for the dataset it was created from, this is checked by the fingerprint.
+  * The fingerprint covers the complete content of small files and the sizes,
+  * headers and samples of large files, a snapshot with a different fingerprint is not used.
+  * Modification times are not part of it, hence copying the files together with the snapshot keeps it valid.
+  * The GeoHierarchySubGraph and the cache of the CQRDilator are not part of a snapshot.
+  * They are sserialize types without a serialized form and are still built on every start.
+  * A snapshot consists of sections, every section is identified by its type and a parameter.
+  * The parameter of cell distance and neighbor ladder sections is the cell distance type.
+  *
+  * file layout:
+  *
+  *----------------------------------------------------------------
+  *VERSION|Fingerprint|SectionCount|SectionInfo             |Data
+  *----------------------------------------------------------------
+  *  u8   |    u64    |    u32     |(u8,u8,u64,u64)[Count]  |*
+  *----------------------------------------------------------------
+  *
+  * SectionInfo: Type|Param|Offset|Size, Offset is relative to the beginning of Data.
+  *
+  * Cell infos of spheres: CellCount u32|(Lat,Lon,Radius)[CellCount]
+  * Cell infos of annuli: CellCount u32|(Lat,Lon,InnerRadius,OuterRadius)[CellCount]
+  * All values of cell infos are the bit patterns of doubles stored as u64, hence they are restored exactly.
+  * Cell hulls and neighbor ladders are stored in their own file format, see CellDistanceByHull and CellNeighborLadder.
+  * Tag phrases are stored as defined by TagPhraseCompleter.
+  */
+class OsmCompleterSnapshot final {
+public:
+	typedef enum : uint8_t {
+		ST_INVALID=0, ST_CELL_DISTANCE=1, ST_CELL_HULLS=2, ST_CELL_NEIGHBOR_LADDER=3, ST_TAG_PHRASES=4
+	} SectionType;
+	struct Section {
+		SectionType type;
+		uint8_t param;
+		sserialize::UByteArrayAdapter data;
+	};
+public:
+	OsmCompleterSnapshot();
+	OsmCompleterSnapshot(const sserialize::UByteArrayAdapter & d);
+	~OsmCompleterSnapshot();
+	inline uint64_t fingerprint() const { return m_fingerprint; }
+	inline uint32_t sectionCount() const { return (uint32_t) m_sections.size(); }
+	bool hasSection(SectionType type, uint8_t param = 0) const;
+	///throws sserialize::MissingDataException if there is no such section
+	sserialize::UByteArrayAdapter section(SectionType type, uint8_t param = 0) const;
+public:
+	static void create(uint64_t fingerprint, const std::vector<Section> & sections, sserialize::UByteArrayAdapter & dest);
+	///FNV-1a hash of the data files.
+	///Files of up to FullHashSize bytes are hashed completely.
+	///Of larger files the size, the first and last HeaderSize bytes, which hold the headers and versions, and 4096 sampled bytes are hashed.
+	static uint64_t fingerprint(const std::vector<sserialize::UByteArrayAdapter> & files);
+	static void putCellInfos(const std::vector<CellDistanceBySphere::CellInfo> & ci, sserialize::UByteArrayAdapter & dest);
+	static void putCellInfos(const std::vector<CellDistanceByAnulus::CellInfo> & ci, sserialize::UByteArrayAdapter & dest);
+	static std::vector<CellDistanceBySphere::CellInfo> sphereCellInfos(const sserialize::UByteArrayAdapter & d);
+	static std::vector<CellDistanceByAnulus::CellInfo> anulusCellInfos(const sserialize::UByteArrayAdapter & d);
+private:
+	struct SectionInfo {
+		SectionType type;
+		uint8_t param;
+		sserialize::UByteArrayAdapter::OffsetType offset;
+		sserialize::UByteArrayAdapter::OffsetType size;
+	};
+	static constexpr uint32_t SectionInfoSize = 1+1+8+8;
+	static constexpr sserialize::UByteArrayAdapter::OffsetType FullHashSize = 16*1024*1024;
+	static constexpr sserialize::UByteArrayAdapter::OffsetType HeaderSize = 64*1024;
+private:
+	static void putDouble(double v, sserialize::UByteArrayAdapter & dest);
+	static double getDouble(const sserialize::UByteArrayAdapter & d, sserialize::UByteArrayAdapter::OffsetType pos);
+	static void checkSize(const sserialize::UByteArrayAdapter & d, sserialize::UByteArrayAdapter::OffsetType size);
+private:
+	sserialize::UByteArrayAdapter m_data;
+	std::vector<SectionInfo> m_sections;
+	uint64_t m_fingerprint;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef LIBOSCAR_PREPARED_GEO_POLYGON_H
+#define LIBOSCAR_PREPARED_GEO_POLYGON_H
+#include <vector>
+#include <sserialize/spatial/GeoPolygon.h>
+#include <sserialize/spatial/GeoRect.h>
+#include <sserialize/Static/GeoWay.h>
+#include <sserialize/Static/GeoPolygon.h>
+#include <sserialize/Static/GeoMultiPolygon.h>
+
+namespace liboscar {
+
+/** A query polygon prepared for many predicate evaluations against static item geometry.
+  * The edges are stored as structure of arrays (lat0, lon0, lat1, lon1) which allows the
+  * point-in-polygon and segment-intersection kernels to test multiple edges (or points) at once.
+  * The kernels use AVX2 or SSE2 if the compiler targets them and a scalar implementation otherwise.
+  *
+  * Polygons with more than IndexThreshold edges additionally get an edge index:
+  * A uniform grid over the bounding box whose cells store copies of the edges overlapping them
+  * and horizontal strips (the rows of the grid) storing the edges overlapping their latitude range.
+  * Point queries then only look at the edges of one strip, segment and rectangle queries only at
+  * the edges of the grid cells they overlap.
+  *
+  * A simplified polygon (see simplified()) accounts for its simplification error in the rectangle predicates:
+  * intersects(rect) may return true for rectangles up to the error away, encloses(rect) only returns true
+  * if the original polygon encloses rect as well. All other predicates treat the simplified polygon as exact.
+  *
+  * A prepared polygon may consist of multiple rings which are combined with the even-odd rule.
+  * Holes are therefore given as additional rings inside their outer ring.
+  *
+  * All predicates are evaluated in the lat/lon plane just like sserialize::spatial::GeoPolygon.
+  * Touching boundaries count as intersection and prevent enclosure.
+  */
+class PreparedGeoPolygon final {
+public:
+	static constexpr std::size_t IndexThreshold = 64;
+	///average number of edges per grid cell
+	static constexpr std::size_t EdgesPerGridCell = 8;
+	static constexpr uint32_t MaxGridDimension = 512;
+public:
+	PreparedGeoPolygon();
+	explicit PreparedGeoPolygon(const sserialize::spatial::GeoPolygon & gp);
+	///the rings are combined with the even-odd rule
+	explicit PreparedGeoPolygon(const std::vector<sserialize::spatial::GeoPolygon> & rings);
+	PreparedGeoPolygon(const PreparedGeoPolygon & other) = default;
+	PreparedGeoPolygon(PreparedGeoPolygon && other) = default;
+	~PreparedGeoPolygon();
+	PreparedGeoPolygon & operator=(const PreparedGeoPolygon & other) = default;
+	PreparedGeoPolygon & operator=(PreparedGeoPolygon && other) = default;
+public:
+	using const_iterator = std::vector<sserialize::spatial::GeoPoint>::const_iterator;
+public:
+	inline const sserialize::spatial::GeoRect & boundary() const { return m_boundary; }
+	inline std::size_t edgeCount() const { return m_edges.size(); }
+	///length of the boundary in meters
+	inline double length() const { return m_length; }
+	///vertices of all rings
+	inline const std::vector<sserialize::spatial::GeoPoint> & vertices() const { return m_vertices; }
+	inline std::size_t ringCount() const { return m_ringAnchors.size(); }
+	inline const_iterator ringBegin(std::size_t i) const { return m_vertices.cbegin()+m_ringBegin.at(i); }
+	inline const_iterator ringEnd(std::size_t i) const { return m_vertices.cbegin()+m_ringBegin.at(i+1); }
+	inline bool hasIndex() const { return m_index.rows; }
+	///maximum distance between the boundary of the original and the simplified polygon, 0 if this polygon was not simplified
+	inline double simplificationError() const { return m_simplificationError; }
+	/** Douglas-Peucker simplification of every ring with tolerance epsilon (in degrees).
+	  * Every point in which the original and the simplified polygon differ is within epsilon of the simplified boundary.
+	  * Rings that would collapse are kept unchanged.
+	  */
+	PreparedGeoPolygon simplified(double epsilon) const;
+public:
+	bool contains(double lat, double lon) const;
+	bool contains(const sserialize::spatial::GeoPoint & p) const;
+	///result[i] = contains(lat[i], lon[i]), vectorized over the points
+	void contains(const double * lat, const double * lon, std::size_t count, uint8_t * result) const;
+	///true iff any of the points is inside
+	bool containsAny(const double * lat, const double * lon, std::size_t count) const;
+	///true iff any segment (lat[i], lon[i]) -> (lat[i+1], lon[i+1]) intersects an edge
+	bool intersectsChain(const double * lat, const double * lon, std::size_t count) const;
+public:
+	bool intersects(const sserialize::spatial::GeoRect & rect) const;
+	bool encloses(const sserialize::spatial::GeoRect & rect) const;
+	bool intersects(const sserialize::Static::spatial::GeoWay & way) const;
+	bool intersects(const sserialize::Static::spatial::GeoPolygon & poly) const;
+	bool encloses(const sserialize::Static::spatial::GeoPolygon & poly) const;
+	///true iff poly encloses this polygon
+	bool enclosedBy(const sserialize::Static::spatial::GeoPolygon & poly) const;
+	bool intersects(const sserialize::Static::spatial::GeoMultiPolygon & mp) const;
+	///may return false if a hole of this polygon lies within a hole of mp
+	bool encloses(const sserialize::Static::spatial::GeoMultiPolygon & mp) const;
+private:
+	struct EdgeStore {
+		std::vector<double> lat0;
+		std::vector<double> lon0;
+		std::vector<double> lat1;
+		std::vector<double> lon1;
+		inline std::size_t size() const { return lat0.size(); }
+		void push_back(double lat0, double lon0, double lat1, double lon1);
+		void reserve(std::size_t size);
+	};
+	struct EdgeIndex {
+		uint32_t rows{0};
+		uint32_t cols{0};
+		double latStep{0};
+		double lonStep{0};
+		///grid cell (row-major) i holds the edges [cellBegin[i], cellBegin[i+1]) of cellEdges
+		std::vector<uint32_t> cellBegin;
+		EdgeStore cellEdges;
+		///strip (grid row) i holds the edges [stripBegin[i], stripBegin[i+1]) of stripEdges
+		std::vector<uint32_t> stripBegin;
+		EdgeStore stripEdges;
+	};
+	///range of grid cells, end is inclusive
+	struct GridRange {
+		uint32_t rowBegin;
+		uint32_t rowEnd;
+		uint32_t colBegin;
+		uint32_t colEnd;
+		inline std::size_t size() const { return std::size_t(rowEnd-rowBegin+1)*(colEnd-colBegin+1); }
+	};
+private:
+	void addRing(const std::vector<sserialize::spatial::GeoPoint> & ring);
+	void buildIndex();
+	uint32_t row(double lat) const;
+	uint32_t col(double lon) const;
+	///returns false if the rectangle does not overlap the grid
+	bool gridRange(double minLat, double minLon, double maxLat, double maxLon, GridRange & range) const;
+	bool crossingParity(double lat, double lon) const;
+	bool edgesIntersect(double pLat, double pLon, double qLat, double qLon) const;
+	///true iff any edge intersects the closed rectangle
+	bool edgesIntersect(const sserialize::spatial::GeoRect & rect) const;
+private:
+	sserialize::spatial::GeoRect m_boundary;
+	double m_length{0};
+	double m_simplificationError{0};
+	EdgeStore m_edges;
+	std::vector<sserialize::spatial::GeoPoint> m_vertices;
+	///ring i consists of the vertices [m_ringBegin[i], m_ringBegin[i+1])
+	std::vector<std::size_t> m_ringBegin{0};
+	///one vertex of each ring, needed for enclosure tests
+	std::vector<sserialize::spatial::GeoPoint> m_ringAnchors;
+	EdgeIndex m_index;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef LIBOSCAR_SIMD_VEC_D_H
+#define LIBOSCAR_SIMD_VEC_D_H
+#include <cstddef>
+#if defined(__AVX2__) || defined(__SSE2__)
+	#include <immintrin.h>
+#endif
+
+/** Minimal vector of doubles so that every kernel is written only once.
+  * This is an internal header of the geometry kernels, it is only included by translation units.
+  * VecD uses AVX2 or SSE2 depending on the compile target, LIBOSCAR_SIMD_VECD is defined if either is available.
+  * Kernels need a scalar path for the remaining elements and for targets without both.
+  * Comparisons return a bit mask with one bit per lane, Full is the mask with all lanes set.
+  */
+
+namespace liboscar {
+namespace detail {
+
+#if defined(__AVX2__)
+struct VecD {
+	static constexpr std::size_t Width = 4;
+	static constexpr int Full = 0xF;
+	__m256d v;
+	VecD(__m256d v) : v(v) {}
+	static inline VecD load(const double * p) { return _mm256_loadu_pd(p); }
+	static inline VecD set1(double x) { return _mm256_set1_pd(x); }
+	static inline void store(double * p, VecD a) { _mm256_storeu_pd(p, a.v); }
+	friend inline VecD operator+(VecD a, VecD b) { return _mm256_add_pd(a.v, b.v); }
+	friend inline VecD operator-(VecD a, VecD b) { return _mm256_sub_pd(a.v, b.v); }
+	friend inline VecD operator*(VecD a, VecD b) { return _mm256_mul_pd(a.v, b.v); }
+	static inline VecD min(VecD a, VecD b) { return _mm256_min_pd(a.v, b.v); }
+	static inline VecD max(VecD a, VecD b) { return _mm256_max_pd(a.v, b.v); }
+	static inline int lt(VecD a, VecD b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+	static inline int le(VecD a, VecD b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)); }
+	static inline int gt(VecD a, VecD b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)); }
+	static inline int ge(VecD a, VecD b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ)); }
+};
+#define LIBOSCAR_SIMD_VECD
+#elif defined(__SSE2__)
+struct VecD {
+	static constexpr std::size_t Width = 2;
+	static constexpr int Full = 0x3;
+	__m128d v;
+	VecD(__m128d v) : v(v) {}
+	static inline VecD load(const double * p) { return _mm_loadu_pd(p); }
+	static inline VecD set1(double x) { return _mm_set1_pd(x); }
+	static inline void store(double * p, VecD a) { _mm_storeu_pd(p, a.v); }
+	friend inline VecD operator+(VecD a, VecD b) { return _mm_add_pd(a.v, b.v); }
+	friend inline VecD operator-(VecD a, VecD b) { return _mm_sub_pd(a.v, b.v); }
+	friend inline VecD operator*(VecD a, VecD b) { return _mm_mul_pd(a.v, b.v); }
+	static inline VecD min(VecD a, VecD b) { return _mm_min_pd(a.v, b.v); }
+	static inline VecD max(VecD a, VecD b) { return _mm_max_pd(a.v, b.v); }
+	static inline int lt(VecD a, VecD b) { return _mm_movemask_pd(_mm_cmplt_pd(a.v, b.v)); }
+	static inline int le(VecD a, VecD b) { return _mm_movemask_pd(_mm_cmple_pd(a.v, b.v)); }
+	static inline int gt(VecD a, VecD b) { return _mm_movemask_pd(_mm_cmpgt_pd(a.v, b.v)); }
+	static inline int ge(VecD a, VecD b) { return _mm_movemask_pd(_mm_cmpge_pd(a.v, b.v)); }
+};
+#define LIBOSCAR_SIMD_VECD
+#endif
+
+}//end namespace detail
+}//end namespace liboscar
+
+#endif
@@ -9,6 +9,12 @@
 #include <liboscar/TextSearch.h>
 #include <liboscar/GeoSearch.h>
 #include <liboscar/CQRFromRouting.h>
+#include <liboscar/CQRFromPolygon.h>
+#include <liboscar/CQRFromComplexSpatialQuery.h>
+#include <liboscar/CellCenterIndex.h>
+#include <liboscar/CellNeighborLadder.h>
+#include <liboscar/OsmCompleterSnapshot.h>
+#include <liboscar/CellKVHistograms.h>
 #include <sserialize/spatial/CellDistance.h>
 #include <sserialize/Static/CellTextCompleter.h>
 #include <sserialize/search/GeoCompleter.h>
@@ -42,8 +48,25 @@ private:
 	uint8_t m_selectedGeoCompleter;
 	sserialize::spatial::GeoHierarchySubGraph m_ghsg;
 	std::shared_ptr<sserialize::spatial::interface::CellDistance> m_cellDistance;
+	///spatial index over the cells of m_cellDistance, may be empty
+	std::shared_ptr<liboscar::CellCenterIndex> m_cellCenterIndex;
+	///precomputed neighbors for m_cellDistance, may be empty
+	std::shared_ptr<liboscar::CellNeighborLadder> m_cellNeighborLadder;
+	///CellDistanceType of m_cellDistance
+	uint8_t m_cellDistanceType;
+	///derived structures of an earlier start, may be empty
+	liboscar::OsmCompleterSnapshot m_snapshot;
+	///per cell key/value tables for KVStats, may be empty
+	liboscar::CellKVHistograms m_cellKVHistograms;
 	sserialize::Static::CQRDilator m_cqrd;
 	std::shared_ptr<liboscar::interface::CQRFromRouting> m_cqrr;
+	liboscar::CQRFromPolygon m_cqrfp;
+	///settings of m_cqrfp, they are applied by energize() since m_cqrfp is created there
+	uint32_t m_cqrfpTileCacheSize;
+	liboscar::CQRFromPolygon::AutoAccuracyParameters m_cqrfpAutoAccuracy;
+	std::shared_ptr<liboscar::RegionHullCache> m_regionHulls;
+	///average number of cells an item is in
+	double m_cellItemDuplication;
 	
 private:
 	sserialize::RCPtrWrapper<TagCompleter> m_tagCompleter;
@@ -59,8 +82,18 @@ private:
 		itemSet.registerSelectableOpFilter( m_tagPhraseCompleter.priv() );
 	}
 	sserialize::StringCompleter getItemsCompleter() const;
+	std::shared_ptr<liboscar::CellCenterIndex> makeCellCenterIndex() const;
+	///fingerprint of the data files, see OsmCompleterSnapshot
+	uint64_t snapshotFingerprint() const;
 public:
-	typedef enum {CDT_CENTER_OF_MASS, CDT_ANULUS, CDT_MIN_SPHERE, CDT_SPHERE} CellDistanceType;
+	///CDT_HULL uses the cellhulls file if there is one and computes the hulls otherwise
+	typedef enum {CDT_CENTER_OF_MASS, CDT_ANULUS, CDT_MIN_SPHERE, CDT_SPHERE, CDT_HULL} CellDistanceType;
+	///Estimated number of items of a query, the exact number is in [min, max]
+	struct CountEstimate {
+		uint32_t min;
+		uint32_t max;
+		uint32_t estimate;
+	};
 public:
 	OsmCompleter();
 	virtual ~OsmCompleter();
@@ -82,16 +115,53 @@ public:
 	inline const sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter> & geoCompleter() const { return m_geoCompleters.at(m_selectedGeoCompleter); }
 	inline sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter> & geoCompleter() { return m_geoCompleters.at(m_selectedGeoCompleter); }
 	inline const sserialize::Static::CQRDilator & cqrd() const { return m_cqrd; }
+	inline std::shared_ptr<liboscar::CellCenterIndex> const & cellCenterIndex() const { return m_cellCenterIndex; }
+	inline std::shared_ptr<liboscar::CellNeighborLadder> const & cellNeighborLadder() const { return m_cellNeighborLadder; }
 	inline std::shared_ptr<liboscar::interface::CQRFromRouting> const & cqrr() const { return m_cqrr; }
+	inline const liboscar::CQRFromPolygon & cqrfp() const { return m_cqrfp; }
+	///empty if there is no cellkvhistograms file, see KVStats::stats(const sserialize::CellQueryResult&, uint32_t)
+	inline const liboscar::CellKVHistograms & cellKVHistograms() const { return m_cellKVHistograms; }
 	
 	bool setTextSearcher(TextSearch::Type t, uint8_t pos);
 	bool setGeoCompleter(uint8_t pos);
 	void setCellDistance(CellDistanceType cdt, uint32_t threadCount);
 	///@param threshold in meter
 	void setCQRDilatorCache(uint32_t threshold, uint32_t threadCount);
+	///Build a CellCenterIndex matching the current cell distance, dilations then use it instead of the CQRDilator.
+	///The index is rebuilt by setCellDistance.
+	void setCellCenterIndex(bool enabled);
+	///Use precomputed neighbors for dilations up to the largest radius of the ladder, see CellNeighborLadder.
+	///If radii is empty then the cellneighborladder file is used if there is one, otherwise the ladder is disabled.
+	///The ladder has to match the cell distance, hence setCellDistance disables it.
+	///@param radii in meters, see CellNeighborLadder::defaultRadii()
+	void setCellNeighborLadder(const std::vector<uint32_t> & radii, uint32_t threadCount);
+	/** Write the derived structures to a snapshot which is used by later calls of energize() with the same data.
+	  * The snapshot contains the cell infos of sphere and anulus cell distances, the cell hulls,
+	  * the neighbor ladder and the tag phrases, as far as they are present.
+	  * setCellDistance and setCellNeighborLadder use the snapshot instead of recomputing the structures.
+	  * The GeoHierarchySubGraph and the CQRDilator cache are not covered and are built as before.
+	  * @param fileName defaults to the snapshot file in the files directory
+	  */
+	void writeSnapshot(const std::string & fileName = std::string()) const;
+	/** Build one of the optional cell files and store it next to the other files.
+	  * energize() loads it on the next start, instead of computing the structure on demand or doing without it.
+	  * Supported are FC_CELL_ITEM_RTREE, FC_CELL_HULLS, FC_CELL_KV_HISTOGRAMS and FC_CELL_NEIGHBOR_LADDER.
+	  * The neighbor ladder depends on the cell distance and is the one set by setCellNeighborLadder.
+	  * Requires energize() to have loaded the store and the index.
+	  * @param fileName defaults to the file of fc in the files directory
+	  */
+	void writeCellFile(liboscar::FileConfig fc, uint32_t threadCount, const std::string & fileName = std::string()) const;
+	inline const liboscar::OsmCompleterSnapshot & snapshot() const { return m_snapshot; }
 
 	void setCQRFromRouting(std::shared_ptr<liboscar::interface::CQRFromRouting> v);
 	void setCQRFromRouting(liboscar::adaptors::CQRFromRoutingFromCellList::Operator v);
+	///@param maxTiles number of cached tiles, 0 disables the tile cache, see CQRFromPolygon::setTileCacheSize
+	///May be called before energize(), the setting is kept
+	void setCQRFromPolygonTileCache(uint32_t maxTiles);
+	///see CQRFromPolygon::AutoAccuracyParameters, may be called before energize(), the setting is kept
+	void setCQRFromPolygonAutoAccuracy(const liboscar::CQRFromPolygon::AutoAccuracyParameters & params);
+	///compute the convex hulls of all regions used by the between operator, otherwise they are computed on demand
+	void precomputeRegionHulls(uint32_t threadCount);
 	
 	inline uint8_t selectedGeoCompleter() { return m_selectedGeoCompleter; }
 	inline uint8_t selectedTextSearcher(TextSearch::Type t) { return m_textSearch.selectedTextSearcher(t); }
@@ -109,6 +179,15 @@ public:
 	///@param threadCount: the number of threads used to flatten a TreedCQR
 	sserialize::CellQueryResult cqrComplete(const std::string & query, bool treedCQR = false, uint32_t threadCount = 1);
 	sserialize::CellQueryResult cqr(sserialize::ItemIndex const & fullMatchCells) const;
+	///exact number of items matching query
+	///The query is computed completely, only the union of the cell indexes of the result is never created.
+	uint32_t cqrCount(const std::string & query, uint32_t threadCount = 1);
+	///number of items matching query, set operations are estimated from their operands without intersecting item indexes
+	///All other operations are computed and estimated from the sizes of their cell indexes, see AdvancedCellOpTree::Calc::estimate()
+	CountEstimate cqrEstimate(const std::string & query, uint32_t threadCount = 1);
+	///true if at least one item matches query
+	///Set operations stop as soon as their first operand decides the result, see AdvancedCellOpTree::Calc::exists()
+	bool cqrExists(const std::string & query, uint32_t threadCount = 1);
 	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string& query, const sserialize::spatial::GeoHierarchySubGraph & ghs, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1);
 	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string& query, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1);
 	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string & query);
@@ -28,7 +28,12 @@ enum FileConfig {
 	FC_TAGSTORE=4,
 	FC_GEO_SEARCH=5,
 	FC_END=6,
-	FC_TAGSTORE_PHRASES=7
+	FC_TAGSTORE_PHRASES=7,
+	FC_CELL_ITEM_RTREE=8,
+	FC_CELL_HULLS=9,
+	FC_CELL_NEIGHBOR_LADDER=10,
+	FC_SNAPSHOT=11,
+	FC_CELL_KV_HISTOGRAMS=12
 };
 
 FileConfig fileConfigFromString(const std::string & str);
@@ -38,7 +38,13 @@ class TagPhraseCompleter: public sserialize::SetOpTree::ExternalFunctoid {
 public:
 	TagPhraseCompleter();
 	TagPhraseCompleter(const liboscar::Static::TagStore & tagStore, std::istream & phrases);
+	///@param d data created by serialize()
+	TagPhraseCompleter(const sserialize::Static::ItemIndexStore & indexStore, const sserialize::UByteArrayAdapter & d);
 	virtual ~TagPhraseCompleter();
+	/** EntryCount|(PhraseLength|Phrase|IndexCount|IndexIds)[EntryCount]
+	  * EntryCount is a u32, all other numbers are vl-packed u32, the phrase is stored as its bytes.
+	  */
+	void serialize(sserialize::UByteArrayAdapter & dest) const;
 	virtual sserialize::ItemIndex complete(const std::string & queryString) const;
 	virtual sserialize::ItemIndex complete(const std::string & queryString) override;
 	/** @param query : format of the query: (special phrase; special phrase...);  */
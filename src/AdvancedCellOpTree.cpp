@@ -1,6 +1,216 @@
 #include <liboscar/AdvancedCellOpTree.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
 
 namespace liboscar {
+namespace {
+
+///Region counters indexed by region id, pays off if a large part of the regions is touched
+class DenseRegionCounter {
+public:
+	DenseRegionCounter(uint32_t regionSize) : m_counts(regionSize, 0) {}
+	inline void add(uint32_t rId, uint32_t weight) {
+		if (!m_counts[rId]) {
+			m_regions.push_back(rId);
+		}
+		m_counts[rId] += weight;
+	}
+	void merge(const DenseRegionCounter & other) {
+		for(uint32_t rId : other.m_regions) {
+			add(rId, other.m_counts[rId]);
+		}
+	}
+	template<typename T_FUNC>
+	void visit(T_FUNC func) const {
+		for(uint32_t rId : m_regions) {
+			func(rId, m_counts[rId]);
+		}
+	}
+private:
+	std::vector<uint32_t> m_counts;
+	std::vector<uint32_t> m_regions;
+};
+
+///Region counters for the touched regions only
+class SparseRegionCounter {
+public:
+	SparseRegionCounter(uint32_t /*regionSize*/) {}
+	inline void add(uint32_t rId, uint32_t weight) {
+		m_counts[rId] += weight;
+	}
+	void merge(const SparseRegionCounter & other) {
+		for(const auto & x : other.m_counts) {
+			add(x.first, x.second);
+		}
+	}
+	template<typename T_FUNC>
+	void visit(T_FUNC func) const {
+		for(const auto & x : m_counts) {
+			func(x.first, x.second);
+		}
+	}
+private:
+	std::unordered_map<uint32_t, uint32_t> m_counts;
+};
+
+///Sums up the weight of the cells of cqr for each of their parent regions.
+///The cells are processed in blocks by multiple threads, each with its own counters.
+///A single thread counts into result directly.
+///@param byItems weight a cell by its number of items instead of 1
+template<typename T_COUNTER>
+void regionCoverage(
+	const sserialize::CellQueryResult & cqr,
+	const sserialize::Static::spatial::GeoHierarchy & gh,
+	bool byItems,
+	uint32_t threadCount,
+	T_COUNTER & result)
+{
+	static constexpr uint32_t BlockSize = 1024;
+	struct State {
+		const sserialize::CellQueryResult & cqr;
+		const sserialize::Static::spatial::GeoHierarchy & gh;
+		bool byItems;
+		bool shared;
+		std::atomic<uint32_t> pos{0};
+		std::mutex lock;
+		T_COUNTER & result;
+		State(const sserialize::CellQueryResult & cqr, const sserialize::Static::spatial::GeoHierarchy & gh, bool byItems, bool shared, T_COUNTER & result) :
+		cqr(cqr), gh(gh), byItems(byItems), shared(shared), result(result)
+		{}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			if (state->shared) {
+				process(state->result);
+			}
+			else {
+				T_COUNTER counter(state->gh.regionSize());
+				process(counter);
+				std::lock_guard<std::mutex> lck(state->lock);
+				state->result.merge(counter);
+			}
+		}
+		void process(T_COUNTER & counter) {
+			const sserialize::Static::spatial::GeoHierarchy & gh = state->gh;
+			uint32_t cellCount = state->cqr.cellCount();
+			while (true) {
+				uint32_t blockBegin = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
+				if (blockBegin >= cellCount) {
+					break;
+				}
+				auto it(state->cqr.begin() + blockBegin);
+				for(uint32_t i(blockBegin), s(std::min(cellCount, blockBegin+BlockSize)); i < s; ++i, ++it) {
+					uint32_t cellId = it.cellId();
+					uint32_t weight = (state->byItems ? it.idxSize() : 1);
+					if (!weight) {
+						continue;
+					}
+					for(uint32_t cP(gh.cellParentsBegin(cellId)), cE(gh.cellParentsEnd(cellId)); cP != cE; ++cP) {
+						counter.add(gh.cellPtr(cP), weight);
+					}
+				}
+			}
+		}
+	};
+	//threads only pay off for larger results
+	threadCount = std::max<uint32_t>(1, std::min<uint32_t>(threadCount, cqr.cellCount()/BlockSize));
+	State state(cqr, gh, byItems, threadCount == 1, result);
+	if (threadCount == 1) {
+		Worker worker(&state);
+		worker();
+	}
+	else {
+		sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+}
+
+///regions whose weight of cells of cqr relative to their size given by regionSize(rId) is larger than th
+///Dense counters are only used if cqr has many cells compared to the number of regions.
+template<typename T_REGION_SIZE>
+std::vector<uint32_t> coveredRegions(
+	const sserialize::CellQueryResult & cqr,
+	const sserialize::Static::spatial::GeoHierarchy & gh,
+	bool byItems,
+	double th,
+	uint32_t threadCount,
+	T_REGION_SIZE regionSize)
+{
+	//a cell usually has a few parents, hence cellCount*DenseFactor approximates the number of touched counters
+	static constexpr uint64_t DenseFactor = 8;
+	std::vector<uint32_t> regions;
+	auto select = [&regions, &regionSize, th](uint32_t rId, uint32_t weight) {
+		if (double(weight) / regionSize(rId) > th) {
+			regions.push_back(rId);
+		}
+	};
+	if (uint64_t(cqr.cellCount())*DenseFactor >= gh.regionSize()) {
+		DenseRegionCounter counter(gh.regionSize());
+		regionCoverage(cqr, gh, byItems, threadCount, counter);
+		counter.visit(select);
+	}
+	else {
+		SparseRegionCounter counter(gh.regionSize());
+		regionCoverage(cqr, gh, byItems, threadCount, counter);
+		counter.visit(select);
+	}
+	return regions;
+}
+
+///union of the cell indexes of regions by a single k-way merge
+sserialize::ItemIndex regionCellsUnion(
+	const std::vector<uint32_t> & regions,
+	const sserialize::Static::spatial::GeoHierarchy & gh,
+	const sserialize::Static::ItemIndexStore & idxStore)
+{
+	if (!regions.size()) {
+		return sserialize::ItemIndex();
+	}
+	if (regions.size() == 1) {
+		return idxStore.at( gh.regionCellIdxPtr(regions.front()) );
+	}
+	struct Cursor {
+		sserialize::ItemIndex idx;
+		sserialize::ItemIndex::const_iterator it;
+		sserialize::ItemIndex::const_iterator end;
+	};
+	std::vector<Cursor> cursors(regions.size());
+	std::size_t maxSize = 0;
+	using HeapEntry = std::pair<uint32_t, uint32_t>;
+	std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+	for(uint32_t i(0), s(regions.size()); i < s; ++i) {
+		Cursor & c = cursors[i];
+		c.idx = idxStore.at( gh.regionCellIdxPtr(regions[i]) );
+		c.it = c.idx.begin();
+		c.end = c.idx.end();
+		maxSize = std::max<std::size_t>(maxSize, c.idx.size());
+		if (c.it != c.end) {
+			heap.emplace(*c.it, i);
+		}
+	}
+	std::vector<uint32_t> result;
+	result.reserve(maxSize);
+	while (heap.size()) {
+		HeapEntry e = heap.top();
+		heap.pop();
+		if (!result.size() || result.back() != e.first) {
+			result.push_back(e.first);
+		}
+		Cursor & c = cursors[e.second];
+		++c.it;
+		if (c.it != c.end) {
+			heap.emplace(*c.it, e.second);
+		}
+	}
+	return sserialize::ItemIndex(std::move(result));
+}
+
+} //end namespace
 
 AdvancedCellOpTree::
 AdvancedCellOpTree(
@@ -50,6 +260,22 @@ sserialize::CellQueryResult AdvancedCellOpTree::CalcBase::calcBetweenOp(const ss
 	return result;
 }
 
+sserialize::CellQueryResult AdvancedCellOpTree::CalcBase::calcWithinOp(Node * node, const sserialize::CellQueryResult & c1, const sserialize::CellQueryResult & c2) {
+	double distance = 0.0;
+	try {
+		distance = sserialize::stod(node->value);
+	}
+	catch (std::invalid_argument & e) {
+		return sserialize::CellQueryResult();
+	}
+	sserialize::CellQueryResult result( m_csq.withinOp(c1, c2, distance, m_threadCount) );
+	int resultFlags = c1.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS;
+	if ((result.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS) != resultFlags) {
+		result = result.convert(resultFlags);
+	}
+	return result;
+}
+
 sserialize::CellQueryResult AdvancedCellOpTree::CalcBase::calcCompassOp(liboscar::AdvancedCellOpTree::Node* node, const sserialize::CellQueryResult& cqr) {
 	CQRFromComplexSpatialQuery::UnaryOp direction = CQRFromComplexSpatialQuery::UO_INVALID;
 	if (node->value == "^" || node->value == "north-of") {
@@ -81,33 +307,28 @@ sserialize::CellQueryResult AdvancedCellOpTree::CalcBase::calcInOp(Node *, const
 	);
 }
 
+sserialize::CellQueryResult AdvancedCellOpTree::CalcBase::calcKnnOp(Node * node, const sserialize::CellQueryResult & cqr) {
+	std::vector<double> tmp( asDoubles(node->value) );
+	if (tmp.size() != 3 || tmp[0] < 1.0) {
+		return sserialize::CellQueryResult();
+	}
+	uint32_t k = uint32_t(std::min<double>(tmp[0], std::numeric_limits<uint32_t>::max()));
+	sserialize::CellQueryResult result( m_csq.knnOp(cqr, sserialize::spatial::GeoPoint(tmp[1], tmp[2]), k) );
+	int resultFlags = cqr.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS;
+	if ((result.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS) != resultFlags) {
+		result = result.convert(resultFlags);
+	}
+	return result;
+}
+
 sserialize::ItemIndex AdvancedCellOpTree::CalcBase::calcDilateRegionByCellCoverageOp(double th, const sserialize::CellQueryResult & cqr) {
 	const sserialize::Static::spatial::GeoHierarchy & gh = m_ctc.geoHierarchy();
 	const sserialize::Static::ItemIndexStore & idxStore = this->idxStore();
 
-	std::vector<uint32_t> regions;
-
-	std::unordered_map<uint32_t, uint32_t> r2cc;
-	
-	for(auto it(cqr.cbegin()), end(cqr.cend()); it != end; ++it) {
-		uint32_t cellId = it.cellId();
-		for(uint32_t cP(gh.cellParentsBegin(cellId)), cE(gh.cellParentsEnd(cellId)); cP != cE; ++cP) {
-			uint32_t rId = gh.cellPtr(cP);
-			r2cc[rId] += 1; //default init is 0 for uint32_t
-		}
-	}
-	for(auto x : r2cc) {
-		if ( (double)x.second / (double)idxStore.idxSize( gh.regionCellIdxPtr(x.first) ) > th) {
-			regions.push_back(x.first);
-		}
-	}
-	
-	//regions need to be unique
-	sserialize::ItemIndex res = sserialize::treeReduceMap<std::vector<uint32_t>::iterator, sserialize::ItemIndex>(regions.begin(), regions.end(),
-		[](const sserialize::ItemIndex & a, const sserialize::ItemIndex & b) { return a+b; },
-		[&gh, &idxStore](uint32_t x) { return idxStore.at( gh.regionCellIdxPtr(x) ); }
-	);
-	return res;
+	std::vector<uint32_t> regions( coveredRegions(cqr, gh, false, th, m_threadCount, [&gh, &idxStore](uint32_t rId) {
+		return (double) idxStore.idxSize( gh.regionCellIdxPtr(rId) );
+	}) );
+	return regionCellsUnion(regions, gh, idxStore);
 }
 
 sserialize::ItemIndex AdvancedCellOpTree::CalcBase::calcDilateRegionByCellCoverageOp(AdvancedCellOpTree::Node * node, const sserialize::CellQueryResult & cqr) {
@@ -127,30 +348,10 @@ sserialize::ItemIndex AdvancedCellOpTree::CalcBase::calcDilateRegionByItemCovera
 	const sserialize::Static::spatial::GeoHierarchy & gh = m_ctc.geoHierarchy();
 	const sserialize::Static::ItemIndexStore & idxStore = this->idxStore();
 
-	std::vector<uint32_t> regions;
-
-	std::unordered_map<uint32_t, uint32_t> r2cc;
-	
-	for(auto it(cqr.cbegin()), end(cqr.cend()); it != end; ++it) {
-		uint32_t cellId = it.cellId();
-		uint32_t cellIdxSize = it.idxSize();
-		for(uint32_t cP(gh.cellParentsBegin(cellId)), cE(gh.cellParentsEnd(cellId)); cP != cE; ++cP) {
-			uint32_t rId = gh.cellPtr(cP);
-			r2cc[rId] +=  cellIdxSize; //default init is 0 for uint32_t
-		}
-	}
-	for(auto x : r2cc) {
-		if ( (double(x.second) / gh.regionItemsCount(x.first)) > th) {
-			regions.push_back(x.first);
-		}
-	}
-	
-	//regions need to be unique
-	sserialize::ItemIndex res = sserialize::treeReduceMap<std::vector<uint32_t>::iterator, sserialize::ItemIndex>(regions.begin(), regions.end(),
-		[](const sserialize::ItemIndex & a, const sserialize::ItemIndex & b) { return a+b; },
-		[&gh, &idxStore](uint32_t x) { return idxStore.at( gh.regionCellIdxPtr(x) ); }
-	);
-	return res;
+	std::vector<uint32_t> regions( coveredRegions(cqr, gh, true, th, m_threadCount, [&gh](uint32_t rId) {
+		return (double) gh.regionItemsCount(rId);
+	}) );
+	return regionCellsUnion(regions, gh, idxStore);
 }
 
 sserialize::ItemIndex AdvancedCellOpTree::CalcBase::calcDilateRegionByItemCoverageOp(AdvancedCellOpTree::Node * node, const sserialize::CellQueryResult & cqr) {
@@ -222,6 +423,90 @@ sserialize::CellQueryResult AdvancedCellOpTree::CalcBase::toCQR(const sserialize
 	return cqr.toCQR( this->threadCount() );
 }
 
+bool AdvancedCellOpTree::CalcBase::hasItems(const sserialize::CellQueryResult & cqr) {
+	for(sserialize::CellQueryResult::const_iterator it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		if (it.idxSize()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool AdvancedCellOpTree::CalcBase::hasItems(const sserialize::TreedCellQueryResult & cqr) const {
+	return hasItems( toCQR(cqr) );
+}
+
+AdvancedCellOpTree::CountEstimate
+AdvancedCellOpTree::CalcBase::cqrEstimate(const sserialize::CellQueryResult & cqr, double cellItemDuplication) const {
+	//full match cells are counted from the index store, partial match cells from their own index
+	uint64_t sum = 0;
+	uint32_t largest = 0;
+	for(sserialize::CellQueryResult::const_iterator it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		uint32_t cellSize = it.idxSize();
+		sum += cellSize;
+		largest = std::max(largest, cellSize);
+	}
+	CountEstimate result;
+	result.max = uint32_t( std::min<uint64_t>(sum, store().size()) );
+	result.min = std::min(largest, result.max);
+	//items in several cells are counted multiple times, correct this by the average number of cells per item
+	double estimate = (cqr.cellCount() > 1 ? double(sum) / cellItemDuplication : double(sum));
+	result.estimate = uint32_t( std::max<double>(result.min, std::min<double>(result.max, estimate)) );
+	return result;
+}
+
+AdvancedCellOpTree::CountEstimate
+AdvancedCellOpTree::CalcBase::cqrEstimate(const sserialize::TreedCellQueryResult & cqr, double cellItemDuplication) const {
+	return cqrEstimate(toCQR(cqr), cellItemDuplication);
+}
+
+AdvancedCellOpTree::CountEstimate
+AdvancedCellOpTree::CalcBase::combineEstimates(char op, const CountEstimate & a, const CountEstimate & b) const {
+	uint64_t itemCount = store().size();
+	//fraction of all items that is part of b
+	double pb = std::min<double>(1.0, double(b.estimate) / std::max<uint64_t>(itemCount, 1));
+	double estimate;
+	CountEstimate result;
+	switch (op) {
+	case '+':
+		result.min = std::max(a.min, b.min);
+		result.max = uint32_t( std::min<uint64_t>(uint64_t(a.max) + b.max, itemCount) );
+		estimate = a.estimate + b.estimate - a.estimate*pb;
+		break;
+	case '/':
+	case ' ':
+		result.min = 0;
+		result.max = std::min(a.max, b.max);
+		estimate = a.estimate*pb;
+		break;
+	case '-':
+		result.min = (a.min > b.max ? a.min - b.max : 0);
+		result.max = a.max;
+		estimate = a.estimate - a.estimate*pb;
+		break;
+	case '^':
+		result.min = (a.min > b.max ? a.min - b.max : (b.min > a.max ? b.min - a.max : 0));
+		result.max = uint32_t( std::min<uint64_t>(uint64_t(a.max) + b.max, itemCount) );
+		estimate = a.estimate + b.estimate - 2*a.estimate*pb;
+		break;
+	default:
+		throw sserialize::UnsupportedFeatureException("AdvancedCellOpTree::CalcBase::combineEstimates: unknown set operation");
+	}
+	result.min = std::min(result.min, result.max);
+	result.estimate = uint32_t( std::max<double>(result.min, std::min<double>(result.max, estimate)) );
+	return result;
+}
+
+sserialize::ItemIndex AdvancedCellOpTree::CalcBase::dilateCells(const sserialize::CellQueryResult & cqr, double distance) const {
+	if (m_cnl && distance <= m_cnl->maxRadius()) {
+		return m_cnl->dilate(cqr, distance, m_threadCount);
+	}
+	if (m_cci) {
+		return m_cci->dilate(cqr, distance, m_threadCount);
+	}
+	return m_cqrd.dilate(cqr, distance, m_threadCount);
+}
+
 template<>
 sserialize::CellQueryResult
 AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcDilationOp(AdvancedCellOpTree::Node* node) {
@@ -229,7 +514,7 @@ AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcDilationOp(AdvancedCe
 	sserialize::CellQueryResult cqr( calc(node->children.front()) );
 	return cqr +
 		sserialize::CellQueryResult(
-									m_cqrd.dilate(cqr, diameter, m_threadCount),
+									dilateCells(cqr, diameter),
 									cqr.cellInfo(),
 									cqr.idxStore(),
 									cqr.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS
@@ -243,7 +528,7 @@ AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcDilationOp(Advan
 	sserialize::TreedCellQueryResult cqr( calc(node->children.front()) );
 	return cqr +
 		sserialize::TreedCellQueryResult(
-										m_cqrd.dilate(toCQR(cqr), diameter, m_threadCount),
+										dilateCells(toCQR(cqr), diameter),
 										cqr.cellInfo(),
 										cqr.idxStore(),
 										cqr.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS
@@ -313,6 +598,20 @@ AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcBetweenOp(Advanc
 	return sserialize::TreedCellQueryResult( CalcBase::calcBetweenOp(toCQR(calc(node->children.front())), toCQR(calc(node->children.back()))) );
 }
 
+template<>
+sserialize::CellQueryResult
+AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcWithinOp(AdvancedCellOpTree::Node* node) {
+	SSERIALIZE_CHEAP_ASSERT(node->children.size() == 2);
+	return CalcBase::calcWithinOp(node, calc(node->children.front()), calc(node->children.back()));
+}
+
+template<>
+sserialize::TreedCellQueryResult
+AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcWithinOp(AdvancedCellOpTree::Node* node) {
+	SSERIALIZE_CHEAP_ASSERT(node->children.size() == 2);
+	return sserialize::TreedCellQueryResult( CalcBase::calcWithinOp(node, toCQR(calc(node->children.front())), toCQR(calc(node->children.back()))) );
+}
+
 template<>
 sserialize::CellQueryResult
 AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcCompassOp(AdvancedCellOpTree::Node* node) {
@@ -341,6 +640,20 @@ AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcInOp(AdvancedCel
 	return sserialize::TreedCellQueryResult( CalcBase::calcInOp(node, toCQR(calc(node->children.front()))) );
 }
 
+template<>
+sserialize::CellQueryResult
+AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcKnnOp(AdvancedCellOpTree::Node* node) {
+	SSERIALIZE_CHEAP_ASSERT(node->children.size() == 1);
+	return CalcBase::calcKnnOp(node, calc(node->children.front()));
+}
+
+template<>
+sserialize::TreedCellQueryResult
+AdvancedCellOpTree::Calc<sserialize::TreedCellQueryResult>::calcKnnOp(AdvancedCellOpTree::Node* node) {
+	SSERIALIZE_CHEAP_ASSERT(node->children.size() == 1);
+	return sserialize::TreedCellQueryResult( CalcBase::calcKnnOp(node, toCQR(calc(node->children.front()))) );
+}
+
 template<>
 sserialize::CellQueryResult
 AdvancedCellOpTree::Calc<sserialize::CellQueryResult>::calcRelevantElementOp(AdvancedCellOpTree::Node* node) {
@@ -235,6 +235,9 @@ Token Tokenizer::next() {
 			else if (tmp == "qec") {
 				t.type = Token::QUERY_EXCLUSIVE_CELLS;
 			}
+			else if (tmp == "knn") {
+				t.type = Token::KNN;
+			}
 			else if (tmp == "cell") {
 				t.type = Token::CELL;
 				opSeparates = true;
@@ -320,6 +323,10 @@ Token Tokenizer::next() {
 				t.type = Token::NEAR_OP;
 				t.value = "near";
 			}
+			else if (t.value.compare(0, 7, "within:") == 0) {
+				t.type = Token::WITHIN_OP;
+				t.value = t.value.substr(7);
+			}
 			return t;
 		}
 		case '*':
@@ -438,6 +445,9 @@ detail::AdvancedOpTree::Node* Parser::parseUnaryOps() {
 	case Token::QUERY_EXCLUSIVE_CELLS:
 		nst = Node::QUERY_EXCLUSIVE_CELLS;
 		break;
+	case Token::KNN:
+		nst = Node::KNN_OP;
+		break;
 	default:
 		break;
 	}
@@ -452,6 +462,7 @@ detail::AdvancedOpTree::Node* Parser::parseUnaryOps() {
 	case Token::COMPASS_OP:
 	case Token::RELEVANT_ELEMENT_OP:
 	case Token::QUERY_EXCLUSIVE_CELLS:
+	case Token::KNN:
 	{
 		pop();
 		Node * unaryOpNode = new Node();
@@ -488,6 +499,7 @@ detail::AdvancedOpTree::Node* Parser::parseSingleQ() {
 		return tmp;
 	}
 	case Token::QUERY_EXCLUSIVE_CELLS:
+	case Token::KNN:
 	case Token::FM_CONVERSION_OP:
 	case Token::CELL_DILATION_OP:
 	case Token::REGION_DILATION_BY_CELL_COVERAGE_OP:
@@ -617,6 +629,7 @@ detail::AdvancedOpTree::Node* Parser::parseQ() {
 		case Token::COMPASS_OP:
 		case Token::RELEVANT_ELEMENT_OP:
 		case Token::QUERY_EXCLUSIVE_CELLS:
+		case Token::KNN:
 		{
 			curTokenNode = parseUnaryOps();
 			if (!curTokenNode) { //something went wrong, skip this op
@@ -626,13 +639,22 @@ detail::AdvancedOpTree::Node* Parser::parseQ() {
 		}
 		case Token::SET_OP:
 		case Token::BETWEEN_OP:
+		case Token::WITHIN_OP:
 		{
 			pop();
 			 //we need to have a valid child, otherwise this operation is bogus (i.e. Q ++ Q)
 			if (n && !(n->baseType == Node::BINARY_OP && n->children.size() < 2)) {
 				Node * opNode = new Node();
 				opNode->baseType = Node::BINARY_OP;
-				opNode->subType = (t.type == Token::SET_OP ? Node::SET_OP : Node::BETWEEN_OP);
+				if (t.type == Token::SET_OP) {
+					opNode->subType = Node::SET_OP;
+				}
+				else if (t.type == Token::BETWEEN_OP) {
+					opNode->subType = Node::BETWEEN_OP;
+				}
+				else {
+					opNode->subType = Node::WITHIN_OP;
+				}
 				opNode->value = t.value;
 				opNode->children.push_back(n);
 				n = 0;
@@ -1,5 +1,15 @@
 #include <liboscar/CQRFromComplexSpatialQuery.h>
+#include <liboscar/ItemGeoDistance.h>
 #include <sserialize/spatial/LatLonCalculations.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 
 //CGAL stuff
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
@@ -8,8 +18,8 @@
 
 namespace liboscar {
 
-CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp) :
-m_priv(new detail::CQRFromComplexSpatialQuery(ssc, cqrfp))
+CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp, const std::shared_ptr<RegionHullCache> & regionHulls) :
+m_priv(new detail::CQRFromComplexSpatialQuery(ssc, cqrfp, regionHulls))
 {}
 
 CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const CQRFromComplexSpatialQuery& other) :
@@ -34,11 +44,20 @@ sserialize::CellQueryResult CQRFromComplexSpatialQuery::betweenOp(const sseriali
 	return m_priv->betweenOp(cqr1, cqr2, threadCount);
 }
 
+sserialize::CellQueryResult CQRFromComplexSpatialQuery::knnOp(const sserialize::CellQueryResult & cqr, const sserialize::spatial::GeoPoint & p, uint32_t k) const {
+	return m_priv->knnOp(cqr, p, k);
+}
+
+sserialize::CellQueryResult CQRFromComplexSpatialQuery::withinOp(const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, double distance, uint32_t threadCount) const {
+	return m_priv->withinOp(cqr1, cqr2, distance, threadCount);
+}
+
 namespace detail {
 
-CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const liboscar::CQRFromPolygon & cqrfp) :
+CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const liboscar::CQRFromPolygon & cqrfp, const std::shared_ptr<liboscar::RegionHullCache> & regionHulls) :
 m_ssc(ssc),
 m_cqrfp(cqrfp),
+m_regionHulls(regionHulls),
 m_itemQueryItemCountTh(20),
 m_itemQueryCellCountTh(10)
 {}
@@ -148,6 +167,32 @@ createPolygon(
 	this->normalize(pp);
 }
 
+void
+CQRFromComplexSpatialQuery::
+createPolygon(
+	const RegionHullCache::Hull & hull1,
+	const RegionHullCache::Hull & hull2,
+	std::vector<sserialize::spatial::GeoPoint> & pp) const
+{
+	RegionHullCache::Hull points;
+	points.reserve(hull1.size()+hull2.size());
+	points.insert(points.end(), hull1.begin(), hull1.end());
+	points.insert(points.end(), hull2.begin(), hull2.end());
+	RegionHullCache::convexHull(points, pp);
+	this->normalize(pp);
+}
+
+RegionHullCache::HullPtr CQRFromComplexSpatialQuery::regionHull(uint32_t ghId) const {
+	if (m_regionHulls) {
+		return m_regionHulls->hull(ghId);
+	}
+	return RegionHullCache::shapeHull(store().geoShape(geoHierarchy().ghIdToStoreId(ghId)));
+}
+
+RegionHullCache::HullPtr CQRFromComplexSpatialQuery::itemHull(uint32_t itemId) const {
+	return RegionHullCache::shapeHull(store().geoShape(itemId));
+}
+
 
 void
 CQRFromComplexSpatialQuery::
@@ -619,25 +664,23 @@ sserialize::CellQueryResult CQRFromComplexSpatialQuery::betweenOp(const sseriali
 		return cqrFromPolygon( sserialize::spatial::GeoPolygon(pp), cqrFlags, threadCount);
 	}
 	else if (qit1 == QIT_ITEM || qit2 == QIT_ITEM) {
-		//item <-> region, just use the bounding box of the item and the bounding box of the region
-		sserialize::spatial::GeoRect rect1, rect2;
-		if (qit1 == QIT_ITEM) {
-			uint32_t itemId = id1;
-			rect1 = store().geoShape(itemId).boundary();
-			rect2 = geoHierarchy().regionBoundary(id2);
-		}
-		else {
-			uint32_t itemId = id2;
-			rect1 = store().geoShape(itemId).boundary();
-			rect2 = geoHierarchy().regionBoundary(id1);
-		}
+		//item <-> region, use the convex hull of the item and the region geometry
+		uint32_t itemId = (qit1 == QIT_ITEM ? id1 : id2);
+		uint32_t regionId = (qit1 == QIT_ITEM ? id2 : id1);
 		std::vector<sserialize::spatial::GeoPoint> gp;
-		createPolygon(rect1, rect2, gp);
+		createPolygon(*itemHull(itemId), *regionHull(regionId), gp);
+		if (gp.size() < 3) {
+			return sserialize::CellQueryResult();
+		}
 		return cqrFromPolygon(sserialize::spatial::GeoPolygon(gp), cqrFlags, threadCount);
 	}
 	else {
+		//the convex hull of both region hulls is much tighter than a polygon spanned by the region bounding boxes
 		std::vector<sserialize::spatial::GeoPoint> gp;
-		createPolygon(geoHierarchy().regionBoundary(id1), geoHierarchy().regionBoundary(id2), gp);
+		createPolygon(*regionHull(id1), *regionHull(id2), gp);
+		if (gp.size() < 3) {
+			return sserialize::CellQueryResult();
+		}
 		
 		sserialize::ItemIndex tmp(cqrfp().fullMatches(sserialize::spatial::GeoPolygon(gp), liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX, threadCount));
 		//now remove the cells that are part of the input regions
@@ -647,6 +690,226 @@ sserialize::CellQueryResult CQRFromComplexSpatialQuery::betweenOp(const sseriali
 	}
 }
 
+sserialize::CellQueryResult CQRFromComplexSpatialQuery::knnOp(const sserialize::CellQueryResult & cqr, const sserialize::spatial::GeoPoint & p, uint32_t k) const {
+	if (!k || !cqr.cellCount()) {
+		return sserialize::CellQueryResult();
+	}
+	struct Candidate {
+		double distance;
+		uint32_t id;
+		Candidate(double distance, uint32_t id) : distance(distance), id(id) {}
+		bool operator<(const Candidate & other) const {
+			return (distance == other.distance ? id < other.id : distance < other.distance);
+		}
+		bool operator>(const Candidate & other) const { return other < *this; }
+	};
+	ItemGeoDistance igd(p);
+	
+	//the bounding box of a cell gives a lower bound for all of its items
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > cells;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		cells.emplace(igd.distance(geoHierarchy().cellBoundary(cqr.cellId(i))), i);
+	}
+	//max-heap of the k best items found so far
+	std::priority_queue<Candidate> best;
+	std::unordered_set<uint32_t> seen;
+	while (cells.size()) {
+		Candidate cell = cells.top();
+		cells.pop();
+		if (best.size() == k && best.top().distance <= cell.distance) {
+			break;
+		}
+		sserialize::ItemIndex cellItems(cqr.idx(cell.id));
+		for(uint32_t itemId : cellItems) {
+			if (!seen.insert(itemId).second) {
+				continue;
+			}
+			auto shape = store().geoShape(itemId);
+			if (best.size() == k && best.top().distance <= igd.distance(shape.boundary())) {
+				continue;
+			}
+			Candidate item(igd.distance(shape), itemId);
+			if (best.size() < k) {
+				best.push(item);
+			}
+			else if (item < best.top()) {
+				best.pop();
+				best.push(item);
+			}
+		}
+	}
+	
+	//result items are put into all of their cells
+	std::map<uint32_t, std::vector<uint32_t> > cell2Items;
+	for(; best.size(); best.pop()) {
+		uint32_t itemId = best.top().id;
+		if (store().isRegion(itemId)) {
+			for(uint32_t cellId : idxStore().at(geoHierarchy().regionCellIdxPtr(geoHierarchy().storeIdToGhId(itemId)))) {
+				cell2Items[cellId].push_back(itemId);
+			}
+		}
+		else {
+			for(uint32_t cellId : store().cells(itemId)) {
+				cell2Items[cellId].push_back(itemId);
+			}
+		}
+	}
+	std::vector<uint32_t> pmCells;
+	std::vector<sserialize::ItemIndex> pmIdx;
+	pmCells.reserve(cell2Items.size());
+	pmIdx.reserve(cell2Items.size());
+	for(auto & x : cell2Items) {
+		std::sort(x.second.begin(), x.second.end());
+		pmCells.push_back(x.first);
+		pmIdx.emplace_back(std::move(x.second));
+	}
+	return sserialize::CellQueryResult(sserialize::ItemIndex(), sserialize::ItemIndex(std::move(pmCells)), pmIdx.begin(), cellInfo(), idxStore(), sserialize::CellQueryResult::FF_CELL_GLOBAL_ITEM_IDS);
+}
+
+sserialize::CellQueryResult CQRFromComplexSpatialQuery::withinOp(const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, double distance, uint32_t threadCount) const {
+	if (!cqr1.cellCount() || !cqr2.cellCount() || distance < 0.0) {
+		return sserialize::CellQueryResult();
+	}
+	static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+	///the cache of loaded items of a worker is cleared before the next cell of cqr1 once it holds more items
+	static constexpr std::size_t MaxCachedItems = 1 << 16;
+	
+	struct State {
+		const CQRFromComplexSpatialQuery * that;
+		const sserialize::CellQueryResult & cqr1;
+		const sserialize::CellQueryResult & cqr2;
+		double distance;
+		///cellId -> position in cqr2
+		std::vector<uint32_t> cqr2Pos;
+		std::atomic<uint32_t> cqr1Pos{0};
+		///matching items per cell of cqr1
+		std::vector< std::vector<uint32_t> > matches;
+		State(const CQRFromComplexSpatialQuery * that, const sserialize::CellQueryResult & cqr1, const sserialize::CellQueryResult & cqr2, double distance) :
+		that(that), cqr1(cqr1), cqr2(cqr2), distance(distance),
+		cqr2Pos(that->geoHierarchy().cellSize(), npos),
+		matches(cqr1.cellCount())
+		{
+			for(uint32_t i(0), s(cqr2.cellCount()); i < s; ++i) {
+				cqr2Pos.at(cqr2.cellId(i)) = i;
+			}
+		}
+	};
+	struct Worker {
+		struct ItemInfo {
+			sserialize::spatial::GeoRect rect;
+			uint32_t itemId;
+		};
+		State * state;
+		///items of the already loaded cells of cqr2
+		std::unordered_map<uint32_t, std::vector<ItemInfo> > cqr2Items;
+		std::size_t cachedItems = 0;
+		///visit marks for the cell graph search
+		std::vector<uint32_t> visited;
+		uint32_t visitMark = 0;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		const std::vector<ItemInfo> & items2(uint32_t pos) {
+			auto it = cqr2Items.find(pos);
+			if (it != cqr2Items.end()) {
+				return it->second;
+			}
+			std::vector<ItemInfo> & dest = cqr2Items[pos];
+			for(uint32_t itemId : state->cqr2.idx(pos)) {
+				dest.push_back(ItemInfo{state->that->store().geoShape(itemId).boundary(), itemId});
+			}
+			cachedItems += dest.size();
+			return dest;
+		}
+		///positions in cqr2 of the cells that may contain items near cellId
+		void candidates(uint32_t cellId, std::vector<uint32_t> & dest) {
+			const sserialize::Static::spatial::GeoHierarchy & gh = state->that->geoHierarchy();
+			const sserialize::Static::spatial::TracGraph & cg = state->that->store().cellGraph();
+			if (visited.size() != state->cqr2Pos.size()) {
+				visited.assign(state->cqr2Pos.size(), 0);
+			}
+			++visitMark;
+			sserialize::spatial::GeoRect cellRect(gh.cellBoundary(cellId));
+			std::vector<uint32_t> queue(1, cellId);
+			visited.at(cellId) = visitMark;
+			//cells near cellId are connected to it by a chain of cells that are near cellId as well
+			for(std::size_t i(0); i < queue.size(); ++i) {
+				uint32_t cur = queue[i];
+				if (state->cqr2Pos[cur] != npos) {
+					dest.push_back(state->cqr2Pos[cur]);
+				}
+				auto node = cg.node(cur);
+				for(uint32_t j(0), s(node.size()); j < s; ++j) {
+					uint32_t nId = node.neighborCellId(j);
+					if (visited.at(nId) != visitMark && ItemGeoDistance::distance(cellRect, gh.cellBoundary(nId)) <= state->distance) {
+						visited.at(nId) = visitMark;
+						queue.push_back(nId);
+					}
+				}
+			}
+		}
+		void operator()() {
+			std::vector<uint32_t> cells2;
+			while (true) {
+				uint32_t pos = state->cqr1Pos.fetch_add(1, std::memory_order_relaxed);
+				if (pos >= state->cqr1.cellCount()) {
+					break;
+				}
+				cells2.clear();
+				candidates(state->cqr1.cellId(pos), cells2);
+				if (!cells2.size()) {
+					continue;
+				}
+				//neighboring cells of cqr1 share most of their candidates, hence the cache is kept as long as it is small
+				if (cachedItems > MaxCachedItems) {
+					cqr2Items.clear();
+					cachedItems = 0;
+				}
+				std::vector<uint32_t> & dest = state->matches[pos];
+				for(uint32_t itemId1 : state->cqr1.idx(pos)) {
+					auto shape1 = state->that->store().geoShape(itemId1);
+					sserialize::spatial::GeoRect rect1(shape1.boundary());
+					bool match = false;
+					for(uint32_t pos2 : cells2) {
+						for(const ItemInfo & ii : items2(pos2)) {
+							//an item is within any distance of itself
+							if (ii.itemId == itemId1) {
+								match = true;
+								break;
+							}
+							if (ItemGeoDistance::distance(rect1, ii.rect) > state->distance) {
+								continue;
+							}
+							if (ItemGeoDistance::withinDistance(shape1, state->that->store().geoShape(ii.itemId), state->distance)) {
+								match = true;
+								break;
+							}
+						}
+						if (match) {
+							break;
+						}
+					}
+					if (match) {
+						dest.push_back(itemId1);
+					}
+				}
+			}
+		}
+	};
+	
+	State state(this, cqr1, cqr2, distance);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	
+	std::vector<uint32_t> pmCells;
+	std::vector<sserialize::ItemIndex> pmIdx;
+	for(uint32_t i(0), s(cqr1.cellCount()); i < s; ++i) {
+		if (state.matches[i].size()) {
+			pmCells.push_back(cqr1.cellId(i));
+			pmIdx.emplace_back(std::move(state.matches[i]));
+		}
+	}
+	return sserialize::CellQueryResult(sserialize::ItemIndex(), sserialize::ItemIndex(std::move(pmCells)), pmIdx.begin(), cellInfo(), idxStore(), sserialize::CellQueryResult::FF_CELL_GLOBAL_ITEM_IDS);
+}
+
 //todo: clip
 sserialize::CellQueryResult CQRFromComplexSpatialQuery::compassOp(const sserialize::CellQueryResult& cqr, liboscar::CQRFromComplexSpatialQuery::UnaryOp direction, uint32_t threadCount) const {
 	if (cqr.cellCount() == 0) {
@@ -796,6 +1059,31 @@ namespace {
 		}
 		static Stat min() { return Stat(std::numeric_limits<uint32_t>::max(), 0, 0, 1); }
 	};
+	
+	struct StatScratch {
+		std::vector<Stat> stats;
+		std::vector<uint32_t> dirty;
+		///clear the entries touched since the last reset
+		void reset(uint32_t regionCount) {
+			for(uint32_t rid : dirty) {
+				stats[rid] = Stat();
+			}
+			dirty.clear();
+			if (stats.size() < regionCount) {
+				stats.resize(regionCount);
+			}
+		}
+		Stat & at(uint32_t rid) {
+			if (rid >= stats.size()) {
+				stats.resize(rid+1);
+			}
+			Stat & s = stats[rid];
+			if (!s.valid()) {
+				dirty.push_back(rid);
+			}
+			return s;
+		}
+	};
 } //end namespace
 
 void
@@ -805,15 +1093,18 @@ CQRFromComplexSpatialQuery::determineQueryItemType(const sserialize::CellQueryRe
 		return;
 	}
 
+	//dense per-thread scratch space indexed by region id, only the touched entries are reset
+	thread_local StatScratch scratch;
+	scratch.reset(geoHierarchy().regionSize());
+	
 	Stat best = Stat::min();
-	std::unordered_map<uint32_t, Stat> r2s;
 	for(sserialize::CellQueryResult::const_iterator it(cqr.begin()), end(cqr.end()); it != end; ++it) {
 		auto cellParents = m_ssc.cellParents(it.cellId());
 		bool fm = it.fullMatch();
 		bool pm = !fm;
 		for(uint32_t rid : cellParents) {
-			Stat & s = r2s[rid];
-			if (!s.rcc) {
+			Stat & s = scratch.at(rid);
+			if (!s.valid()) {
 				s.rid = rid;
 				s.rcc = m_ssc.regionCellCount(rid);
 			}
@@ -831,17 +1122,36 @@ CQRFromComplexSpatialQuery::determineQueryItemType(const sserialize::CellQueryRe
 	id = best.rid;
 	//check if this could be a item query
 	if (best.fmc < best.rcc && best.pmc + best.fmc < m_itemQueryCellCountTh) {
-		sserialize::ItemIndex items( cqr.flaten() );
-		if (!items.size()) {
-			throw sserialize::BugException("CQR items are empty, but cells are not: cellCount=" + std::to_string(cqr.cellCount()));
-		}
-		if (items.size() < m_itemQueryItemCountTh) {
+		std::vector<uint32_t> items;
+		if (itemCountSmallerThan(cqr, m_itemQueryItemCountTh, items)) {
+			if (!items.size()) {
+				throw sserialize::BugException("CQR items are empty, but cells are not: cellCount=" + std::to_string(cqr.cellCount()));
+			}
 			qit = QIT_ITEM;
-			id = determineRelevantItem( items );
+			id = determineRelevantItem( sserialize::ItemIndex(std::move(items)) );
 		}
 	}
 }
 
+bool
+CQRFromComplexSpatialQuery::itemCountSmallerThan(const sserialize::CellQueryResult & cqr, uint32_t threshold, std::vector<uint32_t> & items) const {
+	items.clear();
+	for(sserialize::CellQueryResult::const_iterator it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		//a single cell with enough items decides it without fetching any index
+		if (it.idxSize() >= threshold) {
+			return false;
+		}
+		sserialize::ItemIndex cellItems(it.idx());
+		items.insert(items.end(), cellItems.begin(), cellItems.end());
+		std::sort(items.begin(), items.end());
+		items.erase(std::unique(items.begin(), items.end()), items.end());
+		if (items.size() >= threshold) {
+			return false;
+		}
+	}
+	return true;
+}
+
 detail::CQRFromComplexSpatialQuery::SubSet
 CQRFromComplexSpatialQuery::createSubSet(const sserialize::CellQueryResult cqr) const {
 	return m_ssc.subSet(cqr, false, 1);
@@ -906,3 +1216,109 @@ uint32_t CQRFromComplexSpatialQuery::determineRelevantItem(const sserialize::Ite
 
 
 }}//end namespace liboscar::detail
+
+namespace liboscar {
+
+RegionHullCache::RegionHullCache(const liboscar::Static::OsmKeyValueObjectStore & store) :
+m_store(store),
+m_hulls(store.geoHierarchy().regionSize())
+{}
+
+RegionHullCache::~RegionHullCache() {}
+
+RegionHullCache::HullPtr RegionHullCache::hull(uint32_t ghId) const {
+	if (ghId >= m_hulls.size()) {
+		throw sserialize::OutOfBoundsException("liboscar::RegionHullCache::hull: ghId=" + std::to_string(ghId));
+	}
+	{
+		std::lock_guard<std::mutex> lck(m_lock);
+		if (m_hulls[ghId]) {
+			return m_hulls[ghId];
+		}
+	}
+	//computing the hull may take a while, other threads may compute the same hull in the meantime which is fine
+	HullPtr result = shapeHull(m_store.geoShape(m_store.geoHierarchy().ghIdToStoreId(ghId)));
+	std::lock_guard<std::mutex> lck(m_lock);
+	if (!m_hulls[ghId]) {
+		m_hulls[ghId] = result;
+	}
+	return m_hulls[ghId];
+}
+
+void RegionHullCache::precompute(uint32_t threadCount) {
+	struct State {
+		const RegionHullCache * that;
+		std::atomic<uint32_t> ghId{0};
+		State(const RegionHullCache * that) : that(that) {}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			for(uint32_t ghId(state->ghId.fetch_add(1)), s(state->that->m_hulls.size()); ghId < s; ghId = state->ghId.fetch_add(1)) {
+				state->that->hull(ghId);
+			}
+		}
+	};
+	State state(this);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+}
+
+void RegionHullCache::appendPoints(const sserialize::Static::spatial::GeoShape & shape, Hull & dest) {
+	switch (shape.type()) {
+	case sserialize::spatial::GS_POINT:
+		dest.emplace_back(*shape.get<sserialize::spatial::GS_POINT>());
+		break;
+	case sserialize::spatial::GS_WAY:
+		for(sserialize::spatial::GeoPoint x : *shape.get<sserialize::spatial::GS_WAY>()) {
+			dest.emplace_back(x);
+		}
+		break;
+	case sserialize::spatial::GS_POLYGON:
+		for(sserialize::spatial::GeoPoint x : *shape.get<sserialize::spatial::GS_POLYGON>()) {
+			dest.emplace_back(x);
+		}
+		break;
+	case sserialize::spatial::GS_MULTI_POLYGON:
+	{
+		//inner polygons lie within the outer polygons and don't change the hull
+		auto gmp = shape.get<sserialize::spatial::GS_MULTI_POLYGON>();
+		for(uint32_t i(0), s((uint32_t) gmp->outerPolygons().size()); i < s; ++i) {
+			for(sserialize::spatial::GeoPoint x : gmp->outerPolygons().at(i)) {
+				dest.emplace_back(x);
+			}
+		}
+		break;
+	}
+	default:
+	{
+		sserialize::spatial::GeoRect rect(shape.boundary());
+		dest.emplace_back(rect.minLat(), rect.minLon());
+		dest.emplace_back(rect.minLat(), rect.maxLon());
+		dest.emplace_back(rect.maxLat(), rect.maxLon());
+		dest.emplace_back(rect.maxLat(), rect.minLon());
+		break;
+	}
+	}
+}
+
+void RegionHullCache::convexHull(const Hull & points, Hull & dest) {
+	typedef detail::CHFromPoints::Point_2 Point_2;
+	std::vector<Point_2> cgalPoints;
+	cgalPoints.reserve(points.size());
+	for(const sserialize::spatial::GeoPoint & x : points) {
+		cgalPoints.emplace_back(x.lat(), x.lon());
+	}
+	detail::CHFromPoints::calc(cgalPoints.begin(), cgalPoints.end(), dest);
+}
+
+RegionHullCache::HullPtr RegionHullCache::shapeHull(const sserialize::Static::spatial::GeoShape & shape) {
+	Hull points;
+	appendPoints(shape, points);
+	auto result = std::make_shared<Hull>();
+	convexHull(points, *result);
+	return result;
+}
+
+}//end namespace liboscar
@@ -1,7 +1,14 @@
 #include <liboscar/CQRFromPolygon.h>
+#include <sserialize/algorithm/utilfuncs.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace liboscar {
 
+CQRFromPolygon::CQRFromPolygon() {}
+
 CQRFromPolygon::CQRFromPolygon(const CQRFromPolygon & other) :
 m_priv(other.m_priv)
 {}
@@ -30,17 +37,61 @@ const sserialize::Static::ItemIndexStore & CQRFromPolygon::idxStore() const {
 }
 
 sserialize::ItemIndex CQRFromPolygon::fullMatches(const sserialize::spatial::GeoPolygon & gp, Accuracy ac, uint32_t threadCount) const {
-	return m_priv->fullMatches(gp, ac, threadCount);
+	return m_priv->fullMatches(PreparedGeoPolygon(gp), ac, threadCount);
 }
 
 sserialize::CellQueryResult CQRFromPolygon::cqr(const sserialize::spatial::GeoPolygon& gp, Accuracy ac, int cqrFlags, uint32_t threadCount) const {
-	return m_priv->cqr(gp, ac, cqrFlags, threadCount);
+	return m_priv->cqr(PreparedGeoPolygon(gp), ac, cqrFlags, threadCount);
+}
+
+sserialize::CellQueryResult CQRFromPolygon::cqr(const PreparedGeoPolygon & pgp, Accuracy ac, int cqrFlags, uint32_t threadCount) const {
+	return m_priv->cqr(pgp, ac, cqrFlags, threadCount);
 }
 
 sserialize::CellQueryResult CQRFromPolygon::cqr(const sserialize::spatial::GeoPoint& gp, double radius, CQRFromPolygon::Accuracy ac, int cqrFlags, uint32_t threadCount) const {
 	return m_priv->cqr(gp, radius, ac, cqrFlags, threadCount);
 }
 
+void CQRFromPolygon::setTileCacheSize(uint32_t maxTiles) {
+	m_priv->setTileCacheSize(maxTiles);
+}
+
+uint32_t CQRFromPolygon::tileCacheSize() const {
+	return m_priv->tileCacheSize();
+}
+
+void CQRFromPolygon::setCellItemRTree(const CellItemRTree & tree) {
+	m_priv->setCellItemRTree(tree);
+}
+
+void CQRFromPolygon::setAutoAccuracyParameters(const AutoAccuracyParameters & params) {
+	m_priv->setAutoAccuracyParameters(params);
+}
+
+CQRFromPolygon::AutoAccuracyParameters CQRFromPolygon::autoAccuracyParameters() const {
+	return m_priv->autoAccuracyParameters();
+}
+
+CQRFromPolygon::AutoAccuracyStats CQRFromPolygon::autoAccuracyStats() const {
+	return m_priv->autoAccuracyStats();
+}
+
+std::ostream & CQRFromPolygon::printStats(std::ostream & out) const {
+	if (!m_priv.priv()) {
+		return out;
+	}
+	AutoAccuracyStats stats = autoAccuracyStats();
+	out << "CQRFromPolygon::printStats -- BEGIN" << std::endl;
+	out << "AC_AUTO queries: " << stats.chosen.at(AC_AUTO) << std::endl;
+	out << "AC_AUTO demoted by work estimate: " << stats.demoted << std::endl;
+	for(const auto & x : Str2PolyAcc) {
+		if (stats.chosen.at(x.second)) {
+			out << "AC_AUTO chose " << x.first << ": " << stats.chosen.at(x.second) << std::endl;
+		}
+	}
+	out << "CQRFromPolygon::printStats -- END" << std::endl;
+	return out;
+}
 
 CQRFromPolygon::Accuracy
 CQRFromPolygon::toAccuracy(std::string const & str) {
@@ -53,12 +104,111 @@ CQRFromPolygon::toAccuracy(std::string const & str) {
 }
 
 namespace detail {
+namespace {
+
+///Sutherland-Hodgman clipping of a polygon against an axis-parallel rectangle, the result is closed
+std::vector<sserialize::spatial::GeoPoint> clip(const std::vector<sserialize::spatial::GeoPoint> & polygon, const sserialize::spatial::GeoRect & rect) {
+	using GeoPoint = sserialize::spatial::GeoPoint;
+	std::vector<GeoPoint> input;
+	std::vector<GeoPoint> output(polygon);
+	auto clipEdge = [&](auto inside, auto intersection) {
+		input.swap(output);
+		output.clear();
+		if (!input.size()) {
+			return;
+		}
+		GeoPoint prev = input.back();
+		for(const GeoPoint & cur : input) {
+			if (inside(cur)) {
+				if (!inside(prev)) {
+					output.push_back(intersection(prev, cur));
+				}
+				output.push_back(cur);
+			}
+			else if (inside(prev)) {
+				output.push_back(intersection(prev, cur));
+			}
+			prev = cur;
+		}
+	};
+	auto atLat = [](double lat) {
+		return [lat](const GeoPoint & a, const GeoPoint & b) {
+			double t = (lat - a.lat())/(b.lat() - a.lat());
+			return GeoPoint(lat, a.lon() + t*(b.lon() - a.lon()));
+		};
+	};
+	auto atLon = [](double lon) {
+		return [lon](const GeoPoint & a, const GeoPoint & b) {
+			double t = (lon - a.lon())/(b.lon() - a.lon());
+			return GeoPoint(a.lat() + t*(b.lat() - a.lat()), lon);
+		};
+	};
+	clipEdge([&rect](const GeoPoint & p) { return p.lat() >= rect.minLat(); }, atLat(rect.minLat()));
+	clipEdge([&rect](const GeoPoint & p) { return p.lat() <= rect.maxLat(); }, atLat(rect.maxLat()));
+	clipEdge([&rect](const GeoPoint & p) { return p.lon() >= rect.minLon(); }, atLon(rect.minLon()));
+	clipEdge([&rect](const GeoPoint & p) { return p.lon() <= rect.maxLon(); }, atLon(rect.maxLon()));
+	if (output.size() >= 3) {
+		output.push_back(output.front());
+	}
+	return output;
+}
+
+}//end anonymous namespace
+
+bool CQRFromPolygon::TileKey::operator==(const TileKey & other) const {
+	return zoom == other.zoom && x == other.x && y == other.y && ac == other.ac && cqrFlags == other.cqrFlags;
+}
+
+std::size_t CQRFromPolygon::TileKeyHash::operator()(const TileKey & k) const {
+	std::hash<uint64_t> hasher;
+	uint64_t v = (uint64_t(k.zoom) << 58) ^ (uint64_t(k.x) << 29) ^ uint64_t(k.y);
+	uint64_t w = (uint64_t(k.ac) << 32) ^ uint64_t(uint32_t(k.cqrFlags));
+	return hasher(v) ^ (hasher(w) + 0x9e3779b9 + (hasher(v) << 6) + (hasher(v) >> 2));
+}
+
+CQRFromPolygon::TileCache::TileCache(uint32_t maxSize) :
+m_maxSize(maxSize)
+{}
+
+CQRFromPolygon::TileCache::~TileCache() {}
+
+bool CQRFromPolygon::TileCache::get(const TileKey & key, sserialize::CellQueryResult & dest) {
+	std::lock_guard<std::mutex> lck(m_lock);
+	auto it = m_index.find(key);
+	if (it == m_index.end()) {
+		return false;
+	}
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	dest = it->second->second;
+	return true;
+}
+
+void CQRFromPolygon::TileCache::insert(const TileKey & key, const sserialize::CellQueryResult & cqr) {
+	std::lock_guard<std::mutex> lck(m_lock);
+	auto it = m_index.find(key);
+	if (it != m_index.end()) {
+		it->second->second = cqr;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return;
+	}
+	m_entries.emplace_front(key, cqr);
+	m_index[key] = m_entries.begin();
+	if (m_entries.size() > m_maxSize) {
+		m_index.erase(m_entries.back().first);
+		m_entries.pop_back();
+	}
+}
 
 CQRFromPolygon::CQRFromPolygon(const Static::OsmKeyValueObjectStore& store, const sserialize::Static::ItemIndexStore & idxStore) :
 m_store(store),
 m_idxStore(idxStore),
-m_ci(sserialize::Static::spatial::GeoHierarchyCellInfo::makeRc(m_store.geoHierarchy()))
-{}
+m_ci(sserialize::Static::spatial::GeoHierarchyCellInfo::makeRc(m_store.geoHierarchy())),
+m_autoDemoted(0)
+{
+	for(auto & x : m_autoChosen) {
+		x = 0;
+	}
+}
 
 CQRFromPolygon::~CQRFromPolygon() {}
 
@@ -78,72 +228,279 @@ const sserialize::Static::ItemIndexStore & CQRFromPolygon::idxStore() const {
 	return m_idxStore;
 }
 
-sserialize::ItemIndex CQRFromPolygon::fullMatches(const sserialize::spatial::GeoPolygon & gp, liboscar::CQRFromPolygon::Accuracy ac, uint32_t threadCount) const {
+sserialize::ItemIndex CQRFromPolygon::fullMatches(const PreparedGeoPolygon & pgp, liboscar::CQRFromPolygon::Accuracy ac, uint32_t threadCount) const {
 	switch (ac) {
 	case liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX:
 	case liboscar::CQRFromPolygon::AC_POLYGON_CELL:
 	case liboscar::CQRFromPolygon::AC_POLYGON_ITEM_BBOX:
 	case liboscar::CQRFromPolygon::AC_POLYGON_ITEM:
 	{
-		return intersectingCellsPolygonCellBBox(gp);
+		PreparedGeoPolygon simplified;
+		return intersectingCellsPolygonCellBBox(pgp, cellTestPolygon(pgp, simplified));
 		break;
 	}
 	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX:
 	default:
-		return m_store.geoHierarchy().intersectingCells(idxStore(), gp.boundary(), threadCount);
+		return m_store.geoHierarchy().intersectingCells(idxStore(), pgp.boundary(), threadCount);
 		break;
 	};
 }
 
-sserialize::CellQueryResult CQRFromPolygon::cqr(const sserialize::spatial::GeoPolygon& gp, liboscar::CQRFromPolygon::Accuracy ac, int cqrFlags, uint32_t /*threadCount*/) const {
-	if (ac == liboscar::CQRFromPolygon::AC_AUTO) {
-		double th;
-		{
-			double gpLen = gp.length();
-			double gpDiag = gp.boundary().diagInM();
-			if (gpLen > double(liboscar::CQRFromPolygon::ACT_USE_LENGTH_OVER_DIAGONAL_RATIO)*gpDiag) {
-				th = gpLen / double(liboscar::CQRFromPolygon::ACT_USE_LENGTH_OVER_DIAGONAL_RATIO);
-			}
-			else {
-				th = gpDiag;
-			}
+void CQRFromPolygon::setTileCacheSize(uint32_t maxTiles) {
+	if (maxTiles) {
+		m_tileCache.reset(new TileCache(maxTiles));
+	}
+	else {
+		m_tileCache.reset();
+	}
+}
+
+uint32_t CQRFromPolygon::tileCacheSize() const {
+	return m_tileCache ? m_tileCache->maxSize() : 0;
+}
+
+void CQRFromPolygon::setCellItemRTree(const CellItemRTree & tree) {
+	if (tree.cellCount() && tree.cellCount() != m_store.geoHierarchy().cellSize()) {
+		throw sserialize::TypeMissMatchException("CQRFromPolygon::setCellItemRTree: cell count of tree does not match");
+	}
+	m_cellItemRTree = tree;
+}
+
+void CQRFromPolygon::setAutoAccuracyParameters(const liboscar::CQRFromPolygon::AutoAccuracyParameters & params) {
+	std::lock_guard<std::mutex> lck(m_autoParamsLock);
+	m_autoParams = params;
+}
+
+liboscar::CQRFromPolygon::AutoAccuracyParameters CQRFromPolygon::autoAccuracyParameters() const {
+	std::lock_guard<std::mutex> lck(m_autoParamsLock);
+	return m_autoParams;
+}
+
+liboscar::CQRFromPolygon::AutoAccuracyStats CQRFromPolygon::autoAccuracyStats() const {
+	liboscar::CQRFromPolygon::AutoAccuracyStats stats;
+	for(std::size_t i(0), s(m_autoChosen.size()); i < s; ++i) {
+		stats.chosen[i] = m_autoChosen[i].load(std::memory_order_relaxed);
+	}
+	stats.demoted = m_autoDemoted.load(std::memory_order_relaxed);
+	return stats;
+}
+
+CQRFromPolygon::Accuracy CQRFromPolygon::autoAccuracy(const PreparedGeoPolygon & pgp, uint32_t threadCount, sserialize::ItemIndex & bboxCells) const {
+	liboscar::CQRFromPolygon::AutoAccuracyParameters params = autoAccuracyParameters();
+	Accuracy ac;
+	double th;
+	{
+		double gpLen = pgp.length();
+		double gpDiag = pgp.boundary().diagInM();
+		if (gpLen > params.lengthOverDiagonalRatio*gpDiag) {
+			th = gpLen / params.lengthOverDiagonalRatio;
 		}
-		
-		if (th < double(liboscar::CQRFromPolygon::ACT_POLYGON_ITEM)) {
-			ac = liboscar::CQRFromPolygon::AC_POLYGON_ITEM;
+		else {
+			th = gpDiag;
 		}
-		else if (th < double(liboscar::CQRFromPolygon::ACT_POLYGON_ITEM_BBOX)) {
+	}
+	
+	if (th < params.polygonItemExtent) {
+		ac = liboscar::CQRFromPolygon::AC_POLYGON_ITEM;
+	}
+	else if (th < params.polygonItemBBoxExtent) {
+		ac = liboscar::CQRFromPolygon::AC_POLYGON_ITEM_BBOX;
+	}
+	else if (th < params.polygonCellBBoxExtent) {
+		ac = liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX;
+	}
+	else { //really large, use fast test
+		ac = liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX;
+	}
+	
+	if (ac != liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX) {
+		//estimate the work with the cells whose bbox intersects the bbox of the polygon, the chosen path reuses them
+		const sserialize::Static::spatial::GeoHierarchy & gh = m_store.geoHierarchy();
+		bboxCells = gh.intersectingCells(idxStore(), pgp.boundary(), threadCount);
+		double cellCount = bboxCells.size();
+		double itemCount = 0;
+		if (ac != liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX) {
+			for(uint32_t cellId : bboxCells) {
+				itemCount += m_idxStore.idxSize(gh.cellItemsPtr(cellId));
+			}
+		}
+		//edge tests per point query of the polygon
+		double edgeWork = pgp.hasIndex() ? double(PreparedGeoPolygon::EdgesPerGridCell) : double(pgp.edgeCount());
+		Accuracy initial = ac;
+		if (ac == liboscar::CQRFromPolygon::AC_POLYGON_ITEM && itemCount*(params.itemAccessWork + edgeWork) > params.polygonItemWork) {
 			ac = liboscar::CQRFromPolygon::AC_POLYGON_ITEM_BBOX;
 		}
-		else if (th < double(liboscar::CQRFromPolygon::ACT_POLYGON_CELL_BBOX)) {
+		if (ac == liboscar::CQRFromPolygon::AC_POLYGON_ITEM_BBOX && itemCount*params.itemAccessWork > params.polygonItemBBoxWork) {
 			ac = liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX;
 		}
-		else { //really large, use fast test
+		if (ac == liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX && cellCount*(params.cellAccessWork + edgeWork) > params.polygonCellBBoxWork) {
 			ac = liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX;
 		}
+		if (ac != initial) {
+			m_autoDemoted.fetch_add(1, std::memory_order_relaxed);
+		}
 	}
+	m_autoChosen[liboscar::CQRFromPolygon::AC_AUTO].fetch_add(1, std::memory_order_relaxed);
+	m_autoChosen[ac].fetch_add(1, std::memory_order_relaxed);
+	return ac;
+}
+
+sserialize::CellQueryResult CQRFromPolygon::cqr(const PreparedGeoPolygon & pgp, liboscar::CQRFromPolygon::Accuracy ac, int cqrFlags, uint32_t threadCount) const {
+	sserialize::ItemIndex bboxCells;
+	bool haveBBoxCells = false;
+	if (ac == liboscar::CQRFromPolygon::AC_AUTO) {
+		ac = autoAccuracy(pgp, threadCount, bboxCells);
+		//bboxCells are only left out if the extent alone chose the bbox accuracy
+		haveBBoxCells = (ac != liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX || bboxCells.size());
+	}
+	if (m_tileCache) {
+		return tiledCqr(pgp, ac, cqrFlags, threadCount, haveBBoxCells ? &bboxCells : nullptr);
+	}
+	return uncachedCqr(pgp, ac, cqrFlags, threadCount, haveBBoxCells ? &bboxCells : nullptr);
+}
+
+sserialize::CellQueryResult CQRFromPolygon::uncachedCqr(const PreparedGeoPolygon & pgp, liboscar::CQRFromPolygon::Accuracy ac, int cqrFlags, uint32_t /*threadCount*/, const sserialize::ItemIndex * bboxCells) const {
+	PreparedGeoPolygon simplified;
+	const PreparedGeoPolygon & cellPgp = (ac == liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL || ac == liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX) ? pgp : cellTestPolygon(pgp, simplified);
 	switch (ac) {
 	case liboscar::CQRFromPolygon::AC_POLYGON_ITEM:
-		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyCellItemIntersectOp>(gp).convert(cqrFlags);
+		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyCellItemIntersectOp>(pgp, cellPgp, bboxCells).convert(cqrFlags);
 	case liboscar::CQRFromPolygon::AC_POLYGON_ITEM_BBOX:
-		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyCellItemBBoxIntersectOp>(gp).convert(cqrFlags);
+		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyCellItemBBoxIntersectOp>(pgp, cellPgp, bboxCells).convert(cqrFlags);
 	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_ITEM:
-		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyBBoxCellItemIntersectOp>(gp).convert(cqrFlags);
+		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyBBoxCellItemIntersectOp>(pgp, cellPgp, bboxCells).convert(cqrFlags);
 	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_ITEM_BBOX:
-		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyBBoxCellItemBBoxIntersectOp>(gp).convert(cqrFlags);
+		return intersectingCellsPolygonItem<detail::CQRFromPolygonHelpers::PolyBBoxCellItemBBoxIntersectOp>(pgp, cellPgp, bboxCells).convert(cqrFlags);
 
 	case liboscar::CQRFromPolygon::AC_POLYGON_CELL:
 	case liboscar::CQRFromPolygon::AC_POLYGON_CELL_BBOX:
-		return sserialize::CellQueryResult(intersectingCellsPolygonCellBBox(gp), cellInfo(), idxStore(), cqrFlags);
+		return sserialize::CellQueryResult(intersectingCellsPolygonCellBBox(pgp, cellPgp, bboxCells), cellInfo(), idxStore(), cqrFlags);
 	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL:
 	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX:
-		return sserialize::CellQueryResult(geoHierarchy().intersectingCells(idxStore(), gp.boundary()), cellInfo(), idxStore(), cqrFlags);
+		if (bboxCells) {
+			return sserialize::CellQueryResult(*bboxCells, cellInfo(), idxStore(), cqrFlags);
+		}
+		return sserialize::CellQueryResult(geoHierarchy().intersectingCells(idxStore(), pgp.boundary()), cellInfo(), idxStore(), cqrFlags);
 	default:
 		throw sserialize::InvalidEnumValueException("CQRFromPolygon::Accuracy does not have " + std::to_string(ac) + " as value");
 		return sserialize::CellQueryResult();;
 	};
 }
 
+sserialize::CellQueryResult CQRFromPolygon::tiledCqr(const PreparedGeoPolygon & pgp, liboscar::CQRFromPolygon::Accuracy ac, int cqrFlags, uint32_t threadCount, const sserialize::ItemIndex * bboxCells) const {
+	const sserialize::spatial::GeoRect & bounds = pgp.boundary();
+	
+	uint32_t zoom = liboscar::CQRFromPolygon::TCP_MAX_ZOOM;
+	double extent = std::max((bounds.maxLat()-bounds.minLat())/180.0, (bounds.maxLon()-bounds.minLon())/360.0);
+	if (extent > 0) {
+		double z = std::floor(std::log2(double(liboscar::CQRFromPolygon::TCP_TILES_PER_DIMENSION)/extent));
+		z = std::max<double>(liboscar::CQRFromPolygon::TCP_MIN_ZOOM, std::min<double>(liboscar::CQRFromPolygon::TCP_MAX_ZOOM, z));
+		zoom = uint32_t(z);
+	}
+	uint32_t tilesPerDimension = uint32_t(1) << zoom;
+	double tileLatStep = 180.0/tilesPerDimension;
+	double tileLonStep = 360.0/tilesPerDimension;
+	auto tileCoord = [tilesPerDimension](double v, double offset, double step) -> uint32_t {
+		double t = (v+offset)/step;
+		return t <= 0 ? 0 : std::min<uint32_t>(tilesPerDimension-1, uint32_t(t));
+	};
+	uint32_t xBegin = tileCoord(bounds.minLon(), 180.0, tileLonStep);
+	uint32_t xEnd = tileCoord(bounds.maxLon(), 180.0, tileLonStep);
+	uint32_t yBegin = tileCoord(bounds.minLat(), 90.0, tileLatStep);
+	uint32_t yEnd = tileCoord(bounds.maxLat(), 90.0, tileLatStep);
+	
+	if (uint64_t(xEnd-xBegin+1)*(yEnd-yBegin+1) > liboscar::CQRFromPolygon::TCP_MAX_TILES) {
+		return uncachedCqr(pgp, ac, cqrFlags, threadCount, bboxCells);
+	}
+	
+	//the bbox accuracies use the boundary of the polygon as query
+	bool bboxQuery = false;
+	//border tiles are computed exactly only for item accuracies
+	bool exactBorder = false;
+	switch (ac) {
+	case liboscar::CQRFromPolygon::AC_POLYGON_ITEM:
+	case liboscar::CQRFromPolygon::AC_POLYGON_ITEM_BBOX:
+		exactBorder = true;
+		break;
+	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_ITEM:
+	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_ITEM_BBOX:
+		exactBorder = true;
+		bboxQuery = true;
+		break;
+	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL:
+	case liboscar::CQRFromPolygon::AC_POLYGON_BBOX_CELL_BBOX:
+		bboxQuery = true;
+		break;
+	default:
+		break;
+	};
+	
+	std::vector<sserialize::CellQueryResult> results;
+	for(uint32_t y(yBegin); y <= yEnd; ++y) {
+		for(uint32_t x(xBegin); x <= xEnd; ++x) {
+			double minLat = -90.0 + y*tileLatStep;
+			double minLon = -180.0 + x*tileLonStep;
+			sserialize::spatial::GeoRect tile(minLat, minLat+tileLatStep, minLon, minLon+tileLonStep);
+			bool covered;
+			if (bboxQuery) {
+				if (!bounds.overlap(tile)) {
+					continue;
+				}
+				covered = bounds.minLat() <= tile.minLat() && tile.maxLat() <= bounds.maxLat() &&
+							bounds.minLon() <= tile.minLon() && tile.maxLon() <= bounds.maxLon();
+			}
+			else {
+				if (!pgp.intersects(tile)) {
+					continue;
+				}
+				covered = pgp.encloses(tile);
+			}
+			if (covered || !exactBorder) {
+				TileKey key{zoom, x, y, ac, cqrFlags};
+				sserialize::CellQueryResult tileCqr;
+				if (!m_tileCache->get(key, tileCqr)) {
+					PreparedGeoPolygon tilePolygon(sserialize::spatial::GeoPolygon::fromRect(tile));
+					tileCqr = uncachedCqr(tilePolygon, ac, cqrFlags, threadCount);
+					m_tileCache->insert(key, tileCqr);
+				}
+				results.emplace_back(std::move(tileCqr));
+			}
+			else if (bboxQuery) {
+				sserialize::spatial::GeoRect clipped(
+					std::max(bounds.minLat(), tile.minLat()), std::min(bounds.maxLat(), tile.maxLat()),
+					std::max(bounds.minLon(), tile.minLon()), std::min(bounds.maxLon(), tile.maxLon())
+				);
+				PreparedGeoPolygon clippedPolygon(sserialize::spatial::GeoPolygon::fromRect(clipped));
+				results.emplace_back( uncachedCqr(clippedPolygon, ac, cqrFlags, threadCount) );
+			}
+			else {
+				//clipping every ring on its own keeps the even-odd classification within the tile
+				std::vector<sserialize::spatial::GeoPolygon> clippedRings;
+				for(std::size_t i(0), s(pgp.ringCount()); i < s; ++i) {
+					std::vector<sserialize::spatial::GeoPoint> clippedPoints( clip(std::vector<sserialize::spatial::GeoPoint>(pgp.ringBegin(i), pgp.ringEnd(i)), tile) );
+					if (clippedPoints.size() >= 4) {
+						clippedRings.emplace_back(std::move(clippedPoints));
+					}
+				}
+				if (!clippedRings.size()) {
+					continue;
+				}
+				PreparedGeoPolygon clippedPolygon(clippedRings);
+				results.emplace_back( uncachedCqr(clippedPolygon, ac, cqrFlags, threadCount) );
+			}
+		}
+	}
+	if (!results.size()) {
+		return sserialize::CellQueryResult();
+	}
+	return sserialize::treeReduce<std::vector<sserialize::CellQueryResult>::const_iterator, sserialize::CellQueryResult>(
+		results.cbegin(),
+		results.cend(),
+		std::plus<sserialize::CellQueryResult>(),
+		threadCount
+	);
+}
+
 sserialize::CellQueryResult CQRFromPolygon::cqr(const sserialize::spatial::GeoPoint& gp, double radius, liboscar::CQRFromPolygon::Accuracy ac, int cqrFlags, uint32_t threadCount) const {
 	if (radius <= 0) { //radius is 0
 		uint32_t cellId = m_store.regionArrangement().cellId(gp);
@@ -152,23 +509,38 @@ sserialize::CellQueryResult CQRFromPolygon::cqr(const sserialize::spatial::GeoPo
 			return sserialize::CellQueryResult();
 		}
 
-		//there should be exactly one
-		sserialize::ItemIndex idx( m_idxStore.at( m_store.geoHierarchy().cellItemsPtr(cellId) ) );
-		//now check all those items in that cell (this may be very very expensive)
-		//though we can avoid checking non-polygon items
+		//we can avoid checking non-polygon items
 		//since the probability that the test point really intersects points/ways is close to zero
-		std::vector<uint32_t> tmp;
-		for(uint32_t itemId : idx) {
+		auto contains = [this, &gp](uint32_t itemId) -> bool {
 			sserialize::spatial::GeoShapeType gst = m_store.geoShapeType(itemId);
-			bool contained = false;
 			if (gst == sserialize::spatial::GS_POLYGON) {
-				contained = m_store.geoShape(itemId).get<sserialize::spatial::GS_POLYGON>()->contains(gp);
+				return m_store.geoShape(itemId).get<sserialize::spatial::GS_POLYGON>()->contains(gp);
 			}
 			else if (gst == sserialize::spatial::GS_MULTI_POLYGON) {
-				contained = m_store.geoShape(itemId).get<sserialize::spatial::GS_MULTI_POLYGON>()->contains(gp);
+				return m_store.geoShape(itemId).get<sserialize::spatial::GS_MULTI_POLYGON>()->contains(gp);
 			}
-			if (contained) {
-				tmp.emplace_back(itemId);
+			return false;
+		};
+		std::vector<uint32_t> tmp;
+		if (m_cellItemRTree.cellCount()) {
+			//only test items whose bounding box contains the point
+			std::vector<uint32_t> candidates;
+			m_cellItemRTree.itemsContaining(cellId, gp, candidates);
+			std::sort(candidates.begin(), candidates.end());
+			for(uint32_t itemId : candidates) {
+				if (contains(itemId)) {
+					tmp.emplace_back(itemId);
+				}
+			}
+		}
+		else {
+			//there should be exactly one
+			sserialize::ItemIndex idx( m_idxStore.at( m_store.geoHierarchy().cellItemsPtr(cellId) ) );
+			//now check all those items in that cell (this may be very very expensive)
+			for(uint32_t itemId : idx) {
+				if (contains(itemId)) {
+					tmp.emplace_back(itemId);
+				}
 			}
 		}
 		std::vector<sserialize::ItemIndex> pmIdcs(1, sserialize::ItemIndex(std::move(tmp)));
@@ -183,23 +555,123 @@ sserialize::CellQueryResult CQRFromPolygon::cqr(const sserialize::spatial::GeoPo
 		return result.convert(cqrFlags);
 	}
 	else {
-		return cqr(sserialize::spatial::GeoPolygon::fromRect(sserialize::spatial::GeoRect(gp.lat(), gp.lon(), radius)), ac, cqrFlags, threadCount);
+		PreparedGeoPolygon pgp(sserialize::spatial::GeoPolygon::fromRect(sserialize::spatial::GeoRect(gp.lat(), gp.lon(), radius)));
+		return cqr(pgp, ac, cqrFlags, threadCount);
+	}
+}
+
+bool CQRFromPolygon::intersects(const PreparedGeoPolygon & pgp, const sserialize::Static::spatial::GeoShape & region) const {
+	switch (region.type()) {
+	case sserialize::spatial::GS_POLYGON:
+		return pgp.intersects(*region.get<sserialize::spatial::GS_POLYGON>());
+	case sserialize::spatial::GS_MULTI_POLYGON:
+		return pgp.intersects(*region.get<sserialize::spatial::GS_MULTI_POLYGON>());
+	default:
+		return false;
+	};
+}
+
+bool CQRFromPolygon::encloses(const PreparedGeoPolygon & pgp, const sserialize::Static::spatial::GeoShape & region) const {
+	switch (region.type()) {
+	case sserialize::spatial::GS_POLYGON:
+		return pgp.encloses(*region.get<sserialize::spatial::GS_POLYGON>());
+	case sserialize::spatial::GS_MULTI_POLYGON:
+		return pgp.encloses(*region.get<sserialize::spatial::GS_MULTI_POLYGON>());
+	default:
+		return false;
+	};
+}
+
+double CQRFromPolygon::facesPerCell() const {
+	return std::max<double>(1.0, double(m_store.regionArrangement().tds().faceCount()) / std::max<uint32_t>(1, m_store.geoHierarchy().cellSize()));
+}
+
+bool CQRFromPolygon::cellsByTriangulationWalk(const PreparedGeoPolygon & pgp, uint32_t maxFaces, sserialize::ItemIndex & cells) const {
+	const sserialize::Static::spatial::TriangulationGeoHierarchyArrangement & ra = m_store.regionArrangement();
+	const auto & tds = ra.tds();
+	
+	std::unordered_set<uint32_t> visitedFaces;
+	std::vector<uint32_t> queue;
+	std::vector<uint32_t> cellIds;
+	//every connected part of the polygon contains the first vertex of one of its rings
+	for(std::size_t i(0), s(pgp.ringCount()); i < s; ++i) {
+		uint32_t faceId = tds.locate(*pgp.ringBegin(i));
+		if (faceId == tds.NullFace) {
+			return false;
+		}
+		if (visitedFaces.insert(faceId).second) {
+			queue.push_back(faceId);
+		}
+	}
+	//the polygon passes from one triangle to its neighbor only through their common edge
+	auto edgeIntersects = [&pgp](const sserialize::spatial::GeoPoint & a, const sserialize::spatial::GeoPoint & b) {
+		double lat[2] = {a.lat(), b.lat()};
+		double lon[2] = {a.lon(), b.lon()};
+		return pgp.contains(lat[0], lon[0]) || pgp.contains(lat[1], lon[1]) || pgp.intersectsChain(lat, lon, 2);
+	};
+	while (queue.size()) {
+		if (visitedFaces.size() > maxFaces) {
+			return false;
+		}
+		uint32_t faceId = queue.back();
+		queue.pop_back();
+		cellIds.push_back(ra.cellIdFromFaceId(faceId));
+		auto face = tds.face(faceId);
+		for(int j(0); j < 3; ++j) {
+			if (!face.isNeighbor(j)) {
+				continue;
+			}
+			uint32_t nId = face.neighborId(j);
+			if (visitedFaces.count(nId)) {
+				continue;
+			}
+			if (edgeIntersects(face.point(tds.ccw(j)), face.point(tds.cw(j)))) {
+				visitedFaces.insert(nId);
+				queue.push_back(nId);
+			}
+		}
 	}
+	std::sort(cellIds.begin(), cellIds.end());
+	cellIds.resize(std::unique(cellIds.begin(), cellIds.end()) - cellIds.begin());
+	if (cellIds.size() && cellIds.back() == ra.NullCellId) {
+		cellIds.pop_back();
+	}
+	cells = sserialize::ItemIndex(std::move(cellIds));
+	return true;
 }
 
-sserialize::Static::spatial::GeoPolygon detail::CQRFromPolygon::toStatic(const sserialize::spatial::GeoPolygon& gp) const {
-	//as of now intersection between static and non-static geometry is not available
-	sserialize::UByteArrayAdapter d(sserialize::UByteArrayAdapter::createCache(1, sserialize::MM_PROGRAM_MEMORY));
-	gp.append(d);
-	d.resetPtrs();
-	return sserialize::Static::spatial::GeoPolygon(d);
+const PreparedGeoPolygon & CQRFromPolygon::cellTestPolygon(const PreparedGeoPolygon & pgp, PreparedGeoPolygon & storage) const {
+	if (pgp.edgeCount() <= liboscar::CQRFromPolygon::SP_MIN_EDGES || !pgp.vertices().size()) {
+		return pgp;
+	}
+	//the tolerance should be small compared to the cells the polygon passes through
+	const sserialize::Static::spatial::GeoHierarchy & gh = m_store.geoHierarchy();
+	const std::vector<sserialize::spatial::GeoPoint> & vertices = pgp.vertices();
+	std::size_t step = std::max<std::size_t>(1, vertices.size()/liboscar::CQRFromPolygon::SP_SAMPLES);
+	double minCellExtent = std::numeric_limits<double>::max();
+	for(std::size_t i(0), s(vertices.size()); i < s; i += step) {
+		uint32_t cellId = m_store.regionArrangement().cellId(vertices[i]);
+		if (cellId == m_store.regionArrangement().NullCellId) {
+			continue;
+		}
+		sserialize::spatial::GeoRect cb( gh.cellBoundary(cellId) );
+		minCellExtent = std::min(minCellExtent, std::min(cb.maxLat()-cb.minLat(), cb.maxLon()-cb.minLon()));
+	}
+	if (minCellExtent == std::numeric_limits<double>::max() || minCellExtent <= 0) {
+		return pgp;
+	}
+	storage = pgp.simplified(minCellExtent/liboscar::CQRFromPolygon::SP_CELL_FRACTION);
+	if (storage.edgeCount() >= pgp.edgeCount()) {
+		return pgp;
+	}
+	return storage;
 }
 
-sserialize::ItemIndex CQRFromPolygon::intersectingCellsPolygonCellBBox(const sserialize::spatial::GeoPolygon& gp) const {
+sserialize::ItemIndex CQRFromPolygon::intersectingCellsPolygonCellBBox(const PreparedGeoPolygon & pgp, const PreparedGeoPolygon & cellPgp, const sserialize::ItemIndex * bboxCells) const {
 	std::vector<uint32_t> intersectingCells;
 	
 	struct MyOperator {
-		const sserialize::spatial::GeoPolygon & gp;
+		const PreparedGeoPolygon & cellPgp;
 		const sserialize::Static::spatial::GeoHierarchy & gh;
 		std::vector<uint32_t> & intersectingCells;
 		
@@ -208,18 +680,18 @@ sserialize::ItemIndex CQRFromPolygon::intersectingCellsPolygonCellBBox(const sse
 		}
 		void candidates(const sserialize::ItemIndex & candidateCells) {
 			for(uint32_t cellId : candidateCells) {
-				if (gp.intersects(gh.cellBoundary(cellId))) {
+				if (cellPgp.intersects(gh.cellBoundary(cellId))) {
 					intersectingCells.push_back(cellId);
 				}
 			}
 		}
-		MyOperator(const sserialize::spatial::GeoPolygon & gp, const sserialize::Static::spatial::GeoHierarchy & gh, std::vector<uint32_t> & intersectingCells) :
-		gp(gp), gh(gh), intersectingCells(intersectingCells)
+		MyOperator(const PreparedGeoPolygon & cellPgp, const sserialize::Static::spatial::GeoHierarchy & gh, std::vector<uint32_t> & intersectingCells) :
+		cellPgp(cellPgp), gh(gh), intersectingCells(intersectingCells)
 		{}
 	};
-	MyOperator myOp(gp, m_store.geoHierarchy(), intersectingCells);
+	MyOperator myOp(cellPgp, m_store.geoHierarchy(), intersectingCells);
 
-	visit(gp, toStatic(gp), myOp);
+	visit(pgp, myOp, bboxCells);
 
 	std::sort(intersectingCells.begin(), intersectingCells.end());
 	intersectingCells.resize(std::unique(intersectingCells.begin(), intersectingCells.end())-intersectingCells.begin());
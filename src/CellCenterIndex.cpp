@@ -0,0 +1,262 @@
+#include <liboscar/CellCenterIndex.h>
+#include <liboscar/CellDistanceByHull.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+namespace liboscar {
+
+CellCenterIndex::CellCenterIndex() {}
+
+CellCenterIndex::CellCenterIndex(const std::vector<CellInfo> & d) :
+m_ci(d)
+{
+	build();
+}
+
+CellCenterIndex::CellCenterIndex(std::vector<CellInfo> && d) :
+m_ci(std::move(d))
+{
+	build();
+}
+
+CellCenterIndex::~CellCenterIndex() {}
+
+template<typename T_CALLBACK>
+void CellCenterIndex::visit(const sserialize::spatial::GeoPoint & p, double radius, double distance, T_CALLBACK cb) const {
+	if (!m_nodes.size()) {
+		return;
+	}
+	Point3D q = toPoint3D(p);
+	std::vector<uint32_t> stack;
+	stack.push_back(0);
+	while (stack.size()) {
+		const Node & node = m_nodes[stack.back()];
+		uint32_t nodeId = stack.back();
+		stack.pop_back();
+		if (lowerBound(q, node) - radius - node.maxRadius > distance) {
+			continue;
+		}
+		if (node.end - node.begin <= LeafSize) {
+			cb(node.begin, node.end);
+		}
+		else {
+			stack.push_back(nodeId+1);
+			stack.push_back(node.right);
+		}
+	}
+}
+
+double CellCenterIndex::distance(uint32_t cellId1, uint32_t cellId2) const {
+	return m_kernels.distance(m_cellPos.at(cellId1), m_cellPos.at(cellId2));
+}
+
+double CellCenterIndex::distance(const sserialize::spatial::GeoPoint & p, uint32_t cellId) const {
+	return m_kernels.distance(p, m_cellPos.at(cellId));
+}
+
+void CellCenterIndex::cellsWithin(const sserialize::spatial::GeoPoint & p, double distance, std::vector<uint32_t> & dest) const {
+	std::size_t oldSize = dest.size();
+	visit(p, 0.0, distance, [this, &p, distance, &dest](uint32_t begin, uint32_t end) {
+		m_kernels.within(p, 0.0, distance, begin, end, dest);
+	});
+	for(std::size_t i(oldSize), s(dest.size()); i < s; ++i) {
+		dest[i] = m_cellIds[dest[i]];
+	}
+}
+
+void CellCenterIndex::cellsWithin(uint32_t cellId, double distance, std::vector<uint32_t> & dest) const {
+	uint32_t pos = m_cellPos.at(cellId);
+	std::size_t oldSize = dest.size();
+	visit(m_ci[cellId].center, m_kernels.radius(pos), distance, [this, pos, distance, &dest](uint32_t begin, uint32_t end) {
+		m_kernels.within(pos, distance, begin, end, dest);
+	});
+	for(std::size_t i(oldSize), s(dest.size()); i < s; ++i) {
+		dest[i] = m_cellIds[dest[i]];
+	}
+}
+
+sserialize::ItemIndex CellCenterIndex::cellsWithin(const sserialize::ItemIndex & cells, double distance, uint32_t threadCount) const {
+	std::vector<uint32_t> src(cells.begin(), cells.end());
+	return neighborhood(src, distance, threadCount);
+}
+
+sserialize::ItemIndex CellCenterIndex::dilate(const sserialize::CellQueryResult & cqr, double distance, uint32_t threadCount) const {
+	std::vector<uint32_t> src;
+	src.reserve(cqr.cellCount());
+	for(auto it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		src.push_back(it.cellId());
+	}
+	return neighborhood(src, distance, threadCount);
+}
+
+sserialize::ItemIndex CellCenterIndex::neighborhood(const std::vector<uint32_t> & src, double distance, uint32_t threadCount) const {
+	struct State {
+		const CellCenterIndex & index;
+		const std::vector<uint32_t> & src;
+		double distance;
+		std::atomic<std::size_t> pos{0};
+		std::mutex lock;
+		std::vector<uint8_t> result;
+		State(const CellCenterIndex & index, const std::vector<uint32_t> & src, double distance) :
+		index(index), src(src), distance(distance), result(index.cellCount(), 0)
+		{}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			std::vector<uint8_t> found(state->index.cellCount(), 0);
+			std::vector<uint32_t> tmp;
+			while (true) {
+				std::size_t i = state->pos.fetch_add(1, std::memory_order_relaxed);
+				if (i >= state->src.size()) {
+					break;
+				}
+				tmp.clear();
+				uint32_t srcCellId = state->src[i];
+				state->index.cellsWithin(srcCellId, state->distance, tmp);
+				if (state->index.m_refinement) {
+					const sserialize::spatial::interface::CellDistance & cd = *state->index.m_refinement;
+					for(uint32_t cellId : tmp) {
+						if (!found[cellId] && CellDistanceByHull::within(cd, srcCellId, cellId, state->distance)) {
+							found[cellId] = 1;
+						}
+					}
+				}
+				else {
+					for(uint32_t cellId : tmp) {
+						found[cellId] = 1;
+					}
+				}
+			}
+			std::lock_guard<std::mutex> lck(state->lock);
+			for(std::size_t i(0), s(found.size()); i < s; ++i) {
+				state->result[i] |= found[i];
+			}
+		}
+	};
+	if (!src.size()) {
+		return sserialize::ItemIndex();
+	}
+	State state(*this, src, distance);
+	threadCount = std::max<uint32_t>(1, std::min<uint32_t>(threadCount, (uint32_t) src.size()));
+	if (threadCount == 1) {
+		Worker worker(&state);
+		worker();
+	}
+	else {
+		sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	for(uint32_t cellId : src) {
+		state.result.at(cellId) = 0;
+	}
+	std::vector<uint32_t> result;
+	for(uint32_t cellId(0), s(cellCount()); cellId < s; ++cellId) {
+		if (state.result[cellId]) {
+			result.push_back(cellId);
+		}
+	}
+	return sserialize::ItemIndex(std::move(result));
+}
+
+CellCenterIndex::Point3D CellCenterIndex::toPoint3D(const sserialize::spatial::GeoPoint & p) {
+	double lat = p.lat()*M_PI/180.0;
+	double lon = p.lon()*M_PI/180.0;
+	return Point3D{{std::cos(lat)*std::cos(lon), std::cos(lat)*std::sin(lon), std::sin(lat)}};
+}
+
+double CellCenterIndex::lowerBound(const Point3D & q, const Node & node) {
+	double chord2 = 0.0;
+	for(uint32_t i(0); i < 3; ++i) {
+		double d = 0.0;
+		if (q.v[i] < node.min.v[i]) {
+			d = node.min.v[i] - q.v[i];
+		}
+		else if (q.v[i] > node.max.v[i]) {
+			d = q.v[i] - node.max.v[i];
+		}
+		chord2 += d*d;
+	}
+	double halfChord = std::min<double>(1.0, std::sqrt(chord2)/2.0);
+	//1m of slack for rounding errors
+	return 2.0*std::asin(halfChord)*CellDistanceKernels::EarthRadius - 1.0;
+}
+
+void CellCenterIndex::build() {
+	m_cellIds.clear();
+	m_cellPos.assign(m_ci.size(), 0);
+	m_kernels = CellDistanceKernels();
+	m_nodes.clear();
+	if (!m_ci.size()) {
+		return;
+	}
+	std::vector<Point3D> points;
+	points.reserve(m_ci.size());
+	m_cellIds.reserve(m_ci.size());
+	for(uint32_t cellId(0), s(cellCount()); cellId < s; ++cellId) {
+		points.push_back(toPoint3D(m_ci[cellId].center));
+		m_cellIds.push_back(cellId);
+	}
+	build(points, 0, cellCount());
+	m_kernels.reserve(m_ci.size());
+	for(uint32_t i(0), s(cellCount()); i < s; ++i) {
+		uint32_t cellId = m_cellIds[i];
+		m_cellPos[cellId] = i;
+		m_kernels.push_back(m_ci[cellId].center, m_ci[cellId].radius);
+	}
+}
+
+uint32_t CellCenterIndex::build(const std::vector<Point3D> & points, uint32_t begin, uint32_t end) {
+	uint32_t nodeId = (uint32_t) m_nodes.size();
+	m_nodes.emplace_back();
+	{
+		Node & node = m_nodes.back();
+		node.begin = begin;
+		node.end = end;
+		node.right = 0;
+		node.maxRadius = 0.0;
+		for(uint32_t i(0); i < 3; ++i) {
+			node.min.v[i] = std::numeric_limits<double>::max();
+			node.max.v[i] = std::numeric_limits<double>::lowest();
+		}
+		for(uint32_t i(begin); i < end; ++i) {
+			uint32_t cellId = m_cellIds[i];
+			const Point3D & p = points[cellId];
+			for(uint32_t j(0); j < 3; ++j) {
+				node.min.v[j] = std::min(node.min.v[j], p.v[j]);
+				node.max.v[j] = std::max(node.max.v[j], p.v[j]);
+			}
+			node.maxRadius = std::max(node.maxRadius, m_ci[cellId].radius);
+		}
+	}
+	if (end - begin <= LeafSize) {
+		return nodeId;
+	}
+	//split at the median of the widest dimension
+	uint32_t dim = 0;
+	{
+		const Node & node = m_nodes[nodeId];
+		for(uint32_t i(1); i < 3; ++i) {
+			if (node.max.v[i] - node.min.v[i] > node.max.v[dim] - node.min.v[dim]) {
+				dim = i;
+			}
+		}
+	}
+	uint32_t mid = begin + (end - begin)/2;
+	std::nth_element(m_cellIds.begin()+begin, m_cellIds.begin()+mid, m_cellIds.begin()+end, [&points, dim](uint32_t a, uint32_t b) {
+		return points[a].v[dim] < points[b].v[dim];
+	});
+	build(points, begin, mid);
+	uint32_t right = build(points, mid, end);
+	//m_nodes may have been reallocated
+	m_nodes[nodeId].right = right;
+	return nodeId;
+}
+
+}//end namespace liboscar
@@ -2,6 +2,7 @@
 
 #include <sserialize/algorithm/hashspecializations.h>
 #include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
 
 #include <CGAL/Min_annulus_d.h>
 #include <CGAL/Min_sphere_annulus_d_traits_2.h>
@@ -16,27 +17,52 @@ namespace liboscar {
 
 CellDistanceByAnulus::CellDistanceByAnulus(const std::vector<CellInfo> & d) :
 m_ci(d)
-{}
+{
+	initKernels();
+}
 
 CellDistanceByAnulus::CellDistanceByAnulus(std::vector<CellInfo> && d) :
 m_ci(std::move(d))
-{}
+{
+	initKernels();
+}
 
 CellDistanceByAnulus::~CellDistanceByAnulus() {}
 
 double CellDistanceByAnulus::distance(uint32_t cellId1, uint32_t cellId2) const {
-	const CellInfo & ci1 = m_ci.at(cellId1);
-	const CellInfo & ci2 = m_ci.at(cellId2);
-	
-	double centerDistance = CellDistance::distance(ci1.center, ci2.center);
-	
-	return std::max<double>(0.0, centerDistance - ci1.outerRadius - ci2.outerRadius);
+	if (cellId1 >= m_ci.size() || cellId2 >= m_ci.size()) {
+		throw sserialize::OutOfBoundsException("CellDistanceByAnulus::distance: cellId1=" + std::to_string(cellId1) + ", cellId2=" + std::to_string(cellId2));
+	}
+	return m_kernels.distance(cellId1, cellId2);
 }
 
 double CellDistanceByAnulus::distance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const {
-	const CellInfo & ci = m_ci.at(cellId);
-	double centerDistance = CellDistance::distance(ci.center, gp);
-	return std::max<double>(0.0, centerDistance - ci.outerRadius);
+	if (cellId >= m_ci.size()) {
+		throw sserialize::OutOfBoundsException("CellDistanceByAnulus::distance: cellId=" + std::to_string(cellId));
+	}
+	return m_kernels.distance(gp, cellId);
+}
+
+void CellDistanceByAnulus::distances(uint32_t cellId, const uint32_t * cellIds, std::size_t count, double * dest) const {
+	if (cellId >= m_ci.size()) {
+		throw sserialize::OutOfBoundsException("CellDistanceByAnulus::distances: cellId=" + std::to_string(cellId));
+	}
+	m_kernels.distancesAt(cellId, cellIds, count, dest);
+}
+
+void CellDistanceByAnulus::distances(const sserialize::spatial::GeoPoint & gp, const uint32_t * cellIds, std::size_t count, double * dest) const {
+	m_kernels.distancesAt(gp, 0.0, cellIds, count, dest);
+}
+
+void CellDistanceByAnulus::distances(const sserialize::spatial::GeoPoint & gp, double * dest) const {
+	m_kernels.distances(gp, 0.0, std::size_t(0), m_kernels.size(), dest);
+}
+
+void CellDistanceByAnulus::initKernels() {
+	m_kernels.reserve(m_ci.size());
+	for(const CellInfo & ci : m_ci) {
+		m_kernels.push_back(ci.center, ci.outerRadius);
+	}
 }
 
 std::vector<CellDistanceByAnulus::CellInfo>
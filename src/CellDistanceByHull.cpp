@@ -0,0 +1,291 @@
+#include <liboscar/CellDistanceByHull.h>
+#include <liboscar/CQRFromComplexSpatialQuery.h>
+#include <liboscar/ItemGeoDistance.h>
+#include <sserialize/algorithm/hashspecializations.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+namespace liboscar {
+
+CellDistanceByHull::CellDistanceByHull() :
+m_cellCount(0)
+{}
+
+CellDistanceByHull::CellDistanceByHull(const sserialize::UByteArrayAdapter & d) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	SSERIALIZE_VERSION_MISSMATCH_CHECK(LIBOSCAR_CELL_DISTANCE_BY_HULL_VERSION, d.at(0), "liboscar::CellDistanceByHull");
+	m_cellCount = d.getUint32(1);
+	OffsetType cellInfoBegin = 5;
+	OffsetType offsetsBegin = cellInfoBegin + OffsetType(m_cellCount)*CellInfoSize;
+	OffsetType pointsBegin = offsetsBegin + OffsetType(m_cellCount+1)*4;
+	if (d.size() < pointsBegin) {
+		throw sserialize::CorruptDataException("liboscar::CellDistanceByHull: data is too small");
+	}
+	m_cellInfo = sserialize::UByteArrayAdapter(d, cellInfoBegin, offsetsBegin-cellInfoBegin);
+	m_offsets = sserialize::UByteArrayAdapter(d, offsetsBegin, pointsBegin-offsetsBegin);
+	m_points = sserialize::UByteArrayAdapter(d, pointsBegin);
+	if (m_points.size() < OffsetType(m_offsets.getUint32(OffsetType(m_cellCount)*4))*PointSize) {
+		throw sserialize::CorruptDataException("liboscar::CellDistanceByHull: data is too small");
+	}
+}
+
+CellDistanceByHull::~CellDistanceByHull() {}
+
+double CellDistanceByHull::distance(uint32_t cellId1, uint32_t cellId2) const {
+	double lb = lowerBound(cellId1, cellId2);
+	if (lb > MaxRefinementDistance) {
+		return lb;
+	}
+	return std::max<double>(lb, hullDistance(cellId1, cellId2));
+}
+
+double CellDistanceByHull::distance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const {
+	double lb = lowerBound(gp, cellId);
+	if (lb > MaxRefinementDistance) {
+		return lb;
+	}
+	return std::max<double>(lb, hullDistance(gp, cellId));
+}
+
+bool CellDistanceByHull::within(uint32_t cellId1, uint32_t cellId2, double distance) const {
+	double centerDistance = CellDistance::distance(center(cellId1), center(cellId2));
+	double r = radius(cellId1) + radius(cellId2);
+	//all points of both hulls are within the spheres, hence their distance is at most centerDistance + r
+	if (centerDistance - r > distance) {
+		return false;
+	}
+	if (centerDistance + r <= distance) {
+		return true;
+	}
+	return hullDistance(cellId1, cellId2) <= distance;
+}
+
+bool CellDistanceByHull::within(const sserialize::spatial::interface::CellDistance & cd, uint32_t cellId1, uint32_t cellId2, double distance) {
+	if (const CellDistanceByHull * hcd = dynamic_cast<const CellDistanceByHull*>(&cd)) {
+		return hcd->within(cellId1, cellId2, distance);
+	}
+	return cd.distance(cellId1, cellId2) <= distance;
+}
+
+double CellDistanceByHull::hullDistance(uint32_t cellId1, uint32_t cellId2) const {
+	thread_local std::vector<sserialize::spatial::GeoPoint> hull1, hull2;
+	hull1.clear();
+	hull2.clear();
+	hull(cellId1, hull1);
+	hull(cellId2, hull2);
+	return ItemGeoDistance::convexPolygonDistance(hull1, hull2) - slack(cellId1) - slack(cellId2);
+}
+
+double CellDistanceByHull::hullDistance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const {
+	thread_local std::vector<sserialize::spatial::GeoPoint> point(1), cellHull;
+	point.front() = gp;
+	cellHull.clear();
+	hull(cellId, cellHull);
+	return ItemGeoDistance::convexPolygonDistance(point, cellHull) - slack(cellId);
+}
+
+double CellDistanceByHull::lowerBound(uint32_t cellId1, uint32_t cellId2) const {
+	double centerDistance = CellDistance::distance(center(cellId1), center(cellId2));
+	return std::max<double>(0.0, centerDistance - radius(cellId1) - radius(cellId2));
+}
+
+double CellDistanceByHull::lowerBound(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const {
+	double centerDistance = CellDistance::distance(center(cellId), gp);
+	return std::max<double>(0.0, centerDistance - radius(cellId));
+}
+
+sserialize::spatial::GeoPoint CellDistanceByHull::center(uint32_t cellId) const {
+	checkCellId(cellId);
+	sserialize::UByteArrayAdapter::OffsetType pos = sserialize::UByteArrayAdapter::OffsetType(cellId)*CellInfoSize;
+	return sserialize::spatial::GeoPoint(fromFixedLat(m_cellInfo.getUint32(pos)), fromFixedLon(m_cellInfo.getUint32(pos+4)));
+}
+
+double CellDistanceByHull::radius(uint32_t cellId) const {
+	checkCellId(cellId);
+	return m_cellInfo.getUint32(sserialize::UByteArrayAdapter::OffsetType(cellId)*CellInfoSize+8);
+}
+
+double CellDistanceByHull::slack(uint32_t cellId) const {
+	checkCellId(cellId);
+	return m_cellInfo.getUint32(sserialize::UByteArrayAdapter::OffsetType(cellId)*CellInfoSize+12);
+}
+
+void CellDistanceByHull::hull(uint32_t cellId, std::vector<sserialize::spatial::GeoPoint> & dest) const {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	checkCellId(cellId);
+	uint32_t begin = m_offsets.getUint32(OffsetType(cellId)*4);
+	uint32_t end = m_offsets.getUint32(OffsetType(cellId+1)*4);
+	for(uint32_t i(begin); i < end; ++i) {
+		OffsetType pos = OffsetType(i)*PointSize;
+		dest.emplace_back(fromFixedLat(m_points.getUint32(pos)), fromFixedLon(m_points.getUint32(pos+4)));
+	}
+}
+
+void CellDistanceByHull::checkCellId(uint32_t cellId) const {
+	if (cellId >= m_cellCount) {
+		throw sserialize::OutOfBoundsException("liboscar::CellDistanceByHull: cellId=" + std::to_string(cellId));
+	}
+}
+
+uint32_t CellDistanceByHull::toFixedLat(double lat) {
+	return uint32_t(std::round((std::max<double>(-90.0, std::min<double>(90.0, lat)) + 90.0) / 180.0 * double(std::numeric_limits<uint32_t>::max())));
+}
+
+uint32_t CellDistanceByHull::toFixedLon(double lon) {
+	return uint32_t(std::round((std::max<double>(-180.0, std::min<double>(180.0, lon)) + 180.0) / 360.0 * double(std::numeric_limits<uint32_t>::max())));
+}
+
+double CellDistanceByHull::fromFixedLat(uint32_t v) {
+	return double(v) / double(std::numeric_limits<uint32_t>::max()) * 180.0 - 90.0;
+}
+
+double CellDistanceByHull::fromFixedLon(uint32_t v) {
+	return double(v) / double(std::numeric_limits<uint32_t>::max()) * 360.0 - 180.0;
+}
+
+void CellDistanceByHull::create(
+	const TriangulationGeoHierarchyArrangement & tra,
+	sserialize::UByteArrayAdapter & dest,
+	uint32_t threadCount,
+	uint32_t maxHullSize)
+{
+	using Hull = RegionHullCache::Hull;
+	struct CellData {
+		Hull hull;
+		sserialize::spatial::GeoPoint center;
+		double radius;
+		double slack;
+	};
+	struct State {
+		const TriangulationGeoHierarchyArrangement & tra;
+		uint32_t maxHullSize;
+		std::atomic<uint32_t> cellId{0};
+		std::vector<CellData> d;
+		State(const TriangulationGeoHierarchyArrangement & tra, uint32_t maxHullSize) :
+		tra(tra), maxHullSize(maxHullSize), d(tra.cellCount())
+		{}
+	};
+	struct Worker {
+		State * state;
+		std::unordered_set<std::pair<double, double>> pts;
+		Hull points;
+		Hull hull;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			while(true) {
+				uint32_t cellId = state->cellId.fetch_add(1, std::memory_order_relaxed);
+				if (cellId >= state->d.size()) {
+					break;
+				}
+				process(cellId);
+			}
+		}
+		void process(uint32_t cellId) {
+			pts.clear();
+			points.clear();
+			hull.clear();
+			state->tra.cfGraph(cellId).visitCB([this, cellId](const auto & face) {
+				for (uint32_t j(0); j < 3; ++j) {
+					auto nId = face.neighborId(j);
+					auto ncId = state->tra.cellIdFromFaceId(nId);
+					if (ncId != cellId) { //only insert points of border edges
+						pts.emplace( face.point( state->tra.tds().ccw(j) ) );
+						pts.emplace( face.point( state->tra.tds().cw(j) ) );
+					}
+				}
+			});
+			for(const auto & x : pts) {
+				points.emplace_back(x.first, x.second);
+			}
+			RegionHullCache::convexHull(points, hull);
+			CellData & cd = state->d.at(cellId);
+			//round to the stored precision first, radius and slack then refer to the stored points
+			for(sserialize::spatial::GeoPoint & x : hull) {
+				x = sserialize::spatial::GeoPoint(fromFixedLat(toFixedLat(x.lat())), fromFixedLon(toFixedLon(x.lon())));
+			}
+			cd.center = centroid(hull);
+			cd.center = sserialize::spatial::GeoPoint(fromFixedLat(toFixedLat(cd.center.lat())), fromFixedLon(toFixedLon(cd.center.lon())));
+			cd.radius = 0.0;
+			for(const sserialize::spatial::GeoPoint & x : hull) {
+				cd.radius = std::max(cd.radius, CellDistance::distance(cd.center, x));
+			}
+			cd.hull = hull;
+			simplify(cd.hull);
+			cd.slack = 0.0;
+			if (cd.hull.size() != hull.size()) {
+				std::vector<sserialize::spatial::GeoPoint> point(1);
+				for(const sserialize::spatial::GeoPoint & x : hull) {
+					point.front() = x;
+					cd.slack = std::max(cd.slack, ItemGeoDistance::convexPolygonDistance(point, cd.hull));
+				}
+			}
+		}
+		///mean of the points as unit vectors, averaging lat/lon breaks for cells crossing the dateline
+		static sserialize::spatial::GeoPoint centroid(const Hull & h) {
+			constexpr double toRad = M_PI/180.0;
+			double x = 0, y = 0, z = 0;
+			for(const sserialize::spatial::GeoPoint & p : h) {
+				double lat = p.lat()*toRad;
+				double lon = p.lon()*toRad;
+				x += std::cos(lat)*std::cos(lon);
+				y += std::cos(lat)*std::sin(lon);
+				z += std::sin(lat);
+			}
+			double norm = std::sqrt(x*x + y*y + z*z);
+			if (norm < 1e-12) {
+				return h.size() ? h.front() : sserialize::spatial::GeoPoint(0.0, 0.0);
+			}
+			return sserialize::spatial::GeoPoint(std::asin(z/norm)/toRad, std::atan2(y, x)/toRad);
+		}
+		///removes the points with the smallest distance to the segment of their neighbors until the hull is small enough
+		void simplify(Hull & h) {
+			while (h.size() > std::max<uint32_t>(3, state->maxHullSize)) {
+				std::size_t best = 0;
+				double bestDist = std::numeric_limits<double>::max();
+				for(std::size_t i(0), s(h.size()); i < s; ++i) {
+					const sserialize::spatial::GeoPoint & prev = h[(i+s-1)%s];
+					const sserialize::spatial::GeoPoint & next = h[(i+1)%s];
+					double d = ItemGeoDistance(h[i]).distance(prev, next);
+					if (d < bestDist) {
+						bestDist = d;
+						best = i;
+					}
+				}
+				h.erase(h.begin()+best);
+			}
+		}
+	};
+
+	State state(tra, maxHullSize);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	dest.putUint8(LIBOSCAR_CELL_DISTANCE_BY_HULL_VERSION);
+	dest.putUint32(uint32_t(state.d.size()));
+	for(const CellData & cd : state.d) {
+		dest.putUint32(toFixedLat(cd.center.lat()));
+		dest.putUint32(toFixedLon(cd.center.lon()));
+		//the extra meter accounts for rounding the points to fixed point numbers
+		dest.putUint32(uint32_t(std::ceil(cd.radius)) + 1);
+		dest.putUint32(uint32_t(std::ceil(cd.slack)) + 1);
+	}
+	uint32_t offset = 0;
+	for(const CellData & cd : state.d) {
+		dest.putUint32(offset);
+		offset += uint32_t(cd.hull.size());
+	}
+	dest.putUint32(offset);
+	for(const CellData & cd : state.d) {
+		for(const sserialize::spatial::GeoPoint & x : cd.hull) {
+			dest.putUint32(toFixedLat(x.lat()));
+			dest.putUint32(toFixedLon(x.lon()));
+		}
+	}
+}
+
+}//end namespace liboscar
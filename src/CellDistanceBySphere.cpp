@@ -1,6 +1,7 @@
 #include <liboscar/CellDistanceBySphere.h>
 #include <sserialize/algorithm/hashspecializations.h>
 #include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
 
 #include <CGAL/Cartesian.h>
 #include <CGAL/Random.h>
@@ -13,27 +14,52 @@ namespace liboscar {
 
 CellDistanceBySphere::CellDistanceBySphere(const std::vector<CellInfo> & d) :
 m_ci(d)
-{}
+{
+	initKernels();
+}
 
 CellDistanceBySphere::CellDistanceBySphere(std::vector<CellInfo> && d) :
 m_ci(std::move(d))
-{}
+{
+	initKernels();
+}
 
 CellDistanceBySphere::~CellDistanceBySphere() {}
 
 double CellDistanceBySphere::distance(uint32_t cellId1, uint32_t cellId2) const {
-	const CellInfo & ci1 = m_ci.at(cellId1);
-	const CellInfo & ci2 = m_ci.at(cellId2);
-	
-	double centerDistance = CellDistance::distance(ci1.center, ci2.center);
-	
-	return std::max<double>(0.0, centerDistance - ci1.radius - ci2.radius);
+	if (cellId1 >= m_ci.size() || cellId2 >= m_ci.size()) {
+		throw sserialize::OutOfBoundsException("CellDistanceBySphere::distance: cellId1=" + std::to_string(cellId1) + ", cellId2=" + std::to_string(cellId2));
+	}
+	return m_kernels.distance(cellId1, cellId2);
 }
 
 double CellDistanceBySphere::distance(const sserialize::spatial::GeoPoint & gp, uint32_t cellId) const {
-	const CellInfo & ci = m_ci.at(cellId);
-	double centerDistance = CellDistance::distance(ci.center, gp);
-	return std::max<double>(0.0, centerDistance - ci.radius);
+	if (cellId >= m_ci.size()) {
+		throw sserialize::OutOfBoundsException("CellDistanceBySphere::distance: cellId=" + std::to_string(cellId));
+	}
+	return m_kernels.distance(gp, cellId);
+}
+
+void CellDistanceBySphere::distances(uint32_t cellId, const uint32_t * cellIds, std::size_t count, double * dest) const {
+	if (cellId >= m_ci.size()) {
+		throw sserialize::OutOfBoundsException("CellDistanceBySphere::distances: cellId=" + std::to_string(cellId));
+	}
+	m_kernels.distancesAt(cellId, cellIds, count, dest);
+}
+
+void CellDistanceBySphere::distances(const sserialize::spatial::GeoPoint & gp, const uint32_t * cellIds, std::size_t count, double * dest) const {
+	m_kernels.distancesAt(gp, 0.0, cellIds, count, dest);
+}
+
+void CellDistanceBySphere::distances(const sserialize::spatial::GeoPoint & gp, double * dest) const {
+	m_kernels.distances(gp, 0.0, std::size_t(0), m_kernels.size(), dest);
+}
+
+void CellDistanceBySphere::initKernels() {
+	m_kernels.reserve(m_ci.size());
+	for(const CellInfo & ci : m_ci) {
+		m_kernels.push_back(ci.center, ci.radius);
+	}
 }
 
 std::vector<CellDistanceBySphere::CellInfo>
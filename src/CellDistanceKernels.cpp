@@ -0,0 +1,198 @@
+#include <liboscar/CellDistanceKernels.h>
+#include <liboscar/SimdVecD.h>
+#include <sserialize/utility/assert.h>
+#include <algorithm>
+#include <cmath>
+
+namespace liboscar {
+namespace {
+
+using detail::VecD;
+
+///half of the angle in radians of a distance in meters, clamped to pi/2
+inline double halfAngle(double distance) {
+	return std::min<double>(M_PI/2.0, std::max<double>(0.0, distance)/(2.0*CellDistanceKernels::EarthRadius));
+}
+
+} //end namespace
+
+CellDistanceKernels::CellDistanceKernels() {}
+
+CellDistanceKernels::~CellDistanceKernels() {}
+
+void CellDistanceKernels::reserve(std::size_t size) {
+	m_x.reserve(size);
+	m_y.reserve(size);
+	m_z.reserve(size);
+	m_radius.reserve(size);
+	m_sinHalf.reserve(size);
+	m_cosHalf.reserve(size);
+}
+
+void CellDistanceKernels::push_back(const sserialize::spatial::GeoPoint & center, double radius) {
+	Query q = query(center, radius);
+	double beta = halfAngle(radius);
+	m_x.push_back(q.x);
+	m_y.push_back(q.y);
+	m_z.push_back(q.z);
+	m_radius.push_back(radius);
+	m_sinHalf.push_back(std::sin(beta));
+	m_cosHalf.push_back(std::cos(beta));
+}
+
+double CellDistanceKernels::distance(std::size_t pos1, std::size_t pos2) const {
+	uint32_t pos = (uint32_t) pos2;
+	double result;
+	distancesAt(query(pos1), &pos, 1, &result);
+	return result;
+}
+
+double CellDistanceKernels::distance(const sserialize::spatial::GeoPoint & p, std::size_t pos) const {
+	uint32_t tmp = (uint32_t) pos;
+	double result;
+	distancesAt(query(p, 0.0), &tmp, 1, &result);
+	return result;
+}
+
+void CellDistanceKernels::distances(const sserialize::spatial::GeoPoint & p, double radius, std::size_t begin, std::size_t end, double * dest) const {
+	distances(query(p, radius), begin, end, dest);
+}
+
+void CellDistanceKernels::distancesAt(const sserialize::spatial::GeoPoint & p, double radius, const uint32_t * positions, std::size_t count, double * dest) const {
+	distancesAt(query(p, radius), positions, count, dest);
+}
+
+void CellDistanceKernels::distancesAt(std::size_t pos, const uint32_t * positions, std::size_t count, double * dest) const {
+	distancesAt(query(pos), positions, count, dest);
+}
+
+std::size_t CellDistanceKernels::within(const sserialize::spatial::GeoPoint & p, double radius, double maxDistance, std::size_t begin, std::size_t end, std::vector<uint32_t> & dest) const {
+	return within(query(p, radius), maxDistance, begin, end, dest);
+}
+
+std::size_t CellDistanceKernels::within(std::size_t pos, double maxDistance, std::size_t begin, std::size_t end, std::vector<uint32_t> & dest) const {
+	return within(query(pos), maxDistance, begin, end, dest);
+}
+
+CellDistanceKernels::Query CellDistanceKernels::query(const sserialize::spatial::GeoPoint & p, double radius) {
+	double lat = p.lat()*M_PI/180.0;
+	double lon = p.lon()*M_PI/180.0;
+	return Query{std::cos(lat)*std::cos(lon), std::cos(lat)*std::sin(lon), std::sin(lat), radius};
+}
+
+CellDistanceKernels::Query CellDistanceKernels::query(std::size_t pos) const {
+	return Query{m_x.at(pos), m_y.at(pos), m_z.at(pos), m_radius.at(pos)};
+}
+
+double CellDistanceKernels::chordToDistance(double chord2) {
+	return 2.0*EarthRadius*std::asin(std::min<double>(1.0, std::sqrt(chord2)/2.0));
+}
+
+void CellDistanceKernels::distances(const Query & q, std::size_t begin, std::size_t end, double * dest) const {
+	const double * x = m_x.data();
+	const double * y = m_y.data();
+	const double * z = m_z.data();
+	std::size_t i = begin;
+#ifdef LIBOSCAR_SIMD_VECD
+	const VecD qx = VecD::set1(q.x);
+	const VecD qy = VecD::set1(q.y);
+	const VecD qz = VecD::set1(q.z);
+	for(; i+VecD::Width <= end; i += VecD::Width) {
+		VecD dx = VecD::load(x+i) - qx;
+		VecD dy = VecD::load(y+i) - qy;
+		VecD dz = VecD::load(z+i) - qz;
+		VecD::store(dest+(i-begin), dx*dx + dy*dy + dz*dz);
+	}
+#endif
+	for(; i < end; ++i) {
+		double dx = x[i] - q.x, dy = y[i] - q.y, dz = z[i] - q.z;
+		dest[i-begin] = dx*dx + dy*dy + dz*dz;
+	}
+	for(i = begin; i < end; ++i) {
+		dest[i-begin] = std::max<double>(0.0, chordToDistance(dest[i-begin]) - q.radius - m_radius[i]);
+	}
+}
+
+void CellDistanceKernels::distancesAt(const Query & q, const uint32_t * positions, std::size_t count, double * dest) const {
+	std::size_t i = 0;
+#ifdef LIBOSCAR_SIMD_VECD
+	//SSE2 has no gather, hence the centers are gathered into a small buffer
+	const VecD qx = VecD::set1(q.x);
+	const VecD qy = VecD::set1(q.y);
+	const VecD qz = VecD::set1(q.z);
+	double bx[VecD::Width], by[VecD::Width], bz[VecD::Width];
+	for(; i+VecD::Width <= count; i += VecD::Width) {
+		for(std::size_t j(0); j < VecD::Width; ++j) {
+			uint32_t pos = positions[i+j];
+			SSERIALIZE_CHEAP_ASSERT_SMALLER(std::size_t(pos), m_x.size());
+			bx[j] = m_x[pos];
+			by[j] = m_y[pos];
+			bz[j] = m_z[pos];
+		}
+		VecD dx = VecD::load(bx) - qx;
+		VecD dy = VecD::load(by) - qy;
+		VecD dz = VecD::load(bz) - qz;
+		VecD::store(dest+i, dx*dx + dy*dy + dz*dz);
+	}
+#endif
+	for(; i < count; ++i) {
+		uint32_t pos = positions[i];
+		SSERIALIZE_CHEAP_ASSERT_SMALLER(std::size_t(pos), m_x.size());
+		double dx = m_x[pos] - q.x, dy = m_y[pos] - q.y, dz = m_z[pos] - q.z;
+		dest[i] = dx*dx + dy*dy + dz*dz;
+	}
+	for(i = 0; i < count; ++i) {
+		dest[i] = std::max<double>(0.0, chordToDistance(dest[i]) - q.radius - m_radius[positions[i]]);
+	}
+}
+
+std::size_t CellDistanceKernels::within(const Query & q, double maxDistance, std::size_t begin, std::size_t end, std::vector<uint32_t> & dest) const {
+	//arc/2 <= alpha+beta <=> chord/2 <= sin(alpha+beta) as long as alpha+beta <= pi/2, every ball matches otherwise
+	double alpha = halfAngle(q.radius + maxDistance);
+	double sinA = std::sin(alpha);
+	double cosA = std::cos(alpha);
+	const double * x = m_x.data();
+	const double * y = m_y.data();
+	const double * z = m_z.data();
+	const double * sinB = m_sinHalf.data();
+	const double * cosB = m_cosHalf.data();
+	std::size_t oldSize = dest.size();
+	std::size_t i = begin;
+#ifdef LIBOSCAR_SIMD_VECD
+	const VecD qx = VecD::set1(q.x);
+	const VecD qy = VecD::set1(q.y);
+	const VecD qz = VecD::set1(q.z);
+	const VecD vSinA = VecD::set1(sinA);
+	const VecD vCosA = VecD::set1(cosA);
+	const VecD four = VecD::set1(4.0);
+	const VecD zero = VecD::set1(0.0);
+	for(; i+VecD::Width <= end; i += VecD::Width) {
+		VecD dx = VecD::load(x+i) - qx;
+		VecD dy = VecD::load(y+i) - qy;
+		VecD dz = VecD::load(z+i) - qz;
+		VecD chord2 = dx*dx + dy*dy + dz*dz;
+		VecD sB = VecD::load(sinB+i);
+		VecD cB = VecD::load(cosB+i);
+		VecD s = vSinA*cB + vCosA*sB;
+		VecD c = vCosA*cB - vSinA*sB;
+		int mask = VecD::le(c, zero) | VecD::le(chord2, four*s*s);
+		for(uint32_t j(0); mask; ++j, mask >>= 1) {
+			if (mask & 0x1) {
+				dest.push_back(uint32_t(i+j));
+			}
+		}
+	}
+#endif
+	for(; i < end; ++i) {
+		double dx = x[i] - q.x, dy = y[i] - q.y, dz = z[i] - q.z;
+		double chord2 = dx*dx + dy*dy + dz*dz;
+		double s = sinA*cosB[i] + cosA*sinB[i];
+		double c = cosA*cosB[i] - sinA*sinB[i];
+		if (c <= 0.0 || chord2 <= 4.0*s*s) {
+			dest.push_back(uint32_t(i));
+		}
+	}
+	return dest.size() - oldSize;
+}
+
+}//end namespace liboscar
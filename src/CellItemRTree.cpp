@@ -0,0 +1,213 @@
+#include <liboscar/CellItemRTree.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace liboscar {
+
+CellItemRTree::CellItemRTree() :
+m_cellCount(0),
+m_nodeCapacity(0)
+{}
+
+CellItemRTree::CellItemRTree(const sserialize::UByteArrayAdapter & d) {
+	SSERIALIZE_VERSION_MISSMATCH_CHECK(LIBOSCAR_CELL_ITEM_RTREE_VERSION, d.at(0), "liboscar::CellItemRTree");
+	m_cellCount = d.getUint32(1);
+	m_nodeCapacity = d.getUint32(5);
+	sserialize::UByteArrayAdapter::OffsetType offsetsBegin = 9;
+	sserialize::UByteArrayAdapter::OffsetType treesBegin = offsetsBegin + sserialize::UByteArrayAdapter::OffsetType(m_cellCount+1)*8;
+	m_offsets = sserialize::UByteArrayAdapter(d, offsetsBegin, treesBegin-offsetsBegin);
+	m_trees = sserialize::UByteArrayAdapter(d, treesBegin);
+	if (m_trees.size() < m_offsets.getUint64(sserialize::UByteArrayAdapter::OffsetType(m_cellCount)*8)) {
+		throw sserialize::CorruptDataException("liboscar::CellItemRTree: data is too small");
+	}
+}
+
+CellItemRTree::~CellItemRTree() {}
+
+uint32_t CellItemRTree::toFixedLat(double lat, bool roundUp) {
+	double v = (std::max<double>(-90.0, std::min<double>(90.0, lat)) + 90.0) / 180.0 * double(std::numeric_limits<uint32_t>::max());
+	return roundUp ? uint32_t(std::ceil(v)) : uint32_t(std::floor(v));
+}
+
+uint32_t CellItemRTree::toFixedLon(double lon, bool roundUp) {
+	double v = (std::max<double>(-180.0, std::min<double>(180.0, lon)) + 180.0) / 360.0 * double(std::numeric_limits<uint32_t>::max());
+	return roundUp ? uint32_t(std::ceil(v)) : uint32_t(std::floor(v));
+}
+
+CellItemRTree::FixedPointRect CellItemRTree::toFixed(const sserialize::spatial::GeoRect & rect) {
+	return FixedPointRect{
+		toFixedLat(rect.minLat(), false),
+		toFixedLon(rect.minLon(), false),
+		toFixedLat(rect.maxLat(), true),
+		toFixedLon(rect.maxLon(), true)
+	};
+}
+
+void CellItemRTree::itemsContaining(uint32_t cellId, const sserialize::spatial::GeoPoint & p, std::vector<uint32_t> & dest) const {
+	//rounding the point outwards makes sure that we don't miss items whose border touches the point
+	FixedPointRect r{
+		toFixedLat(p.lat(), false),
+		toFixedLon(p.lon(), false),
+		toFixedLat(p.lat(), true),
+		toFixedLon(p.lon(), true)
+	};
+	query(cellId, r, dest);
+}
+
+void CellItemRTree::itemsIntersecting(uint32_t cellId, const sserialize::spatial::GeoRect & rect, std::vector<uint32_t> & dest) const {
+	query(cellId, toFixed(rect), dest);
+}
+
+void CellItemRTree::query(uint32_t cellId, const FixedPointRect & rect, std::vector<uint32_t> & dest) const {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	if (cellId >= m_cellCount) {
+		throw sserialize::OutOfBoundsException("liboscar::CellItemRTree::query: cellId=" + std::to_string(cellId));
+	}
+	OffsetType treeBegin = m_offsets.getUint64(OffsetType(cellId)*8);
+	OffsetType treeEnd = m_offsets.getUint64(OffsetType(cellId+1)*8);
+	if (treeBegin == treeEnd) {
+		return;
+	}
+	uint32_t levelCount = m_trees.getUint32(treeBegin);
+	//offsets of the levels, levels are stored from top to bottom
+	OffsetType levelBegin[32];
+	SSERIALIZE_CHEAP_ASSERT_SMALLER(levelCount, uint32_t(32));
+	{
+		OffsetType pos = treeBegin + 4 + OffsetType(levelCount)*4;
+		for(uint32_t i(levelCount); i > 0; --i) {
+			uint32_t level = i-1;
+			levelBegin[level] = pos;
+			uint32_t levelSize = m_trees.getUint32(treeBegin + 4 + OffsetType(levelCount-1-level)*4);
+			pos += OffsetType(levelSize) * (level ? InnerEntrySize : LeafEntrySize);
+		}
+	}
+	auto entryRect = [this](OffsetType pos) {
+		return FixedPointRect{m_trees.getUint32(pos), m_trees.getUint32(pos+4), m_trees.getUint32(pos+8), m_trees.getUint32(pos+12)};
+	};
+	struct Range {
+		uint32_t level;
+		uint32_t begin;
+		uint32_t count;
+	};
+	std::vector<Range> stack;
+	stack.push_back(Range{levelCount-1, 0, m_trees.getUint32(treeBegin + 4)});
+	while (stack.size()) {
+		Range r = stack.back();
+		stack.pop_back();
+		if (r.level) {
+			for(uint32_t i(r.begin), s(r.begin+r.count); i < s; ++i) {
+				OffsetType pos = levelBegin[r.level] + OffsetType(i)*InnerEntrySize;
+				if (entryRect(pos).overlap(rect)) {
+					stack.push_back(Range{r.level-1, m_trees.getUint32(pos+16), m_trees.getUint32(pos+20)});
+				}
+			}
+		}
+		else {
+			for(uint32_t i(r.begin), s(r.begin+r.count); i < s; ++i) {
+				OffsetType pos = levelBegin[0] + OffsetType(i)*LeafEntrySize;
+				if (entryRect(pos).overlap(rect)) {
+					dest.push_back(m_trees.getUint32(pos+16));
+				}
+			}
+		}
+	}
+}
+
+void CellItemRTree::create(
+	const Static::OsmKeyValueObjectStore & store,
+	const sserialize::Static::ItemIndexStore & idxStore,
+	sserialize::UByteArrayAdapter & dest,
+	uint32_t nodeCapacity)
+{
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	struct Entry {
+		FixedPointRect rect;
+		uint32_t ref;
+		uint32_t count;
+	};
+
+	nodeCapacity = std::max<uint32_t>(nodeCapacity, 2);
+	const sserialize::Static::spatial::GeoHierarchy & gh = store.geoHierarchy();
+	uint32_t cellCount = gh.cellSize();
+
+	dest.putUint8(LIBOSCAR_CELL_ITEM_RTREE_VERSION);
+	dest.putUint32(cellCount);
+	dest.putUint32(nodeCapacity);
+	OffsetType offsetsBegin = dest.tellPutPtr();
+	for(uint32_t i(0); i <= cellCount; ++i) {
+		dest.putUint64(0);
+	}
+	OffsetType treesBegin = dest.tellPutPtr();
+
+	//Sort-Tile-Recursive: sort by lon into vertical slices of sqrt(nodeCount) nodes, sort each slice by lat
+	auto strSort = [nodeCapacity](std::vector<Entry> & entries) {
+		auto centerLon = [](const Entry & e) { return uint64_t(e.rect.minLon) + e.rect.maxLon; };
+		auto centerLat = [](const Entry & e) { return uint64_t(e.rect.minLat) + e.rect.maxLat; };
+		std::size_t nodeCount = (entries.size() + nodeCapacity - 1) / nodeCapacity;
+		std::size_t sliceCount = std::ceil(std::sqrt(double(nodeCount)));
+		std::size_t sliceSize = sliceCount*nodeCapacity;
+		std::sort(entries.begin(), entries.end(), [&](const Entry & a, const Entry & b) { return centerLon(a) < centerLon(b); });
+		for(std::size_t i(0), s(entries.size()); i < s; i += sliceSize) {
+			auto sliceEnd = entries.begin() + std::min(s, i+sliceSize);
+			std::sort(entries.begin()+i, sliceEnd, [&](const Entry & a, const Entry & b) { return centerLat(a) < centerLat(b); });
+		}
+	};
+
+	std::vector< std::vector<Entry> > levels;
+	for(uint32_t cellId(0); cellId < cellCount; ++cellId) {
+		levels.clear();
+		levels.emplace_back();
+		sserialize::ItemIndex cellItems( idxStore.at( gh.cellItemsPtr(cellId) ) );
+		for(uint32_t itemId : cellItems) {
+			sserialize::spatial::GeoShapeType gst = store.geoShapeType(itemId);
+			if (gst == sserialize::spatial::GS_POLYGON || gst == sserialize::spatial::GS_MULTI_POLYGON) {
+				levels.back().push_back(Entry{toFixed(store.geoShape(itemId).boundary()), itemId, 0});
+			}
+		}
+		if (!levels.back().size()) {
+			dest.putUint64(offsetsBegin + OffsetType(cellId+1)*8, dest.tellPutPtr() - treesBegin);
+			continue;
+		}
+		strSort(levels.back());
+		while (levels.back().size() > nodeCapacity) {
+			std::vector<Entry> parents;
+			const std::vector<Entry> & children = levels.back();
+			for(uint32_t i(0), s(children.size()); i < s; i += nodeCapacity) {
+				uint32_t end = std::min<uint32_t>(s, i+nodeCapacity);
+				Entry p{children[i].rect, i, end-i};
+				for(uint32_t j(i+1); j < end; ++j) {
+					const FixedPointRect & r = children[j].rect;
+					p.rect.minLat = std::min(p.rect.minLat, r.minLat);
+					p.rect.minLon = std::min(p.rect.minLon, r.minLon);
+					p.rect.maxLat = std::max(p.rect.maxLat, r.maxLat);
+					p.rect.maxLon = std::max(p.rect.maxLon, r.maxLon);
+				}
+				parents.push_back(p);
+			}
+			//reordering parents is fine since they reference their children explicitly
+			strSort(parents);
+			levels.emplace_back(std::move(parents));
+		}
+		dest.putUint32(levels.size());
+		for(auto it(levels.rbegin()), end(levels.rend()); it != end; ++it) {
+			dest.putUint32(it->size());
+		}
+		for(std::size_t level(levels.size()); level > 0; --level) {
+			for(const Entry & e : levels[level-1]) {
+				dest.putUint32(e.rect.minLat);
+				dest.putUint32(e.rect.minLon);
+				dest.putUint32(e.rect.maxLat);
+				dest.putUint32(e.rect.maxLon);
+				dest.putUint32(e.ref);
+				if (level > 1) {
+					dest.putUint32(e.count);
+				}
+			}
+		}
+		dest.putUint64(offsetsBegin + OffsetType(cellId+1)*8, dest.tellPutPtr() - treesBegin);
+	}
+}
+
+}//end namespace liboscar
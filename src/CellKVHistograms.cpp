@@ -0,0 +1,178 @@
+#include <liboscar/CellKVHistograms.h>
+#include <sserialize/algorithm/hashspecializations.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+namespace liboscar {
+
+CellKVHistograms::CellKVHistograms() :
+m_cellCount(0)
+{}
+
+CellKVHistograms::CellKVHistograms(const sserialize::UByteArrayAdapter & d) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	SSERIALIZE_VERSION_MISSMATCH_CHECK(LIBOSCAR_CELL_KV_HISTOGRAMS_VERSION, d.at(0), "liboscar::CellKVHistograms");
+	m_cellCount = d.getUint32(1);
+	OffsetType offsetsBegin = 5;
+	OffsetType cellsBegin = offsetsBegin + OffsetType(m_cellCount+1)*8;
+	if (d.size() < cellsBegin) {
+		throw sserialize::CorruptDataException("liboscar::CellKVHistograms: data is too small");
+	}
+	m_offsets = sserialize::UByteArrayAdapter(d, offsetsBegin, cellsBegin-offsetsBegin);
+	m_cells = sserialize::UByteArrayAdapter(d, cellsBegin);
+	if (m_cells.size() < m_offsets.getUint64(OffsetType(m_cellCount)*8)) {
+		throw sserialize::CorruptDataException("liboscar::CellKVHistograms: data is too small");
+	}
+}
+
+CellKVHistograms::~CellKVHistograms() {}
+
+sserialize::UByteArrayAdapter CellKVHistograms::cellData(uint32_t cellId) const {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	if (cellId >= m_cellCount) {
+		throw sserialize::OutOfBoundsException("liboscar::CellKVHistograms: cellId=" + std::to_string(cellId));
+	}
+	OffsetType begin = m_offsets.getUint64(OffsetType(cellId)*8);
+	OffsetType end = m_offsets.getUint64(OffsetType(cellId+1)*8);
+	sserialize::UByteArrayAdapter d(m_cells, begin, end-begin);
+	d.resetGetPtr();
+	return d;
+}
+
+uint32_t CellKVHistograms::exclusiveItemCount(uint32_t cellId) const {
+	return cellData(cellId).getVlPackedUint32();
+}
+
+void CellKVHistograms::sharedItems(uint32_t cellId, std::vector<uint32_t> & dest) const {
+	sserialize::UByteArrayAdapter d( cellData(cellId) );
+	d.getVlPackedUint32(); //exclusive item count
+	uint32_t itemId = 0;
+	for(uint32_t i(0), s(d.getVlPackedUint32()); i < s; ++i) {
+		itemId += d.getVlPackedUint32();
+		dest.push_back(itemId);
+	}
+}
+
+void CellKVHistograms::create(
+	const Static::OsmKeyValueObjectStore & store,
+	const sserialize::Static::ItemIndexStore & idxStore,
+	sserialize::UByteArrayAdapter & dest,
+	uint32_t threadCount)
+{
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	using KeyValueCount = std::pair<std::pair<uint32_t, uint32_t>, uint32_t>;
+	struct CellData {
+		uint32_t exclusiveItemCount;
+		std::vector<uint32_t> sharedItems;
+		std::vector<KeyValueCount> entries;
+	};
+	struct State {
+		const Static::OsmKeyValueObjectStore & store;
+		const sserialize::Static::ItemIndexStore & idxStore;
+		const sserialize::Static::spatial::GeoHierarchy & gh;
+		///number of cells an item is part of, saturates at 2
+		std::vector<uint8_t> itemCellCount;
+		uint32_t begin;
+		uint32_t end;
+		std::atomic<uint32_t> pos{0};
+		std::vector<CellData> block;
+		State(const Static::OsmKeyValueObjectStore & store, const sserialize::Static::ItemIndexStore & idxStore) :
+		store(store), idxStore(idxStore), gh(store.geoHierarchy()),
+		itemCellCount(store.size(), 0), begin(0), end(0), block(CreateBlockSize)
+		{}
+	};
+	struct Worker {
+		State * state;
+		std::unordered_map<std::pair<uint32_t, uint32_t>, uint32_t> kvCount;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			while(true) {
+				uint32_t cellId = state->pos.fetch_add(1, std::memory_order_relaxed);
+				if (cellId >= state->end) {
+					break;
+				}
+				process(cellId);
+			}
+		}
+		void process(uint32_t cellId) {
+			CellData & cd = state->block.at(cellId - state->begin);
+			cd.exclusiveItemCount = 0;
+			cd.sharedItems.clear();
+			cd.entries.clear();
+			kvCount.clear();
+			sserialize::ItemIndex cellItems( state->idxStore.at( state->gh.cellItemsPtr(cellId) ) );
+			for(uint32_t itemId : cellItems) {
+				if (state->itemCellCount[itemId] > 1) {
+					cd.sharedItems.push_back(itemId);
+					continue;
+				}
+				++cd.exclusiveItemCount;
+				auto item = state->store.kvBaseItem(itemId);
+				for(uint32_t i(0), s(item.size()); i < s; ++i) {
+					++kvCount[std::make_pair(item.keyId(i), item.valueId(i))];
+				}
+			}
+			cd.entries.assign(kvCount.begin(), kvCount.end());
+			std::sort(cd.entries.begin(), cd.entries.end());
+		}
+	};
+
+	State state(store, idxStore);
+	uint32_t cellCount = state.gh.cellSize();
+	for(uint32_t cellId(0); cellId < cellCount; ++cellId) {
+		sserialize::ItemIndex cellItems( idxStore.at( state.gh.cellItemsPtr(cellId) ) );
+		for(uint32_t itemId : cellItems) {
+			uint8_t & c = state.itemCellCount.at(itemId);
+			c = std::min<uint8_t>(2, c+1);
+		}
+	}
+
+	dest.putUint8(LIBOSCAR_CELL_KV_HISTOGRAMS_VERSION);
+	dest.putUint32(cellCount);
+	OffsetType offsetsBegin = dest.tellPutPtr();
+	for(uint32_t i(0); i <= cellCount; ++i) {
+		dest.putUint64(0);
+	}
+	OffsetType cellsBegin = dest.tellPutPtr();
+	for(uint32_t blockBegin(0); blockBegin < cellCount; blockBegin += CreateBlockSize) {
+		state.begin = blockBegin;
+		state.end = std::min<uint32_t>(cellCount, blockBegin+CreateBlockSize);
+		state.pos = blockBegin;
+		if (threadCount <= 1) {
+			Worker worker(&state);
+			worker();
+		}
+		else {
+			sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+		}
+		for(uint32_t cellId(state.begin); cellId < state.end; ++cellId) {
+			const CellData & cd = state.block[cellId - state.begin];
+			dest.putVlPackedUint32(cd.exclusiveItemCount);
+			dest.putVlPackedUint32(uint32_t(cd.sharedItems.size()));
+			uint32_t prevItemId = 0;
+			for(uint32_t itemId : cd.sharedItems) {
+				dest.putVlPackedUint32(itemId - prevItemId);
+				prevItemId = itemId;
+			}
+			dest.putVlPackedUint32(uint32_t(cd.entries.size()));
+			uint32_t prevKeyId = 0;
+			uint32_t prevValueId = 0;
+			for(const KeyValueCount & x : cd.entries) {
+				uint32_t keyId = x.first.first;
+				uint32_t valueId = x.first.second;
+				dest.putVlPackedUint32(keyId - prevKeyId);
+				dest.putVlPackedUint32(keyId == prevKeyId ? valueId - prevValueId : valueId);
+				dest.putVlPackedUint32(x.second);
+				prevKeyId = keyId;
+				prevValueId = valueId;
+			}
+			dest.putUint64(offsetsBegin + OffsetType(cellId+1)*8, dest.tellPutPtr() - cellsBegin);
+		}
+	}
+}
+
+}//end namespace liboscar
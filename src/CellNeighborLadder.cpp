@@ -0,0 +1,354 @@
+#include <liboscar/CellNeighborLadder.h>
+#include <liboscar/CellDistanceByHull.h>
+#include <liboscar/CellDistanceBySphere.h>
+#include <liboscar/CellDistanceByAnulus.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace liboscar {
+namespace {
+
+///dest[i] = cd.distance(cellId, cellIds[i]), sphere and anulus distances use their batched kernels
+void distances(const CellNeighborLadder::CellDistance & cd, uint32_t cellId, const std::vector<uint32_t> & cellIds, std::vector<double> & dest) {
+	dest.resize(cellIds.size());
+	if (!cellIds.size()) {
+		return;
+	}
+	if (auto x = dynamic_cast<const CellDistanceBySphere*>(&cd)) {
+		x->distances(cellId, cellIds.data(), cellIds.size(), dest.data());
+	}
+	else if (auto x = dynamic_cast<const CellDistanceByAnulus*>(&cd)) {
+		x->distances(cellId, cellIds.data(), cellIds.size(), dest.data());
+	}
+	else {
+		for(std::size_t i(0), s(cellIds.size()); i < s; ++i) {
+			dest[i] = cd.distance(cellId, cellIds[i]);
+		}
+	}
+}
+
+///removes the cells from candidates that are more than distance away from cellId
+void refine(const CellNeighborLadder::CellDistance & cd, uint32_t cellId, double distance, std::vector<uint32_t> & candidates, std::vector<double> & tmp) {
+	if (dynamic_cast<const CellDistanceByHull*>(&cd)) {
+		//hulls are only compared if the bounding spheres do not decide, this is done per pair
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&cd, cellId, distance](uint32_t nId) {
+			return !CellDistanceByHull::within(cd, cellId, nId, distance);
+		}), candidates.end());
+		return;
+	}
+	distances(cd, cellId, candidates, tmp);
+	std::size_t j = 0;
+	for(std::size_t i(0), s(candidates.size()); i < s; ++i) {
+		if (tmp[i] <= distance) {
+			candidates[j] = candidates[i];
+			++j;
+		}
+	}
+	candidates.resize(j);
+}
+
+}//end namespace
+
+CellNeighborLadder::CellNeighborLadder() :
+m_cellCount(0),
+m_cellDistanceType(0)
+{}
+
+CellNeighborLadder::CellNeighborLadder(const sserialize::UByteArrayAdapter & d, const std::shared_ptr<CellDistance> & cd) :
+m_data(d),
+m_cd(cd)
+{
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	SSERIALIZE_VERSION_MISSMATCH_CHECK(LIBOSCAR_CELL_NEIGHBOR_LADDER_VERSION, d.at(0), "liboscar::CellNeighborLadder");
+	m_cellDistanceType = d.at(1);
+	uint32_t rungCount = d.at(2);
+	OffsetType pos = 3;
+	for(uint32_t i(0); i < rungCount; ++i, pos += 4) {
+		m_radii.push_back(d.getUint32(pos));
+	}
+	m_cellCount = d.getUint32(pos);
+	pos += 4;
+	OffsetType listsBegin = pos + OffsetType(m_cellCount+1)*8;
+	if (d.size() < listsBegin) {
+		throw sserialize::CorruptDataException("liboscar::CellNeighborLadder: data is too small");
+	}
+	m_offsets = sserialize::UByteArrayAdapter(d, pos, listsBegin-pos);
+	m_lists = sserialize::UByteArrayAdapter(d, listsBegin);
+	if (m_lists.size() < m_offsets.getUint64(OffsetType(m_cellCount)*8)) {
+		throw sserialize::CorruptDataException("liboscar::CellNeighborLadder: data is too small");
+	}
+}
+
+CellNeighborLadder::~CellNeighborLadder() {}
+
+std::vector<uint32_t> CellNeighborLadder::defaultRadii() {
+	return std::vector<uint32_t>({100, 500, 1000, 5000, 20000});
+}
+
+uint32_t CellNeighborLadder::rung(double distance) const {
+	auto it = std::lower_bound(m_radii.begin(), m_radii.end(), distance, [](uint32_t r, double d) { return r < d; });
+	return (uint32_t) (it - m_radii.begin());
+}
+
+void CellNeighborLadder::checkCellId(uint32_t cellId) const {
+	if (cellId >= m_cellCount) {
+		throw sserialize::OutOfBoundsException("liboscar::CellNeighborLadder: cellId=" + std::to_string(cellId));
+	}
+}
+
+template<typename T_CALLBACK>
+void CellNeighborLadder::visit(uint32_t cellId, uint32_t lastRung, T_CALLBACK cb) const {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	checkCellId(cellId);
+	OffsetType listBegin = m_offsets.getUint64(OffsetType(cellId)*8);
+	OffsetType listEnd = m_offsets.getUint64(OffsetType(cellId+1)*8);
+	sserialize::UByteArrayAdapter list(m_lists, listBegin, listEnd-listBegin);
+	list.resetGetPtr();
+	for(uint32_t r(0), s(std::min<uint32_t>(lastRung+1, rungCount())); r < s; ++r) {
+		uint32_t count = list.getVlPackedUint32();
+		uint32_t nId = 0;
+		for(uint32_t i(0); i < count; ++i) {
+			nId += list.getVlPackedUint32();
+			cb(r, nId);
+		}
+	}
+}
+
+void CellNeighborLadder::neighbors(uint32_t cellId, uint32_t rung, std::vector<uint32_t> & dest) const {
+	visit(cellId, rung, [rung, &dest](uint32_t r, uint32_t nId) {
+		if (r == rung) {
+			dest.push_back(nId);
+		}
+	});
+}
+
+void CellNeighborLadder::cellsWithin(uint32_t cellId, double distance, std::vector<uint32_t> & dest) const {
+	uint32_t k = rung(distance);
+	if (k >= rungCount()) {
+		throw sserialize::OutOfBoundsException("liboscar::CellNeighborLadder: distance " + std::to_string(distance) + " is larger than the largest radius");
+	}
+	bool exact = distance >= m_radii[k];
+	if (!exact && !m_cd) {
+		throw sserialize::MissingDataException("liboscar::CellNeighborLadder: no cell distance to refine the neighbors");
+	}
+	std::vector<uint32_t> candidates;
+	visit(cellId, k, [k, exact, &dest, &candidates](uint32_t r, uint32_t nId) {
+		if (r < k || exact) {
+			dest.push_back(nId);
+		}
+		else {
+			candidates.push_back(nId);
+		}
+	});
+	if (candidates.size()) {
+		std::vector<double> tmp;
+		refine(*m_cd, cellId, distance, candidates, tmp);
+		dest.insert(dest.end(), candidates.begin(), candidates.end());
+	}
+}
+
+sserialize::ItemIndex CellNeighborLadder::dilate(const sserialize::CellQueryResult & cqr, double distance, uint32_t threadCount) const {
+	struct State {
+		const CellNeighborLadder & ladder;
+		std::vector<uint32_t> src;
+		double distance;
+		uint32_t rung;
+		bool exact;
+		std::atomic<std::size_t> pos{0};
+		std::mutex lock;
+		///1 for cells of src, their neighbors are never checked
+		std::vector<uint8_t> isSrc;
+		std::vector<uint8_t> result;
+		State(const CellNeighborLadder & ladder, double distance) :
+		ladder(ladder), distance(distance), rung(ladder.rung(distance)), exact(false),
+		isSrc(ladder.cellCount(), 0), result(ladder.cellCount(), 0)
+		{}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			std::vector<uint8_t> found(state->ladder.cellCount(), 0);
+			std::vector<uint32_t> candidates;
+			std::vector<double> tmp;
+			while (true) {
+				std::size_t i = state->pos.fetch_add(1, std::memory_order_relaxed);
+				if (i >= state->src.size()) {
+					break;
+				}
+				uint32_t cellId = state->src[i];
+				candidates.clear();
+				//cells that are already part of the result do not need the expensive distance check
+				state->ladder.visit(cellId, state->rung, [this, &found, &candidates](uint32_t r, uint32_t nId) {
+					if (found[nId] || state->isSrc[nId]) {
+						return;
+					}
+					if (r < state->rung || state->exact) {
+						found[nId] = 1;
+					}
+					else {
+						candidates.push_back(nId);
+					}
+				});
+				if (candidates.size()) {
+					refine(*state->ladder.m_cd, cellId, state->distance, candidates, tmp);
+					for(uint32_t nId : candidates) {
+						found[nId] = 1;
+					}
+				}
+			}
+			std::lock_guard<std::mutex> lck(state->lock);
+			for(std::size_t i(0), s(found.size()); i < s; ++i) {
+				state->result[i] |= found[i];
+			}
+		}
+	};
+	if (!cqr.cellCount()) {
+		return sserialize::ItemIndex();
+	}
+	State state(*this, distance);
+	if (state.rung >= rungCount()) {
+		throw sserialize::OutOfBoundsException("liboscar::CellNeighborLadder: distance " + std::to_string(distance) + " is larger than the largest radius");
+	}
+	state.exact = distance >= m_radii[state.rung];
+	if (!state.exact && !m_cd) {
+		throw sserialize::MissingDataException("liboscar::CellNeighborLadder: no cell distance to refine the neighbors");
+	}
+	state.src.reserve(cqr.cellCount());
+	for(auto it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		checkCellId(it.cellId());
+		state.src.push_back(it.cellId());
+		state.isSrc[it.cellId()] = 1;
+	}
+	threadCount = std::max<uint32_t>(1, std::min<uint32_t>(threadCount, (uint32_t) state.src.size()));
+	if (threadCount == 1) {
+		Worker worker(&state);
+		worker();
+	}
+	else {
+		sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	std::vector<uint32_t> result;
+	for(uint32_t cellId(0), s(cellCount()); cellId < s; ++cellId) {
+		if (state.result[cellId]) {
+			result.push_back(cellId);
+		}
+	}
+	return sserialize::ItemIndex(std::move(result));
+}
+
+void CellNeighborLadder::create(
+	const CellDistance & cd,
+	uint8_t cellDistanceType,
+	const CellCenterIndex & cci,
+	std::vector<uint32_t> radii,
+	sserialize::UByteArrayAdapter & dest,
+	uint32_t threadCount)
+{
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	std::sort(radii.begin(), radii.end());
+	radii.erase(std::unique(radii.begin(), radii.end()), radii.end());
+	if (!radii.size() || radii.size() > MaxRungCount) {
+		throw sserialize::UnsupportedFeatureException("liboscar::CellNeighborLadder: the number of radii has to be in [1, " + std::to_string(MaxRungCount) + "]");
+	}
+	///(rung << 32) | cellId, hence sorting orders by rung and cell id
+	typedef std::vector<uint64_t> Neighbors;
+	struct State {
+		const CellDistance & cd;
+		const CellCenterIndex & cci;
+		const std::vector<uint32_t> & radii;
+		double candidateDistance;
+		uint32_t begin;
+		uint32_t end;
+		std::atomic<uint32_t> pos{0};
+		std::vector<Neighbors> block;
+		State(const CellDistance & cd, const CellCenterIndex & cci, const std::vector<uint32_t> & radii) :
+		cd(cd), cci(cci), radii(radii), candidateDistance(1.01*radii.back()+100.0),
+		begin(0), end(0), block(CreateBlockSize)
+		{}
+	};
+	struct Worker {
+		State * state;
+		std::vector<uint32_t> candidates;
+		std::vector<double> dists;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			while(true) {
+				uint32_t cellId = state->pos.fetch_add(1, std::memory_order_relaxed);
+				if (cellId >= state->end) {
+					break;
+				}
+				process(cellId);
+			}
+		}
+		void process(uint32_t cellId) {
+			Neighbors & nb = state->block.at(cellId - state->begin);
+			nb.clear();
+			candidates.clear();
+			state->cci.cellsWithin(cellId, state->candidateDistance, candidates);
+			candidates.erase(std::remove(candidates.begin(), candidates.end(), cellId), candidates.end());
+			distances(state->cd, cellId, candidates, dists);
+			for(std::size_t i(0), s(candidates.size()); i < s; ++i) {
+				uint32_t nId = candidates[i];
+				double d = dists[i];
+				if (d > state->radii.back()) {
+					continue;
+				}
+				auto it = std::lower_bound(state->radii.begin(), state->radii.end(), d, [](uint32_t r, double d) { return r < d; });
+				nb.push_back( (uint64_t(it - state->radii.begin()) << 32) | nId );
+			}
+			std::sort(nb.begin(), nb.end());
+		}
+	};
+
+	uint32_t cellCount = cci.cellCount();
+	uint32_t rungCount = (uint32_t) radii.size();
+	dest.putUint8(LIBOSCAR_CELL_NEIGHBOR_LADDER_VERSION);
+	dest.putUint8(cellDistanceType);
+	dest.putUint8(rungCount);
+	for(uint32_t r : radii) {
+		dest.putUint32(r);
+	}
+	dest.putUint32(cellCount);
+	OffsetType offsetsBegin = dest.tellPutPtr();
+	for(uint32_t i(0); i <= cellCount; ++i) {
+		dest.putUint64(0);
+	}
+	OffsetType listsBegin = dest.tellPutPtr();
+
+	State state(cd, cci, radii);
+	for(uint32_t blockBegin(0); blockBegin < cellCount; blockBegin += CreateBlockSize) {
+		state.begin = blockBegin;
+		state.end = std::min<uint32_t>(cellCount, blockBegin+CreateBlockSize);
+		state.pos = blockBegin;
+		if (threadCount <= 1) {
+			Worker worker(&state);
+			worker();
+		}
+		else {
+			sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+		}
+		for(uint32_t cellId(state.begin); cellId < state.end; ++cellId) {
+			const Neighbors & nb = state.block[cellId - state.begin];
+			auto it = nb.begin();
+			for(uint32_t r(0); r < rungCount; ++r) {
+				auto rungEnd = std::find_if(it, nb.end(), [r](uint64_t x) { return (x >> 32) != r; });
+				dest.putVlPackedUint32(uint32_t(rungEnd - it));
+				uint32_t prev = 0;
+				for(; it != rungEnd; ++it) {
+					uint32_t nId = uint32_t(*it);
+					dest.putVlPackedUint32(nId - prev);
+					prev = nId;
+				}
+			}
+			dest.putUint64(offsetsBegin + OffsetType(cellId+1)*8, dest.tellPutPtr() - listsBegin);
+		}
+	}
+}
+
+}//end namespace liboscar
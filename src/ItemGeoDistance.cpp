@@ -0,0 +1,326 @@
+#include <liboscar/ItemGeoDistance.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace liboscar {
+namespace {
+
+constexpr double MetersPerDegree = 6371000.0*M_PI/180.0;
+
+///difference of two longitudes in [-180, 180]
+double lonDelta(double from, double to) {
+	double d = to - from;
+	if (d > 180.0) {
+		d -= 360.0;
+	}
+	else if (d < -180.0) {
+		d += 360.0;
+	}
+	return d;
+}
+
+///gap between the longitude ranges of two boxes, 0 if they overlap
+double lonGap(double minLon1, double maxLon1, double minLon2, double maxLon2) {
+	if (maxLon1 >= minLon2 && maxLon2 >= minLon1) {
+		return 0.0;
+	}
+	return std::min(std::abs(lonDelta(maxLon1, minLon2)), std::abs(lonDelta(maxLon2, minLon1)));
+}
+
+double latGap(double minLat1, double maxLat1, double minLat2, double maxLat2) {
+	if (maxLat1 < minLat2) {
+		return minLat2 - maxLat1;
+	}
+	else if (maxLat2 < minLat1) {
+		return minLat1 - maxLat2;
+	}
+	return 0.0;
+}
+
+} //end namespace
+
+ItemGeoDistance::ItemGeoDistance(const sserialize::spatial::GeoPoint & origin) :
+m_origin(origin),
+m_lonScale(std::cos(origin.lat()*M_PI/180.0))
+{}
+
+ItemGeoDistance::~ItemGeoDistance() {}
+
+ItemGeoDistance::Point2D ItemGeoDistance::project(const sserialize::spatial::GeoPoint & p) const {
+	return Point2D{
+		lonDelta(m_origin.lon(), p.lon())*MetersPerDegree*m_lonScale,
+		(p.lat() - m_origin.lat())*MetersPerDegree
+	};
+}
+
+double ItemGeoDistance::distance(const sserialize::spatial::GeoPoint & p) const {
+	Point2D pp = project(p);
+	return std::sqrt(pp.x*pp.x + pp.y*pp.y);
+}
+
+double ItemGeoDistance::distance(const sserialize::spatial::GeoRect & rect) const {
+	double y = latGap(m_origin.lat(), m_origin.lat(), rect.minLat(), rect.maxLat())*MetersPerDegree;
+	double x = lonGap(m_origin.lon(), m_origin.lon(), rect.minLon(), rect.maxLon())*MetersPerDegree*m_lonScale;
+	return std::sqrt(x*x + y*y);
+}
+
+double ItemGeoDistance::distance(const sserialize::spatial::GeoPoint & a, const sserialize::spatial::GeoPoint & b) const {
+	return segmentDistance(Point2D{0.0, 0.0}, project(a), project(b));
+}
+
+double ItemGeoDistance::distance(const sserialize::Static::spatial::GeoShape & shape) const {
+	if (isPolygonal(shape) && contains(shape, m_origin)) {
+		return 0.0;
+	}
+	std::vector<Chain> tmp;
+	chains(shape, tmp);
+	double result = std::numeric_limits<double>::max();
+	Point2D o{0.0, 0.0};
+	for(const Chain & c : tmp) {
+		if (c.size() == 1) {
+			result = std::min(result, segmentDistance(o, c.front(), c.front()));
+		}
+		for(std::size_t i(1), s(c.size()); i < s; ++i) {
+			result = std::min(result, segmentDistance(o, c[i-1], c[i]));
+		}
+	}
+	return result;
+}
+
+double ItemGeoDistance::distance(const sserialize::spatial::GeoRect & rect1, const sserialize::spatial::GeoRect & rect2) {
+	//the smallest longitude scale of both boxes keeps this a lower bound for any projection center within them
+	double maxAbsLat = std::min<double>(90.0, std::max(
+		std::max(std::abs(rect1.minLat()), std::abs(rect1.maxLat())),
+		std::max(std::abs(rect2.minLat()), std::abs(rect2.maxLat()))
+	));
+	double y = latGap(rect1.minLat(), rect1.maxLat(), rect2.minLat(), rect2.maxLat())*MetersPerDegree;
+	double x = lonGap(rect1.minLon(), rect1.maxLon(), rect2.minLon(), rect2.maxLon())*MetersPerDegree*std::cos(maxAbsLat*M_PI/180.0);
+	return std::sqrt(x*x + y*y);
+}
+
+bool ItemGeoDistance::withinDistance(const sserialize::Static::spatial::GeoShape & shape1, const sserialize::Static::spatial::GeoShape & shape2, double maxDistance) {
+	//the distance of the bounding boxes is a lower bound, this rejects most candidate pairs without decoding the shapes
+	if (distance(shape1.boundary(), shape2.boundary()) > maxDistance) {
+		return false;
+	}
+	sserialize::spatial::GeoPoint p1, p2;
+	if (!firstPoint(shape1, p1) || !firstPoint(shape2, p2)) {
+		return false;
+	}
+	if ((isPolygonal(shape2) && contains(shape2, p1)) || (isPolygonal(shape1) && contains(shape1, p2))) {
+		return true;
+	}
+	ItemGeoDistance igd(p1);
+	std::vector<Chain> chains1, chains2;
+	igd.chains(shape1, chains1);
+	igd.chains(shape2, chains2);
+	//consecutive segments of a chain with their bounding box, pairs of pieces whose boxes are too far apart are skipped
+	struct Piece {
+		const Chain * chain;
+		std::size_t begin;
+		std::size_t end;
+		Point2D min;
+		Point2D max;
+	};
+	constexpr std::size_t PieceSize = 16;
+	auto pieces = [](const std::vector<Chain> & chains, std::vector<Piece> & dest) {
+		for(const Chain & c : chains) {
+			//a single point is a segment of length 0
+			std::size_t segmentCount = (c.size() > 1 ? c.size()-1 : c.size());
+			for(std::size_t begin(0); begin < segmentCount; begin += PieceSize) {
+				Piece p{&c, begin, std::min(segmentCount, begin+PieceSize), c[begin], c[begin]};
+				for(std::size_t i(begin), s(std::min(c.size(), p.end+1)); i < s; ++i) {
+					p.min.x = std::min(p.min.x, c[i].x);
+					p.min.y = std::min(p.min.y, c[i].y);
+					p.max.x = std::max(p.max.x, c[i].x);
+					p.max.y = std::max(p.max.y, c[i].y);
+				}
+				dest.push_back(p);
+			}
+		}
+	};
+	auto boxDistance = [](const Piece & a, const Piece & b) {
+		double x = std::max<double>(0.0, std::max(a.min.x - b.max.x, b.min.x - a.max.x));
+		double y = std::max<double>(0.0, std::max(a.min.y - b.max.y, b.min.y - a.max.y));
+		return std::sqrt(x*x + y*y);
+	};
+	auto segment = [](const Chain & c, std::size_t i) -> std::pair<const Point2D&, const Point2D&> {
+		return c.size() > 1 ? std::pair<const Point2D&, const Point2D&>(c[i], c[i+1]) : std::pair<const Point2D&, const Point2D&>(c[0], c[0]);
+	};
+	std::vector<Piece> pieces1, pieces2;
+	pieces(chains1, pieces1);
+	pieces(chains2, pieces2);
+	for(const Piece & a : pieces1) {
+		for(const Piece & b : pieces2) {
+			if (boxDistance(a, b) > maxDistance) {
+				continue;
+			}
+			for(std::size_t i(a.begin); i < a.end; ++i) {
+				auto s1 = segment(*a.chain, i);
+				for(std::size_t j(b.begin); j < b.end; ++j) {
+					auto s2 = segment(*b.chain, j);
+					if (segmentDistance(s1.first, s1.second, s2.first, s2.second) <= maxDistance) {
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+double ItemGeoDistance::convexPolygonDistance(const std::vector<sserialize::spatial::GeoPoint> & poly1, const std::vector<sserialize::spatial::GeoPoint> & poly2) {
+	if (!poly1.size() || !poly2.size()) {
+		return std::numeric_limits<double>::max();
+	}
+	//the projection is affine in lat/lon, hence the polygons stay convex
+	ItemGeoDistance igd(poly1.front());
+	Chain c1, c2;
+	for(const sserialize::spatial::GeoPoint & x : poly1) {
+		c1.push_back(igd.project(x));
+	}
+	for(const sserialize::spatial::GeoPoint & x : poly2) {
+		c2.push_back(igd.project(x));
+	}
+	if (convexContains(c1, c2.front()) || convexContains(c2, c1.front())) {
+		return 0.0;
+	}
+	double result = std::numeric_limits<double>::max();
+	for(std::size_t i(0), is(c1.size()); i < is; ++i) {
+		const Point2D & a1 = c1[i];
+		const Point2D & a2 = c1[(i+1)%is];
+		for(std::size_t j(0), js(c2.size()); j < js; ++j) {
+			result = std::min(result, segmentDistance(a1, a2, c2[j], c2[(j+1)%js]));
+		}
+	}
+	return result;
+}
+
+bool ItemGeoDistance::convexContains(const Chain & poly, const Point2D & p) {
+	if (poly.size() < 3) {
+		return false;
+	}
+	int sign = 0;
+	for(std::size_t i(0), s(poly.size()); i < s; ++i) {
+		const Point2D & a = poly[i];
+		const Point2D & b = poly[(i+1)%s];
+		double v = (b.x-a.x)*(p.y-a.y) - (b.y-a.y)*(p.x-a.x);
+		int vs = (v > 0.0) - (v < 0.0);
+		if (vs && sign && vs != sign) {
+			return false;
+		}
+		if (vs) {
+			sign = vs;
+		}
+	}
+	//degenerate polygons are handled by the segment distances
+	return sign != 0;
+}
+
+void ItemGeoDistance::chains(const sserialize::Static::spatial::GeoShape & shape, std::vector<Chain> & dest) const {
+	auto addChain = [this, &dest](const auto & points, bool closed) {
+		dest.emplace_back();
+		Chain & c = dest.back();
+		for(sserialize::spatial::GeoPoint x : points) {
+			c.push_back(project(x));
+		}
+		if (closed && c.size() > 1 && (c.front().x != c.back().x || c.front().y != c.back().y)) {
+			c.push_back(c.front());
+		}
+	};
+	switch (shape.type()) {
+	case sserialize::spatial::GS_POINT:
+		dest.emplace_back(1, project(*shape.get<sserialize::spatial::GS_POINT>()));
+		break;
+	case sserialize::spatial::GS_WAY:
+		addChain(*shape.get<sserialize::spatial::GS_WAY>(), false);
+		break;
+	case sserialize::spatial::GS_POLYGON:
+		addChain(*shape.get<sserialize::spatial::GS_POLYGON>(), true);
+		break;
+	case sserialize::spatial::GS_MULTI_POLYGON:
+	{
+		auto gmp = shape.get<sserialize::spatial::GS_MULTI_POLYGON>();
+		for(uint32_t i(0), s((uint32_t) gmp->outerPolygons().size()); i < s; ++i) {
+			addChain(gmp->outerPolygons().at(i), true);
+		}
+		for(uint32_t i(0), s((uint32_t) gmp->innerPolygons().size()); i < s; ++i) {
+			addChain(gmp->innerPolygons().at(i), true);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+double ItemGeoDistance::segmentDistance(const Point2D & p, const Point2D & a, const Point2D & b) {
+	double dx = b.x - a.x, dy = b.y - a.y;
+	double len2 = dx*dx + dy*dy;
+	double t = 0.0;
+	if (len2 > 0.0) {
+		t = std::max<double>(0.0, std::min<double>(1.0, ((p.x-a.x)*dx + (p.y-a.y)*dy)/len2));
+	}
+	double x = a.x + t*dx - p.x, y = a.y + t*dy - p.y;
+	return std::sqrt(x*x + y*y);
+}
+
+double ItemGeoDistance::segmentDistance(const Point2D & a1, const Point2D & a2, const Point2D & b1, const Point2D & b2) {
+	auto orientation = [](const Point2D & p, const Point2D & q, const Point2D & r) {
+		double v = (q.x-p.x)*(r.y-p.y) - (q.y-p.y)*(r.x-p.x);
+		return (v > 0.0) - (v < 0.0);
+	};
+	//proper crossings, touching segments are handled by the endpoint distances
+	int o1 = orientation(a1, a2, b1), o2 = orientation(a1, a2, b2);
+	int o3 = orientation(b1, b2, a1), o4 = orientation(b1, b2, a2);
+	if (o1*o2 < 0 && o3*o4 < 0) {
+		return 0.0;
+	}
+	return std::min(
+		std::min(segmentDistance(a1, b1, b2), segmentDistance(a2, b1, b2)),
+		std::min(segmentDistance(b1, a1, a2), segmentDistance(b2, a1, a2))
+	);
+}
+
+bool ItemGeoDistance::isPolygonal(const sserialize::Static::spatial::GeoShape & shape) {
+	return shape.type() == sserialize::spatial::GS_POLYGON || shape.type() == sserialize::spatial::GS_MULTI_POLYGON;
+}
+
+bool ItemGeoDistance::contains(const sserialize::Static::spatial::GeoShape & shape, const sserialize::spatial::GeoPoint & p) {
+	if (shape.type() == sserialize::spatial::GS_POLYGON) {
+		return shape.get<sserialize::spatial::GS_POLYGON>()->contains(p);
+	}
+	else if (shape.type() == sserialize::spatial::GS_MULTI_POLYGON) {
+		return shape.get<sserialize::spatial::GS_MULTI_POLYGON>()->contains(p);
+	}
+	return false;
+}
+
+bool ItemGeoDistance::firstPoint(const sserialize::Static::spatial::GeoShape & shape, sserialize::spatial::GeoPoint & p) {
+	auto first = [&p](const auto & points) -> bool {
+		for(sserialize::spatial::GeoPoint x : points) {
+			p = x;
+			return true;
+		}
+		return false;
+	};
+	switch (shape.type()) {
+	case sserialize::spatial::GS_POINT:
+		p = *shape.get<sserialize::spatial::GS_POINT>();
+		return true;
+	case sserialize::spatial::GS_WAY:
+		return first(*shape.get<sserialize::spatial::GS_WAY>());
+	case sserialize::spatial::GS_POLYGON:
+		return first(*shape.get<sserialize::spatial::GS_POLYGON>());
+	case sserialize::spatial::GS_MULTI_POLYGON:
+	{
+		auto gmp = shape.get<sserialize::spatial::GS_MULTI_POLYGON>();
+		return gmp->outerPolygons().size() && first(gmp->outerPolygons().at(0));
+	}
+	default:
+		return false;
+	}
+}
+
+}//end namespace liboscar
@@ -0,0 +1,44 @@
+#include <liboscar/KVStatsSession.h>
+
+namespace liboscar {
+
+KVStatsSession::KVStatsSession(const KVStats & kvstats) :
+m_kvstats(kvstats),
+m_valid(false),
+m_lastWasIncremental(false)
+{}
+
+KVStatsSession::~KVStatsSession() {}
+
+KVStatsSession::Stats KVStatsSession::stats(const sserialize::ItemIndex & items, uint32_t threadCount) {
+	m_lastWasIncremental = false;
+	if (m_valid) {
+		sserialize::ItemIndex removed = m_items - items;
+		sserialize::ItemIndex added = items - m_items;
+		//both ways decode items, updating additionally needs two linear sweeps over the pairs
+		if (removed.size() + added.size() < items.size()) {
+			if (removed.size()) {
+				m_data = detail::KVStats::SortedData::subtract(std::move(m_data), m_kvstats.data(removed, threadCount));
+			}
+			if (added.size()) {
+				m_data = detail::KVStats::SortedData::merge(std::move(m_data), m_kvstats.data(added, threadCount));
+			}
+			m_lastWasIncremental = true;
+		}
+	}
+	if (!m_lastWasIncremental) {
+		m_data = m_kvstats.data(items, threadCount);
+	}
+	m_items = items;
+	m_valid = true;
+	return m_kvstats.stats(detail::KVStats::SortedData(m_data));
+}
+
+void KVStatsSession::reset() {
+	m_items = sserialize::ItemIndex();
+	m_data = detail::KVStats::SortedData();
+	m_valid = false;
+	m_lastWasIncremental = false;
+}
+
+}//end namespace liboscar
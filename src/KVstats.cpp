@@ -1,5 +1,9 @@
 #include <liboscar/KVStats.h>
 #include <sserialize/mt/ThreadPool.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
 
 
 namespace liboscar {
@@ -8,17 +12,6 @@ namespace KVStats {
 	
 SortedData::SortedData() {}
 
-SortedData::SortedData(Data && other) :
-keyValueCount(other.keyValueCount.begin(), other.keyValueCount.end()) 
-{
-	if (!std::is_same<Data::KeyValueCountMap, Data::KeyValueCountSortedMap>::value) {
-		std::sort(keyValueCount.begin(), keyValueCount.end(), [](const KeyValueCount & a, const KeyValueCount & b) {
-			return a.first < b.first;
-		});
-	}
-	other.keyValueCount.clear();
-}
-
 SortedData::SortedData(SortedData && other) :
 keyValueCount(std::move(other.keyValueCount))
 {}
@@ -55,34 +48,22 @@ SortedData SortedData::merge(SortedData && first, SortedData && second) {
 	return result;
 }
 
-Data::Data() {}
-
-Data::Data(Data && other) : keyValueCount(std::move(other.keyValueCount)) {}
-
-Data & Data::operator=(Data && other) {
-	keyValueCount = std::move(other.keyValueCount);
-	return *this;
-}
-
-void Data::update(const Static::OsmKeyValueObjectStore::KVItemBase & item) {
-	for (uint32_t i(0), s(item.size()); i < s; ++i) {
-		uint32_t key = item.keyId(i);
-		uint32_t value = item.valueId(i);
-		++(keyValueCount[std::make_pair(key, value)]); //init to 0 if not existent
-	}
-}
-
-Data Data::merge(Data && first, Data && second) {
-	if (first.keyValueCount.size() < second.keyValueCount.size()) {
-		return merge(std::move(second), std::move(first));
-	}
-	if (!second.keyValueCount.size()) {
-		return std::move(first);
-	}
-	
-	for(const auto & x : second.keyValueCount) {
-		first.keyValueCount[x.first] += x.second; 
+SortedData SortedData::subtract(SortedData && first, SortedData && second) {
+	auto sit(second.keyValueCount.begin()), send(second.keyValueCount.end());
+	auto dest = first.keyValueCount.begin();
+	for(auto fit(first.keyValueCount.begin()), fend(first.keyValueCount.end()); fit != fend; ++fit) {
+		SSERIALIZE_CHEAP_ASSERT(sit == send || !(sit->first < fit->first));
+		if (sit != send && sit->first == fit->first) {
+			SSERIALIZE_CHEAP_ASSERT_SMALLER_OR_EQUAL(sit->second, fit->second);
+			fit->second -= std::min(sit->second, fit->second);
+			++sit;
+		}
+		if (fit->second) {
+			*dest = *fit;
+			++dest;
+		}
 	}
+	first.keyValueCount.resize(dest - first.keyValueCount.begin());
 	second.keyValueCount.clear();
 	return std::move(first);
 }
@@ -99,47 +80,185 @@ store(store),
 items(items)
 {}
 
+template<typename T_WORKER>
+void State::execute(uint32_t threadCount) {
+	taskPos = 0;
+	if (threadCount == 1) {
+		T_WORKER worker(this);
+		worker();
+	}
+	else {
+		sserialize::ThreadPool::execute(T_WORKER(this), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+}
+
+void State::run(uint32_t threadCount) {
+	threadCount = std::max<uint32_t>(1, threadCount);
+	collected.resize(threadCount);
+	execute<Worker>(threadCount);
+	
+	//a few partitions per thread even out partitions of different size
+	uint32_t partitionCount = (threadCount > 1 ? 4*threadCount : 1);
+	sampleSplitters(partitionCount);
+	partitionCount = uint32_t(splitters.size()+1);
+	d.resize(partitionCount);
+	execute<ReduceWorker>(std::min<uint32_t>(threadCount, partitionCount));
+	collected.clear();
+}
+
+State::DataType State::result() {
+	DataType result;
+	if (d.size() == 1) {
+		result = std::move(d.front());
+	}
+	else {
+		std::size_t size = 0;
+		for(const DataType & x : d) {
+			size += x.keyValueCount.size();
+		}
+		result.keyValueCount.reserve(size);
+		for(DataType & x : d) {
+			result.keyValueCount.insert(result.keyValueCount.end(), x.keyValueCount.begin(), x.keyValueCount.end());
+			x.keyValueCount = DataType::KeyValueCountContainer();
+		}
+	}
+	d.clear();
+	return result;
+}
+
+void State::sampleSplitters(uint32_t partitionCount) {
+	constexpr std::size_t SamplesPerWorker = 1024;
+	splitters.clear();
+	if (partitionCount < 2) {
+		return;
+	}
+	std::vector<uint64_t> samples;
+	for(const PairCounts & p : collected) {
+		std::size_t step = std::max<std::size_t>(1, p.size()/SamplesPerWorker);
+		for(std::size_t i(0), s(p.size()); i < s; i += step) {
+			samples.push_back(p[i].first);
+		}
+	}
+	if (samples.size() < partitionCount) {
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	for(uint32_t i(1); i < partitionCount; ++i) {
+		splitters.push_back(samples[samples.size()*i/partitionCount]);
+	}
+	splitters.erase(std::unique(splitters.begin(), splitters.end()), splitters.end());
+}
 
 Worker::Worker(State * state) : state(state) {}
 
 Worker::Worker(const Worker & other) : state(other.state) {}
 
 void Worker::operator()() {
+	pairs = &state->collected.at(state->taskPos.fetch_add(1, std::memory_order_relaxed));
+	if (state->histograms) {
+		while (true) {
+			std::size_t p = state->cellPos.fetch_add(1, std::memory_order_relaxed);
+			if (p >= state->cells.size()) {
+				break;
+			}
+			state->histograms->visit(state->cells[p], [this](uint32_t keyId, uint32_t valueId, uint32_t count) {
+				pairs->emplace_back(packKeyValue(keyId, valueId), count);
+			});
+			compact(false);
+		}
+	}
 	std::size_t size = state->items.size();
+	buffer.reserve(std::min<std::size_t>(FlushSize, size*8));
 	while (true) {
 		std::size_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
-		if (p >= state->items.size()) {
+		if (p >= size) {
 			break;
 		}
 		for(std::size_t i(0); i < BlockSize && p < size; ++i, ++p) {
-			uint32_t itemId = state->items.at(p);
-			d.update( state->store.kvBaseItem(itemId) );
+			auto item = state->store.kvBaseItem( state->items.at(p) );
+			for (uint32_t j(0), sj(item.size()); j < sj; ++j) {
+				buffer.push_back( packKeyValue(item.keyId(j), item.valueId(j)) );
+			}
 		}
-		if (d.keyValueCount.size() > FlushSize) {
+		if (buffer.size() >= FlushSize) {
 			flush();
 		}
 	}
 	flush();
+	compact(true);
 }
 
 void Worker::flush() {
-	State::DataType sd(std::move(d));
-	std::unique_lock<std::mutex> lck(state->lock, std::defer_lock);
-	while(true) {
-		lck.lock();
-		state->d.emplace_back(std::move(sd));
-		if (state->d.size() < 2) {
+	std::sort(buffer.begin(), buffer.end());
+	for(auto it(buffer.begin()), end(buffer.end()); it != end;) {
+		auto runEnd = std::upper_bound(it, end, *it);
+		pairs->emplace_back(*it, uint32_t(runEnd - it));
+		it = runEnd;
+	}
+	buffer.clear();
+	compact(false);
+}
+
+void Worker::compact(bool force) {
+	if (!force && pairs->size() < std::max<std::size_t>(FlushSize, 2*compactedSize)) {
+		return;
+	}
+	std::sort(pairs->begin(), pairs->end());
+	auto dest = pairs->begin();
+	for(auto it(pairs->begin()), end(pairs->end()); it != end; ++it) {
+		if (dest != pairs->begin() && (dest-1)->first == it->first) {
+			(dest-1)->second += it->second;
+		}
+		else {
+			*dest = *it;
+			++dest;
+		}
+	}
+	pairs->resize(dest - pairs->begin());
+	compactedSize = pairs->size();
+}
+
+ReduceWorker::ReduceWorker(State * state) : state(state) {}
+
+ReduceWorker::ReduceWorker(const ReduceWorker & other) : state(other.state) {}
+
+void ReduceWorker::operator()() {
+	while (true) {
+		uint32_t partition = state->taskPos.fetch_add(1, std::memory_order_relaxed);
+		if (partition >= state->d.size()) {
 			break;
 		}
-		auto first = std::move(state->d.back());
-		state->d.pop_back();
-		auto second = std::move(state->d.back());
-		state->d.pop_back();
-		lck.unlock();
-		sd = State::DataType::merge(std::move(first), std::move(second));
+		reduce(partition);
 	}
 }
 
+void ReduceWorker::reduce(uint32_t partition) {
+	using KeyValueCount = State::DataType::KeyValueCount;
+	const std::vector<uint64_t> & splitters = state->splitters;
+	auto pairLess = [](const std::pair<uint64_t, uint32_t> & a, uint64_t b) { return a.first < b; };
+	//the pairs of every worker are sorted, select the range of the partition
+	PairCounts pairs;
+	for(const PairCounts & x : state->collected) {
+		auto begin = (partition ? std::lower_bound(x.begin(), x.end(), splitters[partition-1], pairLess) : x.begin());
+		auto end = (partition < splitters.size() ? std::lower_bound(begin, x.end(), splitters[partition], pairLess) : x.end());
+		pairs.insert(pairs.end(), begin, end);
+	}
+	if (state->collected.size() > 1) {
+		std::sort(pairs.begin(), pairs.end());
+	}
+	auto toKeyValue = [](uint64_t kv) {
+		return std::make_pair(uint32_t(kv >> 32), uint32_t(kv));
+	};
+	State::DataType::KeyValueCountContainer & dest = state->d.at(partition).keyValueCount;
+	for(const auto & x : pairs) {
+		if (dest.size() && dest.back().first == toKeyValue(x.first)) {
+			dest.back().second += x.second;
+		}
+		else {
+			dest.emplace_back(KeyValueCount(toKeyValue(x.first), x.second));
+		}
+	}
+}
 
 Stats::Stats(std::unique_ptr<std::vector<ValueInfo>> && valueInfoStore, std::vector<KeyInfo> && keyInfoStore, std::unordered_map<uint32_t, KeyInfoPtr> && keyInfo) :
 m_valueInfoStore(std::move(valueInfoStore)),
@@ -150,16 +269,56 @@ m_keyInfo(std::move(keyInfo))
 Stats::Stats(Stats && other) :
 m_valueInfoStore(std::move(other.m_valueInfoStore)),
 m_keyInfoStore(std::move(other.m_keyInfoStore)),
-m_keyInfo(std::move(other.m_keyInfo))
+m_keyInfo(std::move(other.m_keyInfo)),
+m_approximate(other.m_approximate),
+m_sampleSize(other.m_sampleSize),
+m_populationSize(other.m_populationSize)
 {}
 
 Stats & Stats::operator=(Stats && other) {
 	m_valueInfoStore = std::move(other.m_valueInfoStore);
 	m_keyInfoStore = std::move(other.m_keyInfoStore);
 	m_keyInfo = std::move(other.m_keyInfo);
+	m_approximate = other.m_approximate;
+	m_sampleSize = other.m_sampleSize;
+	m_populationSize = other.m_populationSize;
 	return *this;
 }
 
+CountInterval Stats::interval(uint32_t count, double z) const {
+	CountInterval result;
+	if (!m_approximate) {
+		result.lower = count;
+		result.upper = count;
+		return result;
+	}
+	double N = m_populationSize;
+	double n = m_sampleSize;
+	if (!m_sampleSize) {
+		result.upper = uint32_t( std::min<double>(N, std::numeric_limits<uint32_t>::max()) );
+		return result;
+	}
+	//sampling without replacement: the finite population correction shrinks the variance
+	double fpc = N > 1 ? std::max<double>(0, (N-n)/(N-1)) : 0;
+	if (fpc <= 0) {
+		result.lower = count;
+		result.upper = count;
+		return result;
+	}
+	double neff = n / fpc;
+	double p = N > 0 ? std::min<double>(1, count/N) : 0;
+	double z2 = z*z;
+	double denom = 1 + z2/neff;
+	double center = (p + z2/(2*neff)) / denom;
+	double half = z/denom * std::sqrt(p*(1-p)/neff + z2/(4*neff*neff));
+	double maxCount = std::numeric_limits<uint32_t>::max();
+	result.lower = uint32_t( std::min<double>(maxCount, std::floor(std::max<double>(0, center-half)*N)) );
+	result.upper = uint32_t( std::min<double>(maxCount, std::ceil(std::min<double>(1, center+half)*N)) );
+	result.lower = std::min(result.lower, count);
+	result.upper = std::max(result.upper, count);
+	return result;
+}
+
 
 Stats::KeyInfo & Stats::key(uint32_t keyId) {
 	return m_keyInfoStore.at( m_keyInfo.at(keyId).offset );
@@ -200,62 +359,172 @@ KVStats::KVStats(const Static::OsmKeyValueObjectStore & store) :
 m_store(store)
 {}
 
+KVStats::KVStats(const Static::OsmKeyValueObjectStore & store, const CellKVHistograms & histograms) :
+m_store(store),
+m_histograms(histograms)
+{}
+
 KVStats::Stats KVStats::stats(const sserialize::ItemIndex & items, uint32_t threadCount) {
+	return stats(data(items, threadCount));
+}
+
+KVStats::Stats KVStats::stats(const sserialize::ItemIndex & items, const Approximation & approx, uint32_t threadCount) {
+	uint64_t m = sampleSize(approx, threadCount);
+	if (items.size() <= m) {
+		return stats(items, threadCount);
+	}
+	if (items.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
+		return stats( sserialize::ItemIndex( items.toVector() ), approx, threadCount);
+	}
+	//Floyd's algorithm draws a uniform subset of m positions
+	uint32_t n = items.size();
+	std::mt19937_64 rng(approx.seed);
+	std::unordered_set<uint32_t> positions;
+	positions.reserve(m);
+	for(uint32_t j(n-uint32_t(m)); j < n; ++j) {
+		uint32_t t = std::uniform_int_distribution<uint32_t>(0, j)(rng);
+		if (!positions.insert(t).second) {
+			positions.insert(j);
+		}
+	}
+	std::vector<uint32_t> sample(positions.begin(), positions.end());
+	std::sort(sample.begin(), sample.end());
+	for(uint32_t & x : sample) {
+		x = items.at(x);
+	}
+	return stats(data(sserialize::ItemIndex(std::move(sample)), threadCount), m, n);
+}
+
+KVStats::Stats KVStats::stats(const sserialize::CellQueryResult & cqr, const Approximation & approx, uint32_t threadCount) {
+	if (approx.sampling == Approximation::S_UNIFORM) {
+		return stats(cqr.flaten(threadCount), approx, threadCount);
+	}
+	constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+	uint64_t m = sampleSize(approx, threadCount);
+	//cellPos[cellId] is the position of cellId in cqr
+	std::vector<uint32_t> cellPos(m_store.geoHierarchy().cellSize(), npos);
+	std::vector<uint32_t> cellIds;
+	std::vector<uint8_t> fullMatch;
+	std::vector<sserialize::ItemIndex> cellItems;
+	uint64_t total = 0;
+	for(auto it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		cellPos.at(it.cellId()) = uint32_t(cellIds.size());
+		cellIds.push_back(it.cellId());
+		fullMatch.push_back(it.fullMatch());
+		sserialize::ItemIndex idx( it.idx() );
+		if (idx.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
+			idx = sserialize::ItemIndex( idx.toVector() );
+		}
+		total += idx.size();
+		cellItems.emplace_back(std::move(idx));
+	}
+	if (total <= m) {
+		return stats(cqr, threadCount);
+	}
+	//A systematic sample of the concatenated items of all cells samples every cell in proportion to its size.
+	//Every entry is sampled with probability 1/stride.
+	//An item that is part of multiple cells is only counted in the first cell of cqr that contains it,
+	//hence every item is sampled with probability 1/stride as well.
+	double stride = double(total)/m;
+	std::mt19937_64 rng(approx.seed);
+	double t = std::uniform_real_distribution<double>(0, stride)(rng);
+	std::vector<uint32_t> sample;
+	sample.reserve(m);
+	uint64_t offset = 0;
+	for(uint32_t i(0), s(uint32_t(cellIds.size())); i < s; ++i) {
+		const sserialize::ItemIndex & idx = cellItems[i];
+		for(; t < double(offset + idx.size()); t += stride) {
+			uint32_t itemId = idx.at(uint32_t(t - offset));
+			bool first = true;
+			for(uint32_t cellId : m_store.cells(itemId)) {
+				if (cellId >= cellIds[i] || cellId >= cellPos.size() || cellPos[cellId] == npos) {
+					continue;
+				}
+				uint32_t pos = cellPos[cellId];
+				if (fullMatch[pos] || cellItems[pos].count(itemId)) {
+					first = false;
+					break;
+				}
+			}
+			if (first) {
+				sample.push_back(itemId);
+			}
+		}
+		offset += idx.size();
+	}
+	std::sort(sample.begin(), sample.end());
+	uint64_t sampleSize = sample.size();
+	return stats(data(sserialize::ItemIndex(std::move(sample)), threadCount), sampleSize, sampleSize*stride);
+}
+
+uint64_t KVStats::sampleSize(const Approximation & approx, uint32_t threadCount) {
+	///we can process about 1k items per ms per thread
+	return std::max<uint64_t>(1, uint64_t(approx.budget)*1000*std::max<uint32_t>(1, threadCount));
+}
+
+KVStats::Stats KVStats::stats(detail::KVStats::SortedData && sample, uint64_t sampleSize, double populationSize) {
+	if (sampleSize) {
+		double scale = populationSize/sampleSize;
+		for(auto & x : sample.keyValueCount) {
+			x.second = uint32_t( std::min<double>(std::numeric_limits<uint32_t>::max(), std::round(x.second*scale)) );
+		}
+	}
+	Stats result = stats(std::move(sample));
+	result.m_approximate = true;
+	result.m_sampleSize = sampleSize;
+	result.m_populationSize = populationSize;
+	return result;
+}
+
+detail::KVStats::SortedData KVStats::data(const sserialize::ItemIndex & items, uint32_t threadCount) {
 	if (items.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
-		return stats( sserialize::ItemIndex( items.toVector() ), threadCount);
+		return data( sserialize::ItemIndex( items.toVector() ), threadCount);
 	}
 	
 	///we can process about 1k items per ms per thread, starting a thread costs less than 1 ms
 	threadCount = std::min<uint32_t>(threadCount, std::max<uint32_t>(1, items.size()/1000));
 	
 	detail::KVStats::State state(m_store, items);
+	state.run(threadCount);
 	
-	sserialize::ThreadPool::execute(detail::KVStats::Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
-	
-	return stats(std::move(state.d.front()));
+	return state.result();
 }
 
-KVStats::Stats KVStats::stats(detail::KVStats::Data && data) {
-	//calculate KeyInfo
-	auto & keyValueCount = data.keyValueCount;
-	auto valueInfoStore = std::make_unique<std::vector<detail::KVStats::ValueInfo> >(keyValueCount.size());
-	std::vector<detail::KVStats::KeyInfo> keyInfoStore;
-	std::unordered_map<uint32_t, detail::KVStats::KeyInfoPtr> keyInfo;
-	{
-		//get the keys and the number of values per key
-		for(const auto & x : keyValueCount) {
-			const std::pair<uint32_t, uint32_t> & kv = x.first;
-			const uint32_t & kvcount = x.second;
-			detail::KVStats::KeyInfoPtr & kiptr = keyInfo[kv.first];
-			if (!kiptr.valid()) {
-				kiptr.offset = keyInfoStore.size();
-				keyInfoStore.resize(keyInfoStore.size()+1);
-			}
-			detail::KVStats::KeyInfo & ki = keyInfoStore[kiptr.offset];
-			ki.count += kvcount;
-			ki.values.resize(ki.values.size()+1);
-		}
-		//init store
-		uint64_t offset = 0;
-		for(auto & x : keyInfo) {
-			detail::KVStats::KeyInfo & ki = keyInfoStore[x.second.offset];
-			ki.keyId = x.first;
-			ki.values.reposition(offset);
-			ki.values.rebind(valueInfoStore.get());
-			offset += ki.values.size();
-			ki.values.resize(0);
+KVStats::Stats KVStats::stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount) {
+	if (!m_histograms.cellCount()) {
+		return stats(cqr.flaten(threadCount), threadCount);
+	}
+	std::vector<uint32_t> fullMatchCells;
+	std::vector<sserialize::ItemIndex> items;
+	uint64_t exclusiveItemCount = 0;
+	for(auto it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		if (it.fullMatch()) {
+			std::vector<uint32_t> shared;
+			m_histograms.sharedItems(it.cellId(), shared);
+			exclusiveItemCount += m_histograms.exclusiveItemCount(it.cellId());
+			fullMatchCells.push_back(it.cellId());
+			items.emplace_back(std::move(shared));
 		}
-		//copy the values
-		for(const auto & x : keyValueCount) {
-			const std::pair<uint32_t, uint32_t> & kv = x.first;
-			detail::KVStats::KeyInfo & ki = keyInfoStore[ keyInfo[kv.first].offset ];
-			ki.values.resize(ki.values.size()+1);
-			ValueInfo & vi = ki.values.back();
-			vi.count = x.second;
-			vi.valueId = kv.second;
+		else {
+			items.emplace_back(it.idx());
 		}
 	}
-	return Stats(std::move(valueInfoStore), std::move(keyInfoStore), std::move(keyInfo));
+	//shared items of full-match cells may be part of other cells of cqr
+	sserialize::ItemIndex decodedItems( sserialize::ItemIndex::unite(items) );
+	if (decodedItems.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
+		decodedItems = sserialize::ItemIndex( decodedItems.toVector() );
+	}
+	
+	//adding the table of a cell is much cheaper than decoding its items, count about 10 items per table entry
+	uint64_t work = decodedItems.size() + exclusiveItemCount/10;
+	threadCount = std::max<uint32_t>(1, std::min<uint64_t>(threadCount, work/1000));
+	
+	detail::KVStats::State state(m_store, decodedItems);
+	state.histograms = &m_histograms;
+	state.cells = std::move(fullMatchCells);
+	state.run(threadCount);
+	
+	return stats(state.result());
 }
 
 KVStats::Stats KVStats::stats(detail::KVStats::SortedData && data) {
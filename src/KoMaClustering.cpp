@@ -1,69 +1,145 @@
 #include <liboscar/KoMaClustering.h>
 #include <sserialize/mt/ThreadPool.h>
+#include <algorithm>
 
 namespace liboscar{
 namespace detail {
 namespace KoMaClustering {
-void
-Data::update(const KeyValue &key, const uint32_t& itemId) {
-	keyValueItemMap[key].emplace_back(itemId);
-}
 Data::Data() {}
 
 State::State(const Static::OsmKeyValueObjectStore &store, const sserialize::ItemIndex &items,
 			 const kvclustering::KeyExclusions &keyExclusions,
 			 const kvclustering::KeyValueExclusions &keyValueExclusions,
-			 Data::KeyValueItemMap &keyValueItemMap,
-			 size_t numberOfThreads) :
+			 Data &data,
+			 uint32_t numberOfThreads) :
 		store(store),
 		items(items),
 		keyExclusions(keyExclusions),
 		keyValueExclusions(keyValueExclusions),
-		keyValueItemMap(keyValueItemMap),
-		numberOfThreads(numberOfThreads)
+		data(data),
+		chunkCount(numberOfChunks(items.size(), numberOfThreads)),
+		chunkCounts(chunkCount)
 {}
 
-void State::merge() {
-	for(auto & data : d) {
-		for(auto & keyValueItem : data.keyValueItemMap) {
-			auto & destination = keyValueItemMap[keyValueItem.first];
-			auto & itemVec = keyValueItem.second;
-			std::move(itemVec.begin(), itemVec.end(), std::back_inserter(destination));
+uint32_t State::numberOfChunks(std::size_t itemCount, uint32_t numberOfThreads) {
+	if (numberOfThreads <= 1) {
+		return 1;
+	}
+	std::size_t maxChunks = std::max<std::size_t>(1, itemCount / MinChunkSize);
+	return (uint32_t) std::min<std::size_t>(std::size_t(numberOfThreads)*ChunksPerThread, maxChunks);
+}
+
+std::size_t State::chunkBegin(uint32_t chunk) const {
+	return std::size_t(items.size()) * chunk / chunkCount;
+}
+
+void State::run(uint32_t threadCount) {
+	execute<CountWorker>(threadCount);
+	allocate();
+	execute<FillWorker>(threadCount);
+	chunkCounts.clear();
+}
+
+template<typename T_WORKER>
+void State::execute(uint32_t threadCount) {
+	chunkPos = 0;
+	if (threadCount <= 1) {
+		T_WORKER worker(this);
+		worker();
+	}
+	else {
+		sserialize::ThreadPool::execute(T_WORKER(this), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+}
+
+void State::allocate() {
+	//list id + 1 of every key-value pair
+	sserialize::OADHashTable<Data::KeyValue, uint32_t> listIds;
+	std::vector<std::size_t> counts;
+	data.keyValues.clear();
+	for(const ChunkCounts & cc : chunkCounts) {
+		for(const auto & x : cc) {
+			uint32_t & id = listIds[x.first];
+			if (!id) {
+				data.keyValues.emplace_back(x.first);
+				counts.emplace_back(0);
+				id = (uint32_t) counts.size();
+			}
+			counts[id-1] += x.second;
+		}
+	}
+	data.offsets.resize(counts.size()+1);
+	data.offsets[0] = 0;
+	for(std::size_t i(0), s(counts.size()); i < s; ++i) {
+		data.offsets[i+1] = data.offsets[i] + counts[i];
+	}
+	data.positions.resize(data.offsets.back());
+	//every chunk gets the slots following the ones of the previous chunks
+	std::vector<std::size_t> & next = counts;
+	std::copy(data.offsets.begin(), data.offsets.end()-1, next.begin());
+	for(ChunkCounts & cc : chunkCounts) {
+		for(auto & x : cc) {
+			std::size_t & slot = next[listIds[x.first]-1];
+			std::size_t count = x.second;
+			x.second = slot;
+			slot += count;
 		}
 	}
 }
 
-Worker::Worker(State * state):
-		state(state)
+CountWorker::CountWorker(State * state) :
+state(state)
+{}
+
+CountWorker::CountWorker(const CountWorker & other) :
+state(other.state)
 {}
-void Worker::operator()() {
 
-	size_t size = state->items.size();
+void CountWorker::operator()() {
 	while(true) {
-		std::size_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
-		if (p>= state->items.size())
+		uint32_t chunk = state->chunkPos.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= state->chunkCount) {
 			break;
-		for(std::size_t i(0); i < BlockSize && p < size; ++i, ++p) {
-			 uint32_t itemId = state->items.at(p);
-			 const auto &item = state->store.kvBaseItem(itemId);
-			//iterate over all key-value pairs
-			 for (uint32_t i = 0; i < item.size(); ++i) {
-				 d.update(std::make_pair(item.keyId(i), item.valueId(i)), p);
-			 }
-			 if(d.keyValueItemMap.size() > FlushSize)
-			 	flush();
-		 }
+		}
+		counts.clear();
+		for(std::size_t p(state->chunkBegin(chunk)), end(state->chunkBegin(chunk+1)); p < end; ++p) {
+			const auto &item = state->store.kvBaseItem(state->items.at(p));
+			for (uint32_t i = 0; i < item.size(); ++i) {
+				++counts[std::make_pair(item.keyId(i), item.valueId(i))];
+			}
+		}
+		state->chunkCounts[chunk].assign(counts.begin(), counts.end());
 	}
-	flush();
 }
 
-void Worker::flush() {
-	std::unique_lock<std::mutex> lck{state->m, std::defer_lock};
-	lck.lock();
-	auto & destination = state->d;
-	destination.emplace_back(std::move(d));
-	lck.unlock();
-	d.keyValueItemMap.clear();
+FillWorker::FillWorker(State * state) :
+state(state)
+{}
+
+FillWorker::FillWorker(const FillWorker & other) :
+state(other.state)
+{}
+
+void FillWorker::operator()() {
+	while(true) {
+		uint32_t chunk = state->chunkPos.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= state->chunkCount) {
+			break;
+		}
+		slots.clear();
+		for(const auto & x : state->chunkCounts[chunk]) {
+			slots[x.first] = x.second;
+		}
+		State::ChunkCounts().swap(state->chunkCounts[chunk]);
+		for(std::size_t p(state->chunkBegin(chunk)), end(state->chunkBegin(chunk+1)); p < end; ++p) {
+			const auto &item = state->store.kvBaseItem(state->items.at(p));
+			for (uint32_t i = 0; i < item.size(); ++i) {
+				std::size_t & slot = slots[std::make_pair(item.keyId(i), item.valueId(i))];
+				state->data.positions[slot] = uint32_t(p);
+				++slot;
+			}
+		}
+	}
 }
 
 
@@ -84,11 +160,8 @@ KoMaClustering::KoMaClustering(const Static::OsmKeyValueObjectStore &store,
 
 void KoMaClustering::preprocess()  {
 
-	auto state = detail::KoMaClustering::State(store, items, keyExclusions, keyValueExclusions, keyValueItemMap, threadCount);
-
-	sserialize::ThreadPool::execute(detail::KoMaClustering::Worker(&state), threadCount,
-	        sserialize::ThreadPool::CopyTaskTag());
-	state.merge();
+	detail::KoMaClustering::State state(store, items, keyExclusions, keyValueExclusions, keyValueItems, threadCount);
+	state.run(threadCount);
 	sort();
 }
 
@@ -105,34 +178,30 @@ std::vector<KoMaClustering::KeyInfo> KoMaClustering::topKeys(uint32_t /*k*/) {
 }
 
 std::vector<KoMaClustering::KeyValueInfo> KoMaClustering::topKeyValues(uint32_t k) {
-	std::vector<std::pair<KeyValuePair, std::uint32_t>> result;
+	std::vector<uint32_t> result;
 	auto &countVec = keyValueCountVec;
-	auto &itemMap = keyValueItemMap;
-	auto itI = countVec.begin();
+	uint32_t countVecSize = (uint32_t) countVec.size();
+	//exclusions change between calls, check them once per pair
+	std::vector<uint8_t> excluded(countVecSize, 0);
+	for(uint32_t i(0); i < countVecSize; ++i) {
+		const auto & kv = countVec[i].first;
+		excluded[i] = keyExclusions.contains(kv.first) || keyValueExclusions.contains(kv.first, kv.second);
+	}
+	uint32_t i = 0;
 	bool startParentsFound = false;
-	std::float_t maxNumberOfIntersections;
 
-	for (; itI < countVec.end(); ++itI) {
-		if(keyExclusions.contains(itI->first.first))
-			continue;
-		if(keyValueExclusions.contains(itI -> first.first, itI->first.second))
+	for (; i < countVecSize; ++i) {
+		if(excluded[i])
 			continue;
 
-
-		for (auto itJ = countVec.begin(); itJ < itI; ++itJ) {
-			if(keyExclusions.contains(itJ->first.first))
-				continue;
-			if(keyValueExclusions.contains(itJ -> first.first, itJ->first.second))
+		for (uint32_t j = 0; j < i; ++j) {
+			if(excluded[j])
 				continue;
-			const std::vector<uint32_t> &setI = itemMap[itI->first];
-			const std::vector<uint32_t> &setJ = itemMap[itJ->first];
-
-			maxNumberOfIntersections = (setI.size() + setJ.size()) / 200.0f;
-			if (!hasIntersection(setI.begin(), setI.end(), setJ.begin(), setJ.end(), maxNumberOfIntersections)) {
+			if (!intersects(j, i)) {
 				// no required amount of intersections
 				// add both parents to results
-				result.emplace_back(itJ->first, itJ->second);
-				result.emplace_back(itI->first, itI->second);
+				result.emplace_back(j);
+				result.emplace_back(i);
 				//end the algorithm
 				startParentsFound = true;
 				break;
@@ -142,40 +211,108 @@ std::vector<KoMaClustering::KeyValueInfo> KoMaClustering::topKeyValues(uint32_t
 			break;
 	}
 
-
-
 	if (startParentsFound) {
-		for (auto itK = itI + 1; itK < countVec.end() && result.size() < k; ++itK) {
-			if(keyExclusions.contains(itK->first.first)) {
-				continue;
-			}
-			if(keyValueExclusions.contains(itK -> first.first, itK->first.second)) {
+		for (uint32_t l = i + 1; l < countVecSize && result.size() < k; ++l) {
+			if(excluded[l]) {
 				continue;
 			}
 			bool discarded = false;
-			for (auto &parentPair : result) {
-				maxNumberOfIntersections = (parentPair.second + (*itK).second) / 200.0f;
-				const std::vector<uint32_t> &setI = itemMap[(*itK).first];
-				const std::vector<uint32_t> &setJ = itemMap[parentPair.first];
-				if (hasIntersection(setI.begin(), setI.end(), setJ.begin(), setJ.end(), maxNumberOfIntersections)) {
+			for (uint32_t parent : result) {
+				if (intersects(parent, l)) {
 					discarded = true;
 					break;
 				}
 			}
 			if (!discarded) {
 				//parent does not intersect with previous found parents; add to results
-				result.emplace_back(*itK);
+				result.emplace_back(l);
 			}
 		}
 	}
 	std::vector<KeyValueInfo> keyValueResult;
-	for (auto &keyValuePair : result) {
+	for (uint32_t pos : result) {
+		const auto & keyValuePair = countVec[pos];
 		keyValueResult.emplace_back(KeyValueInfo(KeyInfo(keyValuePair.first.first, keyValuePair.second),
 												 ValueInfo(keyValuePair.first.second, keyValuePair.second)));
 	}
 
 	return keyValueResult;
 }
+
+bool KoMaClustering::intersects(uint32_t i, uint32_t j) {
+	if (j < i) {
+		std::swap(i, j);
+	}
+	uint64_t cacheKey = (uint64_t(i) << 32) | j;
+	auto it = intersectionCache.find(cacheKey);
+	if (it != intersectionCache.end()) {
+		return it->second;
+	}
+	bool result = computeIntersects(i, j);
+	intersectionCache.emplace(cacheKey, result);
+	return result;
+}
+
+bool KoMaClustering::computeIntersects(uint32_t i, uint32_t j) {
+	const uint32_t * beginI = keyValueItems.begin(listIds[i]);
+	const uint32_t * endI = keyValueItems.end(listIds[i]);
+	const uint32_t * beginJ = keyValueItems.begin(listIds[j]);
+	const uint32_t * endJ = keyValueItems.end(listIds[j]);
+	std::size_t sizeI = endI - beginI;
+	std::size_t sizeJ = endJ - beginJ;
+	std::float_t maxNumberOfIntersections = (sizeI + sizeJ) / 200.0f;
+	//the intersection is at most as large as the smaller set
+	if (std::min(sizeI, sizeJ) <= maxNumberOfIntersections) {
+		return false;
+	}
+	//and at least as large as the overlap forced by the number of items
+	if (sizeI + sizeJ > items.size() && sizeI + sizeJ - items.size() > maxNumberOfIntersections) {
+		return true;
+	}
+	bool denseI = isDense(i);
+	bool denseJ = isDense(j);
+	if (denseI && denseJ) {
+		const std::vector<uint64_t> & bitsI = itemBitset(i);
+		const std::vector<uint64_t> & bitsJ = itemBitset(j);
+		std::uint32_t intersectionCount = 0;
+		for(std::size_t w(0), s(bitsI.size()); w < s; ++w) {
+			intersectionCount += __builtin_popcountll(bitsI[w] & bitsJ[w]);
+			if (intersectionCount > maxNumberOfIntersections) {
+				return true;
+			}
+		}
+		return false;
+	}
+	if (denseI || denseJ) {
+		const std::vector<uint64_t> & bits = itemBitset(denseI ? i : j);
+		const uint32_t * it = denseI ? beginJ : beginI;
+		const uint32_t * end = denseI ? endJ : endI;
+		std::uint32_t intersectionCount = 0;
+		for(; it != end; ++it) {
+			uint32_t p = *it;
+			if ((bits[p/64] >> (p%64)) & 0x1) {
+				if (++intersectionCount > maxNumberOfIntersections) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+	return hasIntersection(beginI, endI, beginJ, endJ, maxNumberOfIntersections);
+}
+
+const std::vector<uint64_t> & KoMaClustering::itemBitset(uint32_t i) {
+	std::vector<uint64_t> & bits = itemBitsets.at(i);
+	if (bits.empty()) {
+		bits.resize(items.size()/64+1, 0);
+		for(const uint32_t * it(keyValueItems.begin(listIds[i])), * end(keyValueItems.end(listIds[i])); it != end; ++it) {
+			uint32_t p = *it;
+			bits[p/64] |= uint64_t(1) << (p%64);
+		}
+	}
+	return bits;
+}
+
 template<typename It>
 bool KoMaClustering::hasIntersection(
 		It beginI, It endI, It beginJ, It endJ, const std::float_t &minNumber) {
@@ -268,25 +405,32 @@ std::list<KoMaClustering::ValueCountPair> KoMaClustering::findValuesToKey(std::u
 }
 
 void KoMaClustering::sort() {
-	// sort
-	for (auto &keyValueItems : keyValueItemMap){
-		std::sort(keyValueItems.second.begin(), keyValueItems.second.end());
-		keyValueCountVec.emplace_back(std::make_pair(keyValueItems.first, keyValueItems.second.size()));
-		keyValueCountVecSortedByIds.emplace_back(std::make_pair(keyValueItems.first, keyValueItems.second.size()));
+	// the item lists are already sorted
+	std::vector<uint32_t> order(keyValueItems.size());
+	for(uint32_t i(0), s(keyValueItems.size()); i < s; ++i) {
+		order[i] = i;
 	}
-	using KeyValue = std::pair<std::uint32_t, std::uint32_t>;
 	// sort all keyValues descending by itemCount to find the top KeyValues faster
-	std::sort(keyValueCountVec.begin(), keyValueCountVec.end(),
-			  [](std::pair<KeyValue , std::uint32_t> const &a,
-				 std::pair<KeyValue, std::uint32_t> const &b) {
-				  return a.second != b.second ? a.second > b.second : a.first < b.first;
-			  });
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+		uint32_t countA = keyValueItems.count(a);
+		uint32_t countB = keyValueItems.count(b);
+		return countA != countB ? countA > countB : keyValueItems.keyValues[a] < keyValueItems.keyValues[b];
+	});
+	keyValueCountVec.clear();
+	keyValueCountVec.reserve(order.size());
+	for(uint32_t id : order) {
+		keyValueCountVec.emplace_back(keyValueItems.keyValues[id], keyValueItems.count(id));
+	}
+	keyValueCountVecSortedByIds = keyValueCountVec;
+	using KeyValue = std::pair<std::uint32_t, std::uint32_t>;
 	std::sort(keyValueCountVecSortedByIds.begin(), keyValueCountVecSortedByIds.end(),
 			  [](std::pair<KeyValue, std::uint32_t> const &a,
 				 std::pair<KeyValue, std::uint32_t> const &b) {
 				  return a.first.first != b.first.first ? a.first.first < b.first.first : a.second > b.second;
 			  });
-
+	listIds = std::move(order);
+	itemBitsets.assign(keyValueCountVec.size(), std::vector<uint64_t>());
+	intersectionCache.clear();
 }
 
 } //end namespace liboscar
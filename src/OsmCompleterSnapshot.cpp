@@ -0,0 +1,172 @@
+#include <liboscar/OsmCompleterSnapshot.h>
+#include <sserialize/utility/exceptions.h>
+#include <algorithm>
+#include <cstring>
+
+namespace liboscar {
+
+OsmCompleterSnapshot::OsmCompleterSnapshot() :
+m_fingerprint(0)
+{}
+
+OsmCompleterSnapshot::OsmCompleterSnapshot(const sserialize::UByteArrayAdapter & d) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	SSERIALIZE_VERSION_MISSMATCH_CHECK(LIBOSCAR_OSM_COMPLETER_SNAPSHOT_VERSION, d.at(0), "liboscar::OsmCompleterSnapshot");
+	m_fingerprint = d.getUint64(1);
+	uint32_t sectionCount = d.getUint32(9);
+	OffsetType pos = 13;
+	OffsetType dataBegin = pos + OffsetType(sectionCount)*SectionInfoSize;
+	checkSize(d, dataBegin);
+	m_data = sserialize::UByteArrayAdapter(d, dataBegin);
+	for(uint32_t i(0); i < sectionCount; ++i, pos += SectionInfoSize) {
+		SectionInfo si;
+		si.type = SectionType(d.at(pos));
+		si.param = d.at(pos+1);
+		si.offset = d.getUint64(pos+2);
+		si.size = d.getUint64(pos+10);
+		checkSize(m_data, si.offset + si.size);
+		m_sections.push_back(si);
+	}
+}
+
+OsmCompleterSnapshot::~OsmCompleterSnapshot() {}
+
+bool OsmCompleterSnapshot::hasSection(SectionType type, uint8_t param) const {
+	return std::any_of(m_sections.begin(), m_sections.end(), [type, param](const SectionInfo & si) {
+		return si.type == type && si.param == param;
+	});
+}
+
+sserialize::UByteArrayAdapter OsmCompleterSnapshot::section(SectionType type, uint8_t param) const {
+	for(const SectionInfo & si : m_sections) {
+		if (si.type == type && si.param == param) {
+			return sserialize::UByteArrayAdapter(m_data, si.offset, si.size);
+		}
+	}
+	throw sserialize::MissingDataException("liboscar::OsmCompleterSnapshot: no section with type=" + std::to_string(int(type)) + " and param=" + std::to_string(int(param)));
+}
+
+void OsmCompleterSnapshot::create(uint64_t fingerprint, const std::vector<Section> & sections, sserialize::UByteArrayAdapter & dest) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	dest.putUint8(LIBOSCAR_OSM_COMPLETER_SNAPSHOT_VERSION);
+	dest.putUint64(fingerprint);
+	dest.putUint32(uint32_t(sections.size()));
+	OffsetType offset = 0;
+	for(const Section & s : sections) {
+		dest.putUint8(s.type);
+		dest.putUint8(s.param);
+		dest.putUint64(offset);
+		dest.putUint64(s.data.size());
+		offset += s.data.size();
+	}
+	for(const Section & s : sections) {
+		for(OffsetType i(0), size(s.data.size()); i < size; ++i) {
+			dest.putUint8(s.data.at(i));
+		}
+	}
+}
+
+uint64_t OsmCompleterSnapshot::fingerprint(const std::vector<sserialize::UByteArrayAdapter> & files) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	constexpr uint32_t SampleCount = 4096;
+	uint64_t h = 14695981039346656037ULL;
+	auto hashByte = [&h](uint8_t v) {
+		h ^= v;
+		h *= 1099511628211ULL;
+	};
+	auto hashUint64 = [&hashByte](uint64_t v) {
+		for(uint32_t i(0); i < 8; ++i) {
+			hashByte(uint8_t(v >> (8*i)));
+		}
+	};
+	for(const sserialize::UByteArrayAdapter & d : files) {
+		OffsetType size = d.size();
+		hashUint64(size);
+		if (size <= FullHashSize) {
+			for(OffsetType pos(0); pos < size; ++pos) {
+				hashByte(d.at(pos));
+			}
+			continue;
+		}
+		for(OffsetType pos(0); pos < HeaderSize; ++pos) {
+			hashByte(d.at(pos));
+		}
+		for(OffsetType pos(size-HeaderSize); pos < size; ++pos) {
+			hashByte(d.at(pos));
+		}
+		OffsetType step = std::max<OffsetType>(1, size/SampleCount);
+		for(OffsetType pos(0); pos < size; pos += step) {
+			hashByte(d.at(pos));
+		}
+	}
+	return h;
+}
+
+void OsmCompleterSnapshot::putCellInfos(const std::vector<CellDistanceBySphere::CellInfo> & ci, sserialize::UByteArrayAdapter & dest) {
+	dest.putUint32(uint32_t(ci.size()));
+	for(const CellDistanceBySphere::CellInfo & x : ci) {
+		putDouble(x.center.lat(), dest);
+		putDouble(x.center.lon(), dest);
+		putDouble(x.radius, dest);
+	}
+}
+
+void OsmCompleterSnapshot::putCellInfos(const std::vector<CellDistanceByAnulus::CellInfo> & ci, sserialize::UByteArrayAdapter & dest) {
+	dest.putUint32(uint32_t(ci.size()));
+	for(const CellDistanceByAnulus::CellInfo & x : ci) {
+		putDouble(x.center.lat(), dest);
+		putDouble(x.center.lon(), dest);
+		putDouble(x.innerRadius, dest);
+		putDouble(x.outerRadius, dest);
+	}
+}
+
+std::vector<CellDistanceBySphere::CellInfo> OsmCompleterSnapshot::sphereCellInfos(const sserialize::UByteArrayAdapter & d) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	uint32_t cellCount = d.getUint32(0);
+	checkSize(d, 4 + OffsetType(cellCount)*3*8);
+	std::vector<CellDistanceBySphere::CellInfo> result(cellCount);
+	OffsetType pos = 4;
+	for(CellDistanceBySphere::CellInfo & x : result) {
+		x.center = sserialize::spatial::GeoPoint(getDouble(d, pos), getDouble(d, pos+8));
+		x.radius = getDouble(d, pos+16);
+		pos += 3*8;
+	}
+	return result;
+}
+
+std::vector<CellDistanceByAnulus::CellInfo> OsmCompleterSnapshot::anulusCellInfos(const sserialize::UByteArrayAdapter & d) {
+	using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+	uint32_t cellCount = d.getUint32(0);
+	checkSize(d, 4 + OffsetType(cellCount)*4*8);
+	std::vector<CellDistanceByAnulus::CellInfo> result(cellCount);
+	OffsetType pos = 4;
+	for(CellDistanceByAnulus::CellInfo & x : result) {
+		x.center = sserialize::spatial::GeoPoint(getDouble(d, pos), getDouble(d, pos+8));
+		x.innerRadius = getDouble(d, pos+16);
+		x.outerRadius = getDouble(d, pos+24);
+		pos += 4*8;
+	}
+	return result;
+}
+
+void OsmCompleterSnapshot::putDouble(double v, sserialize::UByteArrayAdapter & dest) {
+	uint64_t tmp;
+	std::memcpy(&tmp, &v, sizeof(tmp));
+	dest.putUint64(tmp);
+}
+
+double OsmCompleterSnapshot::getDouble(const sserialize::UByteArrayAdapter & d, sserialize::UByteArrayAdapter::OffsetType pos) {
+	uint64_t tmp = d.getUint64(pos);
+	double v;
+	std::memcpy(&v, &tmp, sizeof(v));
+	return v;
+}
+
+void OsmCompleterSnapshot::checkSize(const sserialize::UByteArrayAdapter & d, sserialize::UByteArrayAdapter::OffsetType size) {
+	if (d.size() < size) {
+		throw sserialize::CorruptDataException("liboscar::OsmCompleterSnapshot: data is too small");
+	}
+}
+
+}//end namespace liboscar
@@ -0,0 +1,725 @@
+#include <liboscar/PreparedGeoPolygon.h>
+#include <liboscar/SimdVecD.h>
+#include <algorithm>
+#include <cmath>
+
+namespace liboscar {
+namespace {
+
+using detail::VecD;
+
+inline int parity(int mask) {
+	return __builtin_popcount(mask) & 0x1;
+}
+
+///(b-a) x (c-a) with x=lon and y=lat
+template<typename T>
+inline T orientation(T aLat, T aLon, T bLat, T bLon, T cLat, T cLon) {
+	return (bLon - aLon)*(cLat - aLat) - (bLat - aLat)*(cLon - aLon);
+}
+
+///Crossing test of the ray starting at (lat, lon) in positive lon direction with edge (a, b)
+///Uses the multiplied form of the intersection test to avoid the division
+inline bool crosses(double aLat, double aLon, double bLat, double bLon, double lat, double lon) {
+	if ((aLat > lat) == (bLat > lat)) {
+		return false;
+	}
+	double t = (lon - aLon)*(bLat - aLat) - (bLon - aLon)*(lat - aLat);
+	return (bLat > aLat) ? t < 0 : t > 0;
+}
+
+inline bool segmentsIntersect(double aLat, double aLon, double bLat, double bLon, double pLat, double pLon, double qLat, double qLon) {
+	if (std::max(aLat, bLat) < std::min(pLat, qLat) || std::min(aLat, bLat) > std::max(pLat, qLat) ||
+		std::max(aLon, bLon) < std::min(pLon, qLon) || std::min(aLon, bLon) > std::max(pLon, qLon))
+	{
+		return false;
+	}
+	double o1 = orientation(pLat, pLon, qLat, qLon, aLat, aLon);
+	double o2 = orientation(pLat, pLon, qLat, qLon, bLat, bLon);
+	double o3 = orientation(aLat, aLon, bLat, bLon, pLat, pLon);
+	double o4 = orientation(aLat, aLon, bLat, bLon, qLat, qLon);
+	return o1*o2 <= 0 && o3*o4 <= 0;
+}
+
+///An edge intersects an axis-parallel rectangle iff their bounding boxes overlap
+///and the corners of the rectangle are not all strictly on one side of the edge
+inline bool segmentIntersectsRect(double aLat, double aLon, double bLat, double bLon, double minLat, double minLon, double maxLat, double maxLon) {
+	if (std::max(aLat, bLat) < minLat || std::min(aLat, bLat) > maxLat ||
+		std::max(aLon, bLon) < minLon || std::min(aLon, bLon) > maxLon)
+	{
+		return false;
+	}
+	double s0 = orientation(aLat, aLon, bLat, bLon, minLat, minLon);
+	double s1 = orientation(aLat, aLon, bLat, bLon, minLat, maxLon);
+	double s2 = orientation(aLat, aLon, bLat, bLon, maxLat, minLon);
+	double s3 = orientation(aLat, aLon, bLat, bLon, maxLat, maxLon);
+	return !((s0 > 0 && s1 > 0 && s2 > 0 && s3 > 0) || (s0 < 0 && s1 < 0 && s2 < 0 && s3 < 0));
+}
+
+struct EdgeArrays {
+	const double * lat0;
+	const double * lon0;
+	const double * lat1;
+	const double * lon1;
+	std::size_t size;
+};
+
+///returns the parity of the number of edges crossed by the ray starting at (lat, lon)
+int crossingParity(const EdgeArrays & e, double lat, double lon) {
+	int result = 0;
+	std::size_t i = 0;
+#ifdef LIBOSCAR_SIMD_VECD
+	const VecD pLat = VecD::set1(lat);
+	const VecD pLon = VecD::set1(lon);
+	const VecD zero = VecD::set1(0.0);
+	for(; i+VecD::Width <= e.size; i += VecD::Width) {
+		VecD aLat = VecD::load(e.lat0+i);
+		VecD bLat = VecD::load(e.lat1+i);
+		int straddles = VecD::gt(aLat, pLat) ^ VecD::gt(bLat, pLat);
+		if (!straddles) {
+			continue;
+		}
+		VecD aLon = VecD::load(e.lon0+i);
+		VecD bLon = VecD::load(e.lon1+i);
+		VecD t = (pLon - aLon)*(bLat - aLat) - (bLon - aLon)*(pLat - aLat);
+		int up = VecD::gt(bLat, aLat);
+		int cross = straddles & ((up & VecD::lt(t, zero)) | (~up & VecD::gt(t, zero)));
+		result ^= parity(cross & VecD::Full);
+	}
+#endif
+	for(; i < e.size; ++i) {
+		result ^= int(crosses(e.lat0[i], e.lon0[i], e.lat1[i], e.lon1[i], lat, lon));
+	}
+	return result;
+}
+
+///point-vectorized variant: tests count points against all edges, result[i] holds the parity of point i
+void crossingParity(const EdgeArrays & e, const double * lat, const double * lon, std::size_t count, uint8_t * result) {
+	std::size_t i = 0;
+#ifdef LIBOSCAR_SIMD_VECD
+	const VecD zero = VecD::set1(0.0);
+	for(; i+VecD::Width <= count; i += VecD::Width) {
+		const VecD pLat = VecD::load(lat+i);
+		const VecD pLon = VecD::load(lon+i);
+		int mask = 0;
+		for(std::size_t j(0); j < e.size; ++j) {
+			const VecD aLat = VecD::set1(e.lat0[j]);
+			const VecD bLat = VecD::set1(e.lat1[j]);
+			int straddles = VecD::gt(aLat, pLat) ^ VecD::gt(bLat, pLat);
+			if (!straddles) {
+				continue;
+			}
+			const VecD aLon = VecD::set1(e.lon0[j]);
+			const VecD bLon = VecD::set1(e.lon1[j]);
+			VecD t = (pLon - aLon)*(bLat - aLat) - (bLon - aLon)*(pLat - aLat);
+			int cross = (e.lat1[j] > e.lat0[j]) ? VecD::lt(t, zero) : VecD::gt(t, zero);
+			mask ^= straddles & cross;
+		}
+		for(std::size_t k(0); k < VecD::Width; ++k) {
+			result[i+k] = (mask >> k) & 0x1;
+		}
+	}
+#endif
+	for(; i < count; ++i) {
+		result[i] = crossingParity(e, lat[i], lon[i]);
+	}
+}
+
+bool anyEdgeIntersectsSegment(const EdgeArrays & e, double pLat, double pLon, double qLat, double qLon) {
+	std::size_t i = 0;
+#ifdef LIBOSCAR_SIMD_VECD
+	const VecD vpLat = VecD::set1(pLat);
+	const VecD vpLon = VecD::set1(pLon);
+	const VecD vqLat = VecD::set1(qLat);
+	const VecD vqLon = VecD::set1(qLon);
+	const VecD sMinLat = VecD::set1(std::min(pLat, qLat));
+	const VecD sMaxLat = VecD::set1(std::max(pLat, qLat));
+	const VecD sMinLon = VecD::set1(std::min(pLon, qLon));
+	const VecD sMaxLon = VecD::set1(std::max(pLon, qLon));
+	const VecD zero = VecD::set1(0.0);
+	for(; i+VecD::Width <= e.size; i += VecD::Width) {
+		VecD aLat = VecD::load(e.lat0+i);
+		VecD aLon = VecD::load(e.lon0+i);
+		VecD bLat = VecD::load(e.lat1+i);
+		VecD bLon = VecD::load(e.lon1+i);
+		int bbox = VecD::ge(VecD::max(aLat, bLat), sMinLat) & VecD::le(VecD::min(aLat, bLat), sMaxLat) &
+					VecD::ge(VecD::max(aLon, bLon), sMinLon) & VecD::le(VecD::min(aLon, bLon), sMaxLon);
+		if (!bbox) {
+			continue;
+		}
+		VecD o1 = orientation(vpLat, vpLon, vqLat, vqLon, aLat, aLon);
+		VecD o2 = orientation(vpLat, vpLon, vqLat, vqLon, bLat, bLon);
+		VecD o3 = orientation(aLat, aLon, bLat, bLon, vpLat, vpLon);
+		VecD o4 = orientation(aLat, aLon, bLat, bLon, vqLat, vqLon);
+		if (bbox & VecD::le(o1*o2, zero) & VecD::le(o3*o4, zero)) {
+			return true;
+		}
+	}
+#endif
+	for(; i < e.size; ++i) {
+		if (segmentsIntersect(e.lat0[i], e.lon0[i], e.lat1[i], e.lon1[i], pLat, pLon, qLat, qLon)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool anyEdgeIntersectsRect(const EdgeArrays & e, double minLat, double minLon, double maxLat, double maxLon) {
+	std::size_t i = 0;
+#ifdef LIBOSCAR_SIMD_VECD
+	const VecD rMinLat = VecD::set1(minLat);
+	const VecD rMinLon = VecD::set1(minLon);
+	const VecD rMaxLat = VecD::set1(maxLat);
+	const VecD rMaxLon = VecD::set1(maxLon);
+	const VecD zero = VecD::set1(0.0);
+	for(; i+VecD::Width <= e.size; i += VecD::Width) {
+		VecD aLat = VecD::load(e.lat0+i);
+		VecD aLon = VecD::load(e.lon0+i);
+		VecD bLat = VecD::load(e.lat1+i);
+		VecD bLon = VecD::load(e.lon1+i);
+		int bbox = VecD::ge(VecD::max(aLat, bLat), rMinLat) & VecD::le(VecD::min(aLat, bLat), rMaxLat) &
+					VecD::ge(VecD::max(aLon, bLon), rMinLon) & VecD::le(VecD::min(aLon, bLon), rMaxLon);
+		if (!bbox) {
+			continue;
+		}
+		VecD s0 = orientation(aLat, aLon, bLat, bLon, rMinLat, rMinLon);
+		VecD s1 = orientation(aLat, aLon, bLat, bLon, rMinLat, rMaxLon);
+		VecD s2 = orientation(aLat, aLon, bLat, bLon, rMaxLat, rMinLon);
+		VecD s3 = orientation(aLat, aLon, bLat, bLon, rMaxLat, rMaxLon);
+		int allPos = VecD::gt(s0, zero) & VecD::gt(s1, zero) & VecD::gt(s2, zero) & VecD::gt(s3, zero);
+		int allNeg = VecD::lt(s0, zero) & VecD::lt(s1, zero) & VecD::lt(s2, zero) & VecD::lt(s3, zero);
+		if (bbox & ~allPos & ~allNeg) {
+			return true;
+		}
+	}
+#endif
+	for(; i < e.size; ++i) {
+		if (segmentIntersectsRect(e.lat0[i], e.lon0[i], e.lat1[i], e.lon1[i], minLat, minLon, maxLat, maxLon)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+///Coordinates of static geometry are copied into these buffers to feed the kernels
+struct PointBuffer {
+	std::vector<double> lat;
+	std::vector<double> lon;
+	template<typename T_GEOMETRY>
+	void assign(const T_GEOMETRY & geo) {
+		lat.clear();
+		lon.clear();
+		for(auto it(geo.cbegin()), end(geo.cend()); it != end; ++it) {
+			sserialize::spatial::GeoPoint gp(*it);
+			lat.push_back(gp.lat());
+			lon.push_back(gp.lon());
+		}
+	}
+	inline std::size_t size() const { return lat.size(); }
+};
+
+thread_local PointBuffer pointBuffer;
+
+template<typename T_EDGE_STORE>
+inline EdgeArrays slice(const T_EDGE_STORE & store, std::size_t begin, std::size_t end) {
+	return EdgeArrays{store.lat0.data()+begin, store.lon0.data()+begin, store.lat1.data()+begin, store.lon1.data()+begin, end-begin};
+}
+
+template<typename T_EDGE_STORE>
+inline EdgeArrays all(const T_EDGE_STORE & store) {
+	return slice(store, 0, store.size());
+}
+
+inline sserialize::spatial::GeoRect expanded(const sserialize::spatial::GeoRect & rect, double margin) {
+	if (margin <= 0) {
+		return rect;
+	}
+	return sserialize::spatial::GeoRect(rect.minLat()-margin, rect.maxLat()+margin, rect.minLon()-margin, rect.maxLon()+margin);
+}
+
+///squared distance of p to the segment a->b in the lat/lon plane
+inline double segmentDistanceSq(const sserialize::spatial::GeoPoint & p, const sserialize::spatial::GeoPoint & a, const sserialize::spatial::GeoPoint & b) {
+	double dLat = b.lat() - a.lat();
+	double dLon = b.lon() - a.lon();
+	double lenSq = dLat*dLat + dLon*dLon;
+	double t = 0;
+	if (lenSq > 0) {
+		t = ((p.lat() - a.lat())*dLat + (p.lon() - a.lon())*dLon) / lenSq;
+		t = std::max<double>(0, std::min<double>(1, t));
+	}
+	double eLat = a.lat() + t*dLat - p.lat();
+	double eLon = a.lon() + t*dLon - p.lon();
+	return eLat*eLat + eLon*eLon;
+}
+
+inline bool rectEnclosedBy(const sserialize::spatial::GeoRect & inner, const sserialize::spatial::GeoRect & outer) {
+	return outer.minLat() <= inner.minLat() && inner.maxLat() <= outer.maxLat() &&
+		outer.minLon() <= inner.minLon() && inner.maxLon() <= outer.maxLon();
+}
+
+}//end anonymous namespace
+
+void PreparedGeoPolygon::EdgeStore::push_back(double lat0, double lon0, double lat1, double lon1) {
+	this->lat0.push_back(lat0);
+	this->lon0.push_back(lon0);
+	this->lat1.push_back(lat1);
+	this->lon1.push_back(lon1);
+}
+
+void PreparedGeoPolygon::EdgeStore::reserve(std::size_t size) {
+	lat0.reserve(size);
+	lon0.reserve(size);
+	lat1.reserve(size);
+	lon1.reserve(size);
+}
+
+PreparedGeoPolygon::PreparedGeoPolygon() {}
+
+PreparedGeoPolygon::PreparedGeoPolygon(const sserialize::spatial::GeoPolygon & gp) :
+m_boundary(gp.boundary()),
+m_length(gp.length())
+{
+	addRing(gp.points());
+	buildIndex();
+}
+
+PreparedGeoPolygon::PreparedGeoPolygon(const std::vector<sserialize::spatial::GeoPolygon> & rings) {
+	bool first = true;
+	for(const sserialize::spatial::GeoPolygon & ring : rings) {
+		if (!ring.points().size()) {
+			continue;
+		}
+		const sserialize::spatial::GeoRect & b = ring.boundary();
+		if (first) {
+			m_boundary = b;
+			first = false;
+		}
+		else {
+			m_boundary = sserialize::spatial::GeoRect(
+				std::min(m_boundary.minLat(), b.minLat()), std::max(m_boundary.maxLat(), b.maxLat()),
+				std::min(m_boundary.minLon(), b.minLon()), std::max(m_boundary.maxLon(), b.maxLon())
+			);
+		}
+		m_length += ring.length();
+		addRing(ring.points());
+	}
+	buildIndex();
+}
+
+PreparedGeoPolygon::~PreparedGeoPolygon() {}
+
+PreparedGeoPolygon PreparedGeoPolygon::simplified(double epsilon) const {
+	using GeoPoint = sserialize::spatial::GeoPoint;
+	if (epsilon <= 0) {
+		return *this;
+	}
+	double epsilonSq = epsilon*epsilon;
+	std::vector<sserialize::spatial::GeoPolygon> rings;
+	std::vector<uint8_t> keep;
+	std::vector< std::pair<std::size_t, std::size_t> > stack;
+	for(std::size_t ring(0), s(ringCount()); ring < s; ++ring) {
+		const GeoPoint * points = m_vertices.data() + m_ringBegin[ring];
+		std::size_t size = m_ringBegin[ring+1] - m_ringBegin[ring];
+		keep.assign(size, 0);
+		keep.front() = 1;
+		keep.back() = 1;
+		stack.emplace_back(0, size-1);
+		while (stack.size()) {
+			std::size_t first = stack.back().first;
+			std::size_t last = stack.back().second;
+			stack.pop_back();
+			double maxDistSq = 0;
+			std::size_t maxPos = first;
+			for(std::size_t i(first+1); i < last; ++i) {
+				double d = segmentDistanceSq(points[i], points[first], points[last]);
+				if (d > maxDistSq) {
+					maxDistSq = d;
+					maxPos = i;
+				}
+			}
+			if (maxDistSq > epsilonSq) {
+				keep[maxPos] = 1;
+				stack.emplace_back(first, maxPos);
+				stack.emplace_back(maxPos, last);
+			}
+		}
+		std::vector<GeoPoint> ringPoints;
+		for(std::size_t i(0); i < size; ++i) {
+			if (keep[i]) {
+				ringPoints.push_back(points[i]);
+			}
+		}
+		//a closed ring needs at least 3 distinct vertices
+		if (ringPoints.size() < 4) {
+			ringPoints.assign(points, points+size);
+		}
+		rings.emplace_back(std::move(ringPoints));
+	}
+	PreparedGeoPolygon result(rings);
+	result.m_simplificationError = m_simplificationError + epsilon;
+	return result;
+}
+
+void PreparedGeoPolygon::addRing(const std::vector<sserialize::spatial::GeoPoint> & ring) {
+	if (!ring.size()) {
+		return;
+	}
+	m_ringAnchors.push_back(ring.front());
+	m_vertices.insert(m_vertices.end(), ring.begin(), ring.end());
+	m_ringBegin.push_back(m_vertices.size());
+	std::size_t s = ring.size();
+	//make sure that the ring is closed
+	bool closed = ring.front().lat() == ring.back().lat() && ring.front().lon() == ring.back().lon();
+	std::size_t edges = closed ? s-1 : s;
+	m_edges.reserve(m_edges.size()+edges);
+	for(std::size_t i(0); i < edges; ++i) {
+		const sserialize::spatial::GeoPoint & a = ring[i];
+		const sserialize::spatial::GeoPoint & b = ring[(i+1)%s];
+		m_edges.push_back(a.lat(), a.lon(), b.lat(), b.lon());
+	}
+}
+
+void PreparedGeoPolygon::buildIndex() {
+	m_index = EdgeIndex();
+	std::size_t edgeCount = m_edges.size();
+	double latRange = m_boundary.maxLat() - m_boundary.minLat();
+	double lonRange = m_boundary.maxLon() - m_boundary.minLon();
+	if (edgeCount <= IndexThreshold || latRange <= 0 || lonRange <= 0) {
+		return;
+	}
+	uint32_t dim = std::ceil(std::sqrt(double(edgeCount) / EdgesPerGridCell));
+	dim = std::max<uint32_t>(1, std::min<uint32_t>(dim, MaxGridDimension));
+	m_index.rows = dim;
+	m_index.cols = dim;
+	m_index.latStep = latRange / dim;
+	m_index.lonStep = lonRange / dim;
+	
+	//two passes: count, then fill
+	std::vector<uint32_t> cellCount(std::size_t(dim)*dim+1, 0);
+	std::vector<uint32_t> stripCount(dim+1, 0);
+	auto forEachEdgeRange = [this](std::size_t i, auto func) {
+		GridRange range;
+		gridRange(std::min(m_edges.lat0[i], m_edges.lat1[i]), std::min(m_edges.lon0[i], m_edges.lon1[i]),
+					std::max(m_edges.lat0[i], m_edges.lat1[i]), std::max(m_edges.lon0[i], m_edges.lon1[i]), range);
+		func(range);
+	};
+	for(std::size_t i(0); i < edgeCount; ++i) {
+		forEachEdgeRange(i, [&](const GridRange & range) {
+			for(uint32_t r(range.rowBegin); r <= range.rowEnd; ++r) {
+				stripCount[r] += 1;
+				for(uint32_t c(range.colBegin); c <= range.colEnd; ++c) {
+					cellCount[r*dim+c] += 1;
+				}
+			}
+		});
+	}
+	auto toOffsets = [](std::vector<uint32_t> & counts) {
+		uint32_t sum = 0;
+		for(uint32_t & x : counts) {
+			uint32_t tmp = x;
+			x = sum;
+			sum += tmp;
+		}
+		return sum;
+	};
+	auto resize = [](EdgeStore & store, std::size_t size) {
+		store.lat0.resize(size);
+		store.lon0.resize(size);
+		store.lat1.resize(size);
+		store.lon1.resize(size);
+	};
+	auto set = [this](EdgeStore & store, std::size_t pos, std::size_t i) {
+		store.lat0[pos] = m_edges.lat0[i];
+		store.lon0[pos] = m_edges.lon0[i];
+		store.lat1[pos] = m_edges.lat1[i];
+		store.lon1[pos] = m_edges.lon1[i];
+	};
+	resize(m_index.cellEdges, toOffsets(cellCount));
+	resize(m_index.stripEdges, toOffsets(stripCount));
+	m_index.cellBegin = cellCount;
+	m_index.stripBegin = stripCount;
+	for(std::size_t i(0); i < edgeCount; ++i) {
+		forEachEdgeRange(i, [&](const GridRange & range) {
+			for(uint32_t r(range.rowBegin); r <= range.rowEnd; ++r) {
+				set(m_index.stripEdges, stripCount[r]++, i);
+				for(uint32_t c(range.colBegin); c <= range.colEnd; ++c) {
+					set(m_index.cellEdges, cellCount[r*dim+c]++, i);
+				}
+			}
+		});
+	}
+}
+
+uint32_t PreparedGeoPolygon::row(double lat) const {
+	double r = (lat - m_boundary.minLat()) / m_index.latStep;
+	return r <= 0 ? 0 : std::min<uint32_t>(m_index.rows-1, uint32_t(r));
+}
+
+uint32_t PreparedGeoPolygon::col(double lon) const {
+	double c = (lon - m_boundary.minLon()) / m_index.lonStep;
+	return c <= 0 ? 0 : std::min<uint32_t>(m_index.cols-1, uint32_t(c));
+}
+
+bool PreparedGeoPolygon::gridRange(double minLat, double minLon, double maxLat, double maxLon, GridRange & range) const {
+	if (maxLat < m_boundary.minLat() || minLat > m_boundary.maxLat() || maxLon < m_boundary.minLon() || minLon > m_boundary.maxLon()) {
+		return false;
+	}
+	//row() and col() are monotone, hence a point shared by an edge and the query maps to a cell in both ranges
+	range.rowBegin = row(minLat);
+	range.rowEnd = row(maxLat);
+	range.colBegin = col(minLon);
+	range.colEnd = col(maxLon);
+	return true;
+}
+
+bool PreparedGeoPolygon::crossingParity(double lat, double lon) const {
+	if (hasIndex()) {
+		//edges not overlapping the strip can not straddle the ray
+		uint32_t r = row(lat);
+		return ::liboscar::crossingParity(slice(m_index.stripEdges, m_index.stripBegin[r], m_index.stripBegin[r+1]), lat, lon);
+	}
+	return ::liboscar::crossingParity(all(m_edges), lat, lon);
+}
+
+bool PreparedGeoPolygon::edgesIntersect(double pLat, double pLon, double qLat, double qLon) const {
+	if (hasIndex()) {
+		GridRange range;
+		if (!gridRange(std::min(pLat, qLat), std::min(pLon, qLon), std::max(pLat, qLat), std::max(pLon, qLon), range)) {
+			return false;
+		}
+		//scanning all edges is cheaper than visiting many cells with duplicated edges
+		if (range.size()*EdgesPerGridCell < m_edges.size()) {
+			for(uint32_t r(range.rowBegin); r <= range.rowEnd; ++r) {
+				for(uint32_t c(range.colBegin); c <= range.colEnd; ++c) {
+					uint32_t cell = r*m_index.cols+c;
+					if (anyEdgeIntersectsSegment(slice(m_index.cellEdges, m_index.cellBegin[cell], m_index.cellBegin[cell+1]), pLat, pLon, qLat, qLon)) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+	}
+	return anyEdgeIntersectsSegment(all(m_edges), pLat, pLon, qLat, qLon);
+}
+
+bool PreparedGeoPolygon::edgesIntersect(const sserialize::spatial::GeoRect & rect) const {
+	if (hasIndex()) {
+		GridRange range;
+		if (!gridRange(rect.minLat(), rect.minLon(), rect.maxLat(), rect.maxLon(), range)) {
+			return false;
+		}
+		if (range.size()*EdgesPerGridCell < m_edges.size()) {
+			for(uint32_t r(range.rowBegin); r <= range.rowEnd; ++r) {
+				for(uint32_t c(range.colBegin); c <= range.colEnd; ++c) {
+					uint32_t cell = r*m_index.cols+c;
+					if (m_index.cellBegin[cell] == m_index.cellBegin[cell+1]) {
+						continue;
+					}
+					if (anyEdgeIntersectsRect(slice(m_index.cellEdges, m_index.cellBegin[cell], m_index.cellBegin[cell+1]),
+												rect.minLat(), rect.minLon(), rect.maxLat(), rect.maxLon()))
+					{
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+	}
+	return anyEdgeIntersectsRect(all(m_edges), rect.minLat(), rect.minLon(), rect.maxLat(), rect.maxLon());
+}
+
+bool PreparedGeoPolygon::contains(double lat, double lon) const {
+	if (!m_boundary.contains(lat, lon)) {
+		return false;
+	}
+	return crossingParity(lat, lon);
+}
+
+bool PreparedGeoPolygon::contains(const sserialize::spatial::GeoPoint & p) const {
+	return contains(p.lat(), p.lon());
+}
+
+void PreparedGeoPolygon::contains(const double * lat, const double * lon, std::size_t count, uint8_t * result) const {
+	if (hasIndex()) {
+		for(std::size_t i(0); i < count; ++i) {
+			result[i] = contains(lat[i], lon[i]);
+		}
+	}
+	else {
+		::liboscar::crossingParity(all(m_edges), lat, lon, count, result);
+	}
+}
+
+bool PreparedGeoPolygon::containsAny(const double * lat, const double * lon, std::size_t count) const {
+	if (count < 8 || hasIndex()) {
+		for(std::size_t i(0); i < count; ++i) {
+			if (contains(lat[i], lon[i])) {
+				return true;
+			}
+		}
+		return false;
+	}
+	std::vector<uint8_t> tmp(count);
+	contains(lat, lon, count, tmp.data());
+	return std::find(tmp.begin(), tmp.end(), 1) != tmp.end();
+}
+
+bool PreparedGeoPolygon::intersectsChain(const double * lat, const double * lon, std::size_t count) const {
+	for(std::size_t i(1); i < count; ++i) {
+		if (edgesIntersect(lat[i-1], lon[i-1], lat[i], lon[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PreparedGeoPolygon::intersects(const sserialize::spatial::GeoRect & queryRect) const {
+	sserialize::spatial::GeoRect rect( expanded(queryRect, m_simplificationError) );
+	if (!m_boundary.overlap(rect)) {
+		return false;
+	}
+	//without an edge intersection the rect is either completely inside or completely outside
+	return edgesIntersect(rect) || contains(rect.minLat(), rect.minLon());
+}
+
+bool PreparedGeoPolygon::encloses(const sserialize::spatial::GeoRect & queryRect) const {
+	sserialize::spatial::GeoRect rect( expanded(queryRect, m_simplificationError) );
+	if (!rectEnclosedBy(rect, m_boundary)) {
+		return false;
+	}
+	return !edgesIntersect(rect) && contains(rect.minLat(), rect.minLon());
+}
+
+bool PreparedGeoPolygon::intersects(const sserialize::Static::spatial::GeoWay & way) const {
+	if (!m_boundary.overlap(way.boundary())) {
+		return false;
+	}
+	pointBuffer.assign(way);
+	return containsAny(pointBuffer.lat.data(), pointBuffer.lon.data(), pointBuffer.size()) ||
+		intersectsChain(pointBuffer.lat.data(), pointBuffer.lon.data(), pointBuffer.size());
+}
+
+bool PreparedGeoPolygon::intersects(const sserialize::Static::spatial::GeoPolygon & poly) const {
+	if (!m_boundary.overlap(poly.boundary())) {
+		return false;
+	}
+	pointBuffer.assign(poly);
+	if (!pointBuffer.size()) {
+		return false;
+	}
+	if (intersectsChain(pointBuffer.lat.data(), pointBuffer.lon.data(), pointBuffer.size())) {
+		return true;
+	}
+	//no boundary intersections: either one is inside the other or they are disjoint
+	if (contains(pointBuffer.lat.front(), pointBuffer.lon.front())) {
+		return true;
+	}
+	for(const sserialize::spatial::GeoPoint & anchor : m_ringAnchors) {
+		if (poly.contains(anchor)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PreparedGeoPolygon::encloses(const sserialize::Static::spatial::GeoPolygon & poly) const {
+	if (!rectEnclosedBy(poly.boundary(), m_boundary)) {
+		return false;
+	}
+	pointBuffer.assign(poly);
+	if (!pointBuffer.size()) {
+		return false;
+	}
+	if (intersectsChain(pointBuffer.lat.data(), pointBuffer.lon.data(), pointBuffer.size()) ||
+		!contains(pointBuffer.lat.front(), pointBuffer.lon.front()))
+	{
+		return false;
+	}
+	//a ring of this polygon inside poly is a hole (or an island within a hole) cutting into poly
+	for(const sserialize::spatial::GeoPoint & anchor : m_ringAnchors) {
+		if (poly.boundary().contains(anchor.lat(), anchor.lon()) && poly.contains(anchor)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PreparedGeoPolygon::enclosedBy(const sserialize::Static::spatial::GeoPolygon & poly) const {
+	if (!m_ringAnchors.size() || !rectEnclosedBy(m_boundary, poly.boundary())) {
+		return false;
+	}
+	pointBuffer.assign(poly);
+	if (intersectsChain(pointBuffer.lat.data(), pointBuffer.lon.data(), pointBuffer.size())) {
+		return false;
+	}
+	for(const sserialize::spatial::GeoPoint & anchor : m_ringAnchors) {
+		if (!poly.contains(anchor)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PreparedGeoPolygon::intersects(const sserialize::Static::spatial::GeoMultiPolygon & mp) const {
+	if (!m_boundary.overlap(mp.boundary()) || !m_ringAnchors.size()) {
+		return false;
+	}
+	//If no rings intersect then each of our rings lies completely within one face of mp.
+	//This face belongs to mp iff the number of rings of mp enclosing it is odd.
+	//Otherwise mp and this polygon intersect iff a ring of mp lies within this polygon.
+	std::vector<uint32_t> enclosingRings(m_ringAnchors.size(), 0);
+	auto checkRing = [&](const sserialize::Static::spatial::GeoPolygon & ring) -> bool {
+		if (!m_boundary.overlap(ring.boundary())) {
+			return false;
+		}
+		pointBuffer.assign(ring);
+		if (!pointBuffer.size()) {
+			return false;
+		}
+		if (intersectsChain(pointBuffer.lat.data(), pointBuffer.lon.data(), pointBuffer.size())) {
+			return true;
+		}
+		if (contains(pointBuffer.lat.front(), pointBuffer.lon.front())) {
+			return true;
+		}
+		const sserialize::spatial::GeoRect & ringBoundary = ring.boundary();
+		for(std::size_t i(0), s(m_ringAnchors.size()); i < s; ++i) {
+			const sserialize::spatial::GeoPoint & anchor = m_ringAnchors[i];
+			if (ringBoundary.contains(anchor.lat(), anchor.lon()) && ring.contains(anchor)) {
+				++enclosingRings[i];
+			}
+		}
+		return false;
+	};
+	for(uint32_t i(0), s(mp.outerPolygons().size()); i < s; ++i) {
+		if (checkRing(mp.outerPolygons().at(i))) {
+			return true;
+		}
+	}
+	for(uint32_t i(0), s(mp.innerPolygons().size()); i < s; ++i) {
+		if (checkRing(mp.innerPolygons().at(i))) {
+			return true;
+		}
+	}
+	for(uint32_t x : enclosingRings) {
+		if (x & 0x1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PreparedGeoPolygon::encloses(const sserialize::Static::spatial::GeoMultiPolygon & mp) const {
+	if (!rectEnclosedBy(mp.boundary(), m_boundary)) {
+		return false;
+	}
+	for(uint32_t i(0), s(mp.outerPolygons().size()); i < s; ++i) {
+		if (!encloses(mp.outerPolygons().at(i))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+}//end namespace liboscar
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <istream>
 #include <fstream>
+#include <queue>
 #include <liboscar/constants.h>
 #include <liboscar/SetOpTreePrivateGeo.h>
 #include <liboscar/tagcompleters.h>
@@ -11,6 +12,8 @@
 #include <liboscar/AdvancedCellOpTree.h>
 #include <liboscar/CellDistanceByAnulus.h>
 #include <liboscar/CellDistanceBySphere.h>
+#include <liboscar/CellDistanceByHull.h>
+#include <liboscar/CellItemRTree.h>
 #include <sserialize/search/StringCompleterPrivateMulti.h>
 #include <sserialize/search/StringCompleterPrivateGeoHierarchyUnclustered.h>
 #include <sserialize/Static/StringCompleter.h>
@@ -28,11 +31,15 @@ namespace Static {
 
 std::ostream & OsmCompleter::printStats(std::ostream & out) const {
 	m_tagCompleter->tagStore().printStats(out);
+	m_cqrfp.printStats(out);
 	return out;
 }
 
 OsmCompleter::OsmCompleter() :
-m_selectedGeoCompleter(0)
+m_selectedGeoCompleter(0),
+m_cellDistanceType(CDT_CENTER_OF_MASS),
+m_cqrfpTileCacheSize(0),
+m_cellItemDuplication(1.0)
 {}
 
 OsmCompleter::~OsmCompleter() {
@@ -73,6 +80,14 @@ void OsmCompleter::setCellDistance(CellDistanceType cdt, uint32_t threadCount) {
 		m_cellDistance.reset(new sserialize::Static::spatial::CellDistanceByCellCenter( m_store.cellCenterOfMass() ));
 		break;
 	case CDT_ANULUS:
+		if (m_snapshot.hasSection(liboscar::OsmCompleterSnapshot::ST_CELL_DISTANCE, cdt)) {
+			m_cellDistance.reset(
+				new liboscar::CellDistanceByAnulus(
+					liboscar::OsmCompleterSnapshot::anulusCellInfos(m_snapshot.section(liboscar::OsmCompleterSnapshot::ST_CELL_DISTANCE, cdt))
+				)
+			);
+			break;
+		}
 		m_cellDistance.reset(
 			new liboscar::CellDistanceByAnulus(
 				liboscar::CellDistanceByAnulus::cellInfo(m_store.regionArrangement(), threadCount)
@@ -80,25 +95,230 @@ void OsmCompleter::setCellDistance(CellDistanceType cdt, uint32_t threadCount) {
 		);
 		break;
 	case CDT_MIN_SPHERE:
-		m_cellDistance.reset(
-			new liboscar::CellDistanceBySphere(
-				liboscar::CellDistanceBySphere::minSpheres(m_store.regionArrangement(), threadCount)
-			)
-		);
-		break;
 	case CDT_SPHERE:
-		m_cellDistance.reset(
-			new liboscar::CellDistanceBySphere(
-				liboscar::CellDistanceBySphere::spheres(m_store.regionArrangement(), threadCount)
-			)
-		);
+		if (m_snapshot.hasSection(liboscar::OsmCompleterSnapshot::ST_CELL_DISTANCE, cdt)) {
+			m_cellDistance.reset(
+				new liboscar::CellDistanceBySphere(
+					liboscar::OsmCompleterSnapshot::sphereCellInfos(m_snapshot.section(liboscar::OsmCompleterSnapshot::ST_CELL_DISTANCE, cdt))
+				)
+			);
+		}
+		else if (cdt == CDT_MIN_SPHERE) {
+			m_cellDistance.reset(
+				new liboscar::CellDistanceBySphere(
+					liboscar::CellDistanceBySphere::minSpheres(m_store.regionArrangement(), threadCount)
+				)
+			);
+		}
+		else {
+			m_cellDistance.reset(
+				new liboscar::CellDistanceBySphere(
+					liboscar::CellDistanceBySphere::spheres(m_store.regionArrangement(), threadCount)
+				)
+			);
+		}
+		break;
+	case CDT_HULL:
+		if (!m_data.count(FC_CELL_HULLS) && m_snapshot.hasSection(liboscar::OsmCompleterSnapshot::ST_CELL_HULLS)) {
+			m_data[FC_CELL_HULLS] = m_snapshot.section(liboscar::OsmCompleterSnapshot::ST_CELL_HULLS);
+		}
+		if (!m_data.count(FC_CELL_HULLS)) {
+			sserialize::UByteArrayAdapter d( sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY) );
+			liboscar::CellDistanceByHull::create(m_store.regionArrangement(), d, threadCount);
+			d.resetPtrs();
+			m_data[FC_CELL_HULLS] = d;
+		}
+		m_cellDistance.reset( new liboscar::CellDistanceByHull(m_data[FC_CELL_HULLS]) );
 		break;
 	default:
 		throw sserialize::InvalidEnumValueException("CellDistanceType does not contain value: " + std::to_string(int(cdt)));
 		break;
 	};
 	
+	m_cellDistanceType = cdt;
 	m_cqrd = sserialize::Static::CQRDilator(m_cellDistance, store().cellGraph());
+	if (m_cellCenterIndex) {
+		setCellCenterIndex(true);
+	}
+	//the neighbors were computed with the old cell distance
+	m_cellNeighborLadder.reset();
+}
+
+void OsmCompleter::setCellCenterIndex(bool enabled) {
+	if (!enabled) {
+		m_cellCenterIndex.reset();
+		return;
+	}
+	m_cellCenterIndex = makeCellCenterIndex();
+}
+
+void OsmCompleter::setCellNeighborLadder(const std::vector<uint32_t> & radii, uint32_t threadCount) {
+	if (!m_cellDistance) {
+		throw sserialize::MissingDataException("OsmCompleter::setCellNeighborLadder: no cell distance, call energize() first");
+	}
+	if (!radii.size()) {
+		std::shared_ptr<liboscar::CellNeighborLadder> cnl;
+		if (m_snapshot.hasSection(liboscar::OsmCompleterSnapshot::ST_CELL_NEIGHBOR_LADDER, m_cellDistanceType)) {
+			cnl = std::make_shared<liboscar::CellNeighborLadder>(
+				m_snapshot.section(liboscar::OsmCompleterSnapshot::ST_CELL_NEIGHBOR_LADDER, m_cellDistanceType),
+				m_cellDistance
+			);
+		}
+		else if (m_data.count(FC_CELL_NEIGHBOR_LADDER)) {
+			cnl = std::make_shared<liboscar::CellNeighborLadder>(m_data[FC_CELL_NEIGHBOR_LADDER], m_cellDistance);
+		}
+		if (cnl && cnl->cellDistanceType() != m_cellDistanceType) {
+			throw sserialize::TypeMissMatchException(
+				"OsmCompleter::setCellNeighborLadder: the ladder was created with cell distance type " +
+				std::to_string(int(cnl->cellDistanceType())) + " but the current type is " + std::to_string(int(m_cellDistanceType))
+			);
+		}
+		m_cellNeighborLadder = cnl;
+		return;
+	}
+	std::shared_ptr<liboscar::CellCenterIndex> cci = m_cellCenterIndex;
+	if (!cci) {
+		cci = makeCellCenterIndex();
+	}
+	sserialize::UByteArrayAdapter d( sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY) );
+	liboscar::CellNeighborLadder::create(*m_cellDistance, m_cellDistanceType, *cci, radii, d, threadCount);
+	d.resetPtrs();
+	m_cellNeighborLadder = std::make_shared<liboscar::CellNeighborLadder>(d, m_cellDistance);
+}
+
+uint64_t OsmCompleter::snapshotFingerprint() const {
+	std::vector<sserialize::UByteArrayAdapter> files;
+	for(uint32_t i = FC_BEGIN; i < FC_END; ++i) {
+		files.push_back(data(FileConfig(i)));
+	}
+	std::string fn;
+	bool cmp;
+	if (fileNameFromPrefix(m_filesDir, FC_TAGSTORE_PHRASES, fn, cmp)) {
+		sserialize::UByteArrayAdapter::OpenFlags flags;
+		if (cmp) {
+			flags |= sserialize::UByteArrayAdapter::OpenFlags::Compressed();
+		}
+		files.push_back(sserialize::UByteArrayAdapter::open(fn, flags));
+	}
+	return liboscar::OsmCompleterSnapshot::fingerprint(files);
+}
+
+namespace {
+
+void writeData(const sserialize::UByteArrayAdapter & d, const std::string & fn, const std::string & caller) {
+	std::ofstream oFile(fn, std::ios::binary | std::ios::trunc);
+	std::vector<char> buffer;
+	for(sserialize::UByteArrayAdapter::OffsetType i(0), s(d.size()); i < s; ++i) {
+		buffer.push_back(char(d.at(i)));
+		if (buffer.size() >= 1024*1024 || i+1 == s) {
+			oFile.write(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	}
+	oFile.close();
+	if (!oFile) {
+		throw sserialize::IOException(caller + ": could not write " + fn);
+	}
+}
+
+}//end namespace
+
+void OsmCompleter::writeSnapshot(const std::string & fileName) const {
+	using Snapshot = liboscar::OsmCompleterSnapshot;
+	auto newSection = [](Snapshot::SectionType type, uint8_t param) {
+		return Snapshot::Section{type, param, sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY)};
+	};
+	std::vector<Snapshot::Section> sections;
+	if (auto cd = dynamic_cast<const liboscar::CellDistanceBySphere*>(m_cellDistance.get())) {
+		sections.push_back(newSection(Snapshot::ST_CELL_DISTANCE, m_cellDistanceType));
+		Snapshot::putCellInfos(cd->cellInfos(), sections.back().data);
+	}
+	else if (auto cd = dynamic_cast<const liboscar::CellDistanceByAnulus*>(m_cellDistance.get())) {
+		sections.push_back(newSection(Snapshot::ST_CELL_DISTANCE, m_cellDistanceType));
+		Snapshot::putCellInfos(cd->cellInfos(), sections.back().data);
+	}
+	if (m_data.count(FC_CELL_HULLS)) {
+		sections.push_back(Snapshot::Section{Snapshot::ST_CELL_HULLS, 0, m_data.at(FC_CELL_HULLS)});
+	}
+	if (m_cellNeighborLadder) {
+		sections.push_back(Snapshot::Section{Snapshot::ST_CELL_NEIGHBOR_LADDER, m_cellDistanceType, m_cellNeighborLadder->data()});
+	}
+	if (m_tagPhraseCompleter.priv()) {
+		sections.push_back(newSection(Snapshot::ST_TAG_PHRASES, 0));
+		m_tagPhraseCompleter->serialize(sections.back().data);
+	}
+	for(Snapshot::Section & s : sections) {
+		s.data.resetPtrs();
+	}
+	sserialize::UByteArrayAdapter d( sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY) );
+	Snapshot::create(snapshotFingerprint(), sections, d);
+	d.resetPtrs();
+	
+	std::string fn = fileName.size() ? fileName : fileNameFromFileConfig(m_filesDir, FC_SNAPSHOT, false);
+	writeData(d, fn, "OsmCompleter::writeSnapshot");
+}
+
+void OsmCompleter::writeCellFile(liboscar::FileConfig fc, uint32_t threadCount, const std::string & fileName) const {
+	sserialize::UByteArrayAdapter d( sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY) );
+	switch (fc) {
+	case FC_CELL_ITEM_RTREE:
+		liboscar::CellItemRTree::create(m_store, m_indexStore, d);
+		break;
+	case FC_CELL_HULLS:
+		//setCellDistance(CDT_HULL) may already have computed them
+		if (m_data.count(FC_CELL_HULLS)) {
+			d = m_data.at(FC_CELL_HULLS);
+		}
+		else {
+			liboscar::CellDistanceByHull::create(m_store.regionArrangement(), d, threadCount);
+		}
+		break;
+	case FC_CELL_NEIGHBOR_LADDER:
+		//the ladder depends on the cell distance, hence it is not recomputed here
+		if (!m_cellNeighborLadder) {
+			throw sserialize::MissingDataException("OsmCompleter::writeCellFile: no cell neighbor ladder, call setCellNeighborLadder() first");
+		}
+		d = m_cellNeighborLadder->data();
+		break;
+	case FC_CELL_KV_HISTOGRAMS:
+		liboscar::CellKVHistograms::create(m_store, m_indexStore, d, threadCount);
+		break;
+	default:
+		throw sserialize::InvalidEnumValueException("OsmCompleter::writeCellFile: unsupported file: " + toString(fc));
+	}
+	d.resetPtrs();
+	std::string fn = fileName.size() ? fileName : fileNameFromFileConfig(m_filesDir, fc, false);
+	writeData(d, fn, "OsmCompleter::writeCellFile");
+}
+
+std::shared_ptr<liboscar::CellCenterIndex> OsmCompleter::makeCellCenterIndex() const {
+	std::vector<liboscar::CellCenterIndex::CellInfo> ci;
+	if (auto cd = dynamic_cast<const liboscar::CellDistanceBySphere*>(m_cellDistance.get())) {
+		for(const auto & x : cd->cellInfos()) {
+			ci.push_back(liboscar::CellCenterIndex::CellInfo{x.center, x.radius});
+		}
+	}
+	else if (auto cd = dynamic_cast<const liboscar::CellDistanceByAnulus*>(m_cellDistance.get())) {
+		for(const auto & x : cd->cellInfos()) {
+			ci.push_back(liboscar::CellCenterIndex::CellInfo{x.center, x.outerRadius});
+		}
+	}
+	else if (auto cd = dynamic_cast<const liboscar::CellDistanceByHull*>(m_cellDistance.get())) {
+		//the bounding spheres over-select, the index refines its candidates by the hulls
+		for(uint32_t cellId(0), s(cd->cellCount()); cellId < s; ++cellId) {
+			ci.push_back(liboscar::CellCenterIndex::CellInfo{cd->center(cellId), cd->radius(cellId)});
+		}
+		auto cci = std::make_shared<liboscar::CellCenterIndex>(std::move(ci));
+		cci->setRefinement(m_cellDistance);
+		return cci;
+	}
+	else {
+		const auto & ccm = m_store.cellCenterOfMass();
+		for(uint32_t i(0), s(ccm.size()); i < s; ++i) {
+			ci.push_back(liboscar::CellCenterIndex::CellInfo{ccm.at(i), 0.0});
+		}
+	}
+	return std::make_shared<liboscar::CellCenterIndex>(std::move(ci));
 }
 
 void OsmCompleter::setCQRDilatorCache(uint32_t threshold, uint32_t threadCount) {
@@ -112,6 +332,26 @@ void OsmCompleter::setCQRDilatorCache(uint32_t threshold, uint32_t threadCount)
 	}
 }
 
+void OsmCompleter::setCQRFromPolygonTileCache(uint32_t maxTiles) {
+	m_cqrfpTileCacheSize = maxTiles;
+	if (m_cqrfp.valid()) {
+		m_cqrfp.setTileCacheSize(maxTiles);
+	}
+}
+
+void OsmCompleter::setCQRFromPolygonAutoAccuracy(const liboscar::CQRFromPolygon::AutoAccuracyParameters & params) {
+	m_cqrfpAutoAccuracy = params;
+	if (m_cqrfp.valid()) {
+		m_cqrfp.setAutoAccuracyParameters(params);
+	}
+}
+
+void OsmCompleter::precomputeRegionHulls(uint32_t threadCount) {
+	if (m_regionHulls) {
+		m_regionHulls->precompute(threadCount);
+	}
+}
+
 bool OsmCompleter::setTextSearcher(TextSearch::Type t, uint8_t pos) {
 	return m_textSearch.select(t, pos);
 }
@@ -275,6 +515,117 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 		std::cout << "OsmCompleter: No index available" << std::endl;
 		return;
 	}
+	
+	m_cqrfp = CQRFromPolygon(m_store, m_indexStore);
+	m_cqrfp.setTileCacheSize(m_cqrfpTileCacheSize);
+	m_cqrfp.setAutoAccuracyParameters(m_cqrfpAutoAccuracy);
+	m_regionHulls = std::make_shared<liboscar::RegionHullCache>(m_store);
+	
+	if (m_store.size()) {
+		const sserialize::Static::spatial::GeoHierarchy & gh = m_store.geoHierarchy();
+		uint64_t cellItemCount = 0;
+		for(uint32_t cellId(0), s(gh.cellSize()); cellId < s; ++cellId) {
+			cellItemCount += m_indexStore.idxSize(gh.cellItemsPtr(cellId));
+		}
+		m_cellItemDuplication = std::max<double>(1.0, double(cellItemCount) / m_store.size());
+	}
+	
+	{
+		std::string cellItemRTreeFn;
+		bool cmp;
+		if (fileNameFromPrefix(m_filesDir, FC_CELL_ITEM_RTREE, cellItemRTreeFn, cmp)) {
+			try {
+				OpenFlags flags;
+				if (cmp) {
+					flags |= OpenFlags::Compressed();
+				}
+				m_data[FC_CELL_ITEM_RTREE] = sserialize::UByteArrayAdapter::open(cellItemRTreeFn, flags);
+				m_cqrfp.setCellItemRTree(CellItemRTree(m_data[FC_CELL_ITEM_RTREE]));
+			}
+			catch (sserialize::Exception & e) {
+				sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize cell item rtree with the following error:\n") + e.what());
+			}
+		}
+	}
+	
+	{
+		std::string cellHullsFn;
+		bool cmp;
+		if (fileNameFromPrefix(m_filesDir, FC_CELL_HULLS, cellHullsFn, cmp)) {
+			OpenFlags flags;
+			if (cmp) {
+				flags |= OpenFlags::Compressed();
+			}
+			m_data[FC_CELL_HULLS] = sserialize::UByteArrayAdapter::open(cellHullsFn, flags);
+		}
+	}
+	
+	{
+		std::string cellNeighborLadderFn;
+		bool cmp;
+		if (fileNameFromPrefix(m_filesDir, FC_CELL_NEIGHBOR_LADDER, cellNeighborLadderFn, cmp)) {
+			try {
+				OpenFlags flags;
+				if (cmp) {
+					flags |= OpenFlags::Compressed();
+				}
+				sserialize::UByteArrayAdapter d( sserialize::UByteArrayAdapter::open(cellNeighborLadderFn, flags) );
+				//a ladder of a different dataset would silently dilate into the wrong cells
+				liboscar::CellNeighborLadder cnl(d, std::shared_ptr<liboscar::CellNeighborLadder::CellDistance>());
+				if (cnl.cellCount() != m_store.geoHierarchy().cellSize()) {
+					throw sserialize::CorruptDataException(
+						"OsmCompleter: " + cellNeighborLadderFn + " has " + std::to_string(cnl.cellCount()) +
+						" cells but the store has " + std::to_string(m_store.geoHierarchy().cellSize())
+					);
+				}
+				m_data[FC_CELL_NEIGHBOR_LADDER] = d;
+			}
+			catch (sserialize::Exception & e) {
+				sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize cell neighbor ladder with the following error:\n") + e.what());
+			}
+		}
+	}
+	
+	{
+		std::string cellKVHistogramsFn;
+		bool cmp;
+		if (fileNameFromPrefix(m_filesDir, FC_CELL_KV_HISTOGRAMS, cellKVHistogramsFn, cmp)) {
+			try {
+				OpenFlags flags;
+				if (cmp) {
+					flags |= OpenFlags::Compressed();
+				}
+				m_data[FC_CELL_KV_HISTOGRAMS] = sserialize::UByteArrayAdapter::open(cellKVHistogramsFn, flags);
+				m_cellKVHistograms = liboscar::CellKVHistograms(m_data[FC_CELL_KV_HISTOGRAMS]);
+			}
+			catch (sserialize::Exception & e) {
+				sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize cell kv histograms with the following error:\n") + e.what());
+			}
+		}
+	}
+	
+	{
+		std::string snapshotFn;
+		bool cmp;
+		if (fileNameFromPrefix(m_filesDir, FC_SNAPSHOT, snapshotFn, cmp)) {
+			try {
+				OpenFlags flags;
+				if (cmp) {
+					flags |= OpenFlags::Compressed();
+				}
+				liboscar::OsmCompleterSnapshot snapshot(sserialize::UByteArrayAdapter::open(snapshotFn, flags));
+				if (snapshot.fingerprint() == snapshotFingerprint()) {
+					m_snapshot = snapshot;
+				}
+				else {
+					std::cout << "OsmCompleter: Ignoring snapshot of a different dataset" << std::endl;
+				}
+			}
+			catch (sserialize::Exception & e) {
+				sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize snapshot with the following error:\n") + e.what());
+			}
+		}
+	}
 
 	if (m_data.count(FC_TEXT_SEARCH)) {
 		try {
@@ -310,7 +661,12 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 			m_tagNameCompleter = sserialize::RCPtrWrapper<TagNameCompleter>( new TagNameCompleter(tagStore) );
 			std::string tagStorePhrasesFn;
 			bool cmp;
-			if (fileNameFromPrefix(m_filesDir, FC_TAGSTORE_PHRASES, tagStorePhrasesFn, cmp) && !cmp) {
+			if (m_snapshot.hasSection(liboscar::OsmCompleterSnapshot::ST_TAG_PHRASES)) {
+				m_tagPhraseCompleter = sserialize::RCPtrWrapper<TagPhraseCompleter>(
+					new TagPhraseCompleter(m_indexStore, m_snapshot.section(liboscar::OsmCompleterSnapshot::ST_TAG_PHRASES))
+				);
+			}
+			else if (fileNameFromPrefix(m_filesDir, FC_TAGSTORE_PHRASES, tagStorePhrasesFn, cmp) && !cmp) {
 				std::ifstream iFile;
 				iFile.open(tagStorePhrasesFn);
 				m_tagPhraseCompleter = sserialize::RCPtrWrapper<TagPhraseCompleter>( new TagPhraseCompleter(tagStore, iFile) );
@@ -368,15 +724,18 @@ OsmCompleter::cqrComplete(
 		throw sserialize::UnsupportedFeatureException("OsmCompleter::cqrComplete data has no CellTextCompleter");
 	}
 	sserialize::Static::CellTextCompleter cmp( m_textSearch.get<liboscar::TextSearch::Type::GEOCELL>() );
-	CQRFromPolygon cqrfp(store(), indexStore());
-	CQRFromComplexSpatialQuery csq(ghsg, cqrfp);
+	CQRFromComplexSpatialQuery csq(ghsg, m_cqrfp, m_regionHulls);
 	if (!treedCQR) {
 		AdvancedCellOpTree opTree(cmp, cqrd(), csq, ghsg, cqrr());
+		opTree.setCellCenterIndex(m_cellCenterIndex);
+		opTree.setCellNeighborLadder(m_cellNeighborLadder);
 		opTree.parse(query);
 		return opTree.calc<sserialize::CellQueryResult>();
 	}
 	else {
 		AdvancedCellOpTree opTree(cmp, cqrd(), csq, ghsg, cqrr());
+		opTree.setCellCenterIndex(m_cellCenterIndex);
+		opTree.setCellNeighborLadder(m_cellNeighborLadder);
 		opTree.parse(query);
 		return opTree.calc<sserialize::TreedCellQueryResult>(threadCount).toCQR(threadCount);
 	}
@@ -398,6 +757,93 @@ OsmCompleter::cqrComplete(
 	return this->cqrComplete(query, m_ghsg, treedCQR, threadCount);
 }
 
+namespace {
+
+///number of distinct items in the cells of cqr by merging the cell indexes without creating the union
+uint32_t distinctItemCount(const sserialize::CellQueryResult & cqr) {
+	if (cqr.cellCount() == 1) {
+		return cqr.begin().idxSize();
+	}
+	struct Cursor {
+		sserialize::ItemIndex idx;
+		sserialize::ItemIndex::const_iterator it;
+		sserialize::ItemIndex::const_iterator end;
+	};
+	std::vector<Cursor> cursors;
+	cursors.reserve(cqr.cellCount());
+	for(sserialize::CellQueryResult::const_iterator it(cqr.begin()), end(cqr.end()); it != end; ++it) {
+		if (it.idxSize()) {
+			cursors.emplace_back();
+			Cursor & c = cursors.back();
+			c.idx = it.idx();
+			c.it = c.idx.begin();
+			c.end = c.idx.end();
+		}
+	}
+	//min-heap of (current item id, cursor)
+	using HeapEntry = std::pair<uint32_t, uint32_t>;
+	std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+	for(uint32_t i(0), s(cursors.size()); i < s; ++i) {
+		heap.emplace(*cursors[i].it, i);
+	}
+	uint32_t count = 0;
+	uint32_t last = std::numeric_limits<uint32_t>::max();
+	while (heap.size()) {
+		HeapEntry e = heap.top();
+		heap.pop();
+		if (!count || e.first != last) {
+			++count;
+			last = e.first;
+		}
+		Cursor & c = cursors[e.second];
+		++c.it;
+		if (c.it != c.end) {
+			heap.emplace(*c.it, e.second);
+		}
+	}
+	return count;
+}
+
+} //end namespace
+
+uint32_t
+OsmCompleter::cqrCount(const std::string & query, uint32_t threadCount) {
+	return distinctItemCount( cqrComplete(query, false, threadCount) );
+}
+
+OsmCompleter::CountEstimate
+OsmCompleter::cqrEstimate(const std::string & query, uint32_t threadCount) {
+	if (!m_textSearch.hasSearch(liboscar::TextSearch::Type::GEOCELL)) {
+		throw sserialize::UnsupportedFeatureException("OsmCompleter::cqrEstimate data has no CellTextCompleter");
+	}
+	sserialize::Static::CellTextCompleter cmp( m_textSearch.get<liboscar::TextSearch::Type::GEOCELL>() );
+	CQRFromComplexSpatialQuery csq(m_ghsg, m_cqrfp, m_regionHulls);
+	AdvancedCellOpTree opTree(cmp, cqrd(), csq, m_ghsg, cqrr());
+	opTree.setCellCenterIndex(m_cellCenterIndex);
+	opTree.setCellNeighborLadder(m_cellNeighborLadder);
+	opTree.parse(query);
+	AdvancedCellOpTree::CountEstimate tmp( opTree.estimate<sserialize::CellQueryResult>(m_cellItemDuplication, threadCount) );
+	CountEstimate result;
+	result.min = tmp.min;
+	result.max = tmp.max;
+	result.estimate = tmp.estimate;
+	return result;
+}
+
+bool
+OsmCompleter::cqrExists(const std::string & query, uint32_t threadCount) {
+	if (!m_textSearch.hasSearch(liboscar::TextSearch::Type::GEOCELL)) {
+		throw sserialize::UnsupportedFeatureException("OsmCompleter::cqrExists data has no CellTextCompleter");
+	}
+	sserialize::Static::CellTextCompleter cmp( m_textSearch.get<liboscar::TextSearch::Type::GEOCELL>() );
+	CQRFromComplexSpatialQuery csq(m_ghsg, m_cqrfp, m_regionHulls);
+	AdvancedCellOpTree opTree(cmp, cqrd(), csq, m_ghsg, cqrr());
+	opTree.setCellCenterIndex(m_cellCenterIndex);
+	opTree.setCellNeighborLadder(m_cellNeighborLadder);
+	opTree.parse(query);
+	return opTree.exists<sserialize::CellQueryResult>(threadCount);
+}
+
 sserialize::Static::spatial::GeoHierarchy::SubSet
 OsmCompleter::clusteredComplete(
 	const std::string& query,
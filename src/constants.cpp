@@ -23,6 +23,21 @@ FileConfig fileConfigFromString(const std::string & str) {
 	else if (str == "geosearch") {
 		return FC_GEO_SEARCH;
 	}
+	else if (str == "cellitemrtree") {
+		return FC_CELL_ITEM_RTREE;
+	}
+	else if (str == "cellhulls") {
+		return FC_CELL_HULLS;
+	}
+	else if (str == "cellneighborladder") {
+		return FC_CELL_NEIGHBOR_LADDER;
+	}
+	else if (str == "snapshot") {
+		return FC_SNAPSHOT;
+	}
+	else if (str == "cellkvhistograms") {
+		return FC_CELL_KV_HISTOGRAMS;
+	}
 	else {
 		return FC_INVALID;
 	}
@@ -42,6 +57,16 @@ std::string toString(FileConfig fc) {
 		return std::string("geosearch");
 	case (FC_TEXT_SEARCH):
 		return std::string("textsearch");
+	case (FC_CELL_ITEM_RTREE):
+		return std::string("cellitemrtree");
+	case (FC_CELL_HULLS):
+		return std::string("cellhulls");
+	case (FC_CELL_NEIGHBOR_LADDER):
+		return std::string("cellneighborladder");
+	case (FC_SNAPSHOT):
+		return std::string("snapshot");
+	case (FC_CELL_KV_HISTOGRAMS):
+		return std::string("cellkvhistograms");
 	default:
 		return "invalid";
 	}
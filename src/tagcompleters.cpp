@@ -133,8 +133,42 @@ m_indexStore(tagStore.itemIndexStore())
 		}
 	}
 }
+
+TagPhraseCompleter::TagPhraseCompleter(const sserialize::Static::ItemIndexStore & indexStore, const sserialize::UByteArrayAdapter & d) :
+m_indexStore(indexStore)
+{
+	sserialize::UByteArrayAdapter tmp(d);
+	tmp.resetGetPtr();
+	uint32_t entryCount = tmp.getUint32();
+	for(uint32_t i(0); i < entryCount; ++i) {
+		std::string phrase(tmp.getVlPackedUint32(), ' ');
+		for(char & c : phrase) {
+			c = char(tmp.getUint8());
+		}
+		std::vector<uint32_t> & indexIds = m_poiToId[phrase];
+		indexIds.resize(tmp.getVlPackedUint32());
+		for(uint32_t & x : indexIds) {
+			x = tmp.getVlPackedUint32();
+		}
+	}
+}
+
 TagPhraseCompleter::~TagPhraseCompleter() {}
 
+void TagPhraseCompleter::serialize(sserialize::UByteArrayAdapter & dest) const {
+	dest.putUint32(uint32_t(m_poiToId.size()));
+	for(const auto & x : m_poiToId) {
+		dest.putVlPackedUint32(uint32_t(x.first.size()));
+		for(char c : x.first) {
+			dest.putUint8(uint8_t(c));
+		}
+		dest.putVlPackedUint32(uint32_t(x.second.size()));
+		for(uint32_t indexId : x.second) {
+			dest.putVlPackedUint32(indexId);
+		}
+	}
+}
+
 const std::string TagPhraseCompleter::cmdString() const {
 	return std::string("p");
 }